@@ -16,6 +16,7 @@
 #include "bfu/dialog.h"
 #include "cache/cache.h"
 #include "cache/dialogs.h"
+#include "cache/disk.h"
 #include "config/options.h"
 #include "main/main.h"
 #include "main/object.h"
@@ -39,8 +40,24 @@
 static INIT_LIST_OF(struct cache_entry, cache_entries);
 
 static unsigned longlong cache_size;
+static int cache_entry_count;
 static int id_counter = 1;
 
+/* Hash indexes of the cache entries so that find_in_cache() only has to
+ * compare the entries sharing a bucket instead of the whole list. The
+ * @uri_index is keyed on the URI_BASE components of cached->uri and the
+ * @proxy_index on those of cached->proxy_uri. Both grow with the number of
+ * entries; the LRU order is still kept by the cache_entries list. */
+static struct list_head *uri_index;
+static struct list_head *proxy_index;
+static unsigned int cache_index_width;
+
+#define CACHE_INDEX_MIN_WIDTH	8
+#define CACHE_INDEX_MAX_WIDTH	20
+#define cache_index_size(width)	(1 << (width))
+#define cache_index_bucket(index, hash) \
+	(&(index)[(hash) & (cache_index_size(cache_index_width) - 1)])
+
 static void truncate_entry(struct cache_entry *cached, off_t offset, int final);
 
 /* Change 0 to 1 to enable cache debugging features (redirect stderr to a file). */
@@ -84,7 +101,7 @@ int
 get_cache_entry_count(void)
 {
 	ELOG
-	return list_size(&cache_entries);
+	return cache_entry_count;
 }
 
 int
@@ -113,22 +130,121 @@ get_cache_entry_loading_count(void)
 	return i;
 }
 
+static inline hash_value_T
+hash_uri_component(hash_value_T hash, const char *component, int length)
+{
+	ELOG
+	if (!component) return hash;
+
+	for (; length > 0; length--, component++)
+		hash = (hash << 5) - hash + (unsigned char) *component;
+
+	/* Separate the components so that "ab" + "c" != "a" + "bc". */
+	return (hash << 5) - hash + 0xff;
+}
+
+/* Hashes exactly the components compared by compare_uri() with URI_BASE, so
+ * that equal URIs always end up in the same bucket. */
+static hash_value_T
+hash_cache_uri(const struct uri *uri)
+{
+	ELOG
+	hash_value_T hash = uri->protocol * 31 + uri->ip_family;
+
+	hash = hash_uri_component(hash, uri->user, uri->userlen);
+	hash = hash_uri_component(hash, uri->password, uri->passwordlen);
+	hash = hash_uri_component(hash, uri->host, uri->hostlen);
+	hash = hash_uri_component(hash, uri->port, uri->portlen);
+	hash = hash_uri_component(hash, uri->data, uri->datalen);
+	if (uri->post)
+		hash = hash_uri_component(hash, uri->post, strlen(uri->post));
+
+	return hash;
+}
+
+static void
+add_to_cache_index(struct cache_entry *cached)
+{
+	ELOG
+	add_to_list(*cache_index_bucket(uri_index, cached->uri_link.hash),
+		    &cached->uri_link);
+	add_to_list(*cache_index_bucket(proxy_index, cached->proxy_link.hash),
+		    &cached->proxy_link);
+}
+
+/* Makes sure there is an index with enough buckets for one more entry.
+ * Returns 0 only if there is no index at all; failing to grow an existing
+ * index just makes the chains longer. */
+static int
+grow_cache_index(void)
+{
+	ELOG
+	struct list_head *new_uri_index, *new_proxy_index;
+	unsigned int width = cache_index_width;
+	struct cache_entry *cached;
+	int i;
+
+	if (!uri_index) {
+		width = CACHE_INDEX_MIN_WIDTH;
+	} else if (cache_entry_count < cache_index_size(width)
+		   || width >= CACHE_INDEX_MAX_WIDTH) {
+		return 1;
+	} else {
+		width++;
+	}
+
+	new_uri_index = (struct list_head *)mem_alloc(cache_index_size(width) * sizeof(*new_uri_index));
+	new_proxy_index = (struct list_head *)mem_alloc(cache_index_size(width) * sizeof(*new_proxy_index));
+	if (!new_uri_index || !new_proxy_index) {
+		mem_free_if(new_uri_index);
+		mem_free_if(new_proxy_index);
+		return !!uri_index;
+	}
+
+	for (i = 0; i < cache_index_size(width); i++) {
+		init_list(new_uri_index[i]);
+		init_list(new_proxy_index[i]);
+	}
+
+	mem_free_if(uri_index);
+	mem_free_if(proxy_index);
+	uri_index = new_uri_index;
+	proxy_index = new_proxy_index;
+	cache_index_width = width;
+
+	/* Rehash from the oldest so the recently used entries stay in front
+	 * of their buckets. */
+	foreachback (cached, cache_entries)
+		add_to_cache_index(cached);
+
+	return 1;
+}
+
 struct cache_entry *
 find_in_cache(struct uri *uri)
 {
 	ELOG
-	struct cache_entry *cached;
+	struct cache_hash_link *link;
+	struct list_head *bucket;
 	int proxy = (uri->protocol == PROTOCOL_PROXY);
+	hash_value_T hash;
 
-	foreach (cached, cache_entries) {
+	if (!uri_index) return NULL;
+
+	hash = hash_cache_uri(uri);
+	bucket = cache_index_bucket(proxy ? proxy_index : uri_index, hash);
+
+	foreach (link, *bucket) {
+		struct cache_entry *cached = link->cached;
 		struct uri *c_uri;
 
-		if (!cached->valid) continue;
+		if (!cached->valid || link->hash != hash) continue;
 
 		c_uri = proxy ? cached->proxy_uri : cached->uri;
 		if (!compare_uri(c_uri, uri, URI_BASE))
 			continue;
 
+		move_to_top_of_list(*bucket, link);
 		move_to_top_of_list(cache_entries, cached);
 
 		return cached;
@@ -149,6 +265,8 @@ get_cache_entry(struct uri *uri)
 
 	shrink_memory(0);
 
+	if (!grow_cache_index()) return NULL;
+
 	cached = (struct cache_entry *)mem_calloc(1, sizeof(*cached));
 	if (!cached) return NULL;
 
@@ -169,11 +287,19 @@ get_cache_entry(struct uri *uri)
 
 	init_list(cached->frag);
 	cached->cache_id = id_counter++;
+	cached->prefix_id = cached->cache_id;
 	object_nolock(cached, "cache_entry"); /* Debugging purpose. */
 
 	cached->box_item = add_listbox_leaf(&cache_browser, NULL, cached);
 
 	add_to_list(cache_entries, cached);
+	cache_entry_count++;
+
+	cached->uri_link.cached = cached;
+	cached->uri_link.hash = hash_cache_uri(cached->uri);
+	cached->proxy_link.cached = cached;
+	cached->proxy_link.hash = hash_cache_uri(cached->proxy_uri);
+	add_to_cache_index(cached);
 
 	return cached;
 }
@@ -201,9 +327,18 @@ get_validated_cache_entry(struct uri *uri, cache_mode_T cache_mode)
 
 	/* We only consider complete entries */
 	cached = find_in_cache(uri);
+	if (!cached) cached = get_disk_cache_entry(uri);
 	if (!cached || cached->incomplete)
 		return NULL;
 
+	/* Expired entries which can be revalidated are kept, so that the
+	 * request is conditional and the server can reply 304 Not Modified
+	 * instead of sending the whole document again. */
+	if (cached->expire && cache_entry_has_expired(cached)
+	    && cached->cache_mode <= CACHE_MODE_CHECK_IF_MODIFIED
+	    && (cached->last_modified || cached->etag)
+	    && !cached->redirect)
+		return NULL;
 
 	/* A bit of a gray zone. Delete the entry if the it has the strictest
 	 * cache mode and we don't want the most aggressive mode or we have to
@@ -341,6 +476,28 @@ frag_free(struct fragment *f)
 	mem_mmap_free(f, FRAGSIZE(f->real_length));
 }
 
+/* Grows @f in place so that it can hold at least @size bytes. Sequentially
+ * loaded entries thus keep all their data in a single mapping which mremap()
+ * can move around without copying, and get_cache_fragment() has nothing left
+ * to defragment. The reserve grows geometrically to keep the cost linear
+ * where mremap() is not available. */
+static struct fragment *
+frag_extend(struct fragment *f, off_t size)
+{
+	ELOG
+	struct fragment *nf;
+	off_t real_length = CACHE_PAD(MAX(size, f->real_length + f->real_length / 2));
+
+	nf = frag_realloc(f, real_length);
+	if (!nf) return NULL;
+
+	nf->prev->next = nf;
+	nf->next->prev = nf;
+	nf->real_length = real_length;
+
+	return nf;
+}
+
 
 /* Concatenate overlapping fragments. */
 static void
@@ -409,12 +566,15 @@ add_fragment(struct cache_entry *cached, off_t offset,
 	if (!length) return 0;
 
 	end_offset = offset + length;
-	if (cached->length < end_offset)
-		cached->length = end_offset;
 
 	/* id marks each entry, and change each time it's modified,
 	 * used in HTML renderer. */
 	cached->cache_id = id_counter++;
+	if (offset < cached->length)
+		cached->prefix_id = cached->cache_id;
+
+	if (cached->length < end_offset)
+		cached->length = end_offset;
 
 	/* Possibly insert the new data in the middle of existing fragment. */
 	foreach (f, cached->frag) {
@@ -435,6 +595,14 @@ add_fragment(struct cache_entry *cached, off_t offset,
 				/* ..and length is now total length. */
 				f->length = end_offset - f->offset;
 
+				ret = 1; /* It was enlarged. */
+			} else if ((nf = frag_extend(f, end_offset - f->offset))) {
+				/* Make room at the end of the fragment instead
+				 * of chaining a new one after it. */
+				f = nf;
+				enlarge_entry(cached, end_offset - f_end_offset);
+				f->length = end_offset - f->offset;
+
 				ret = 1; /* It was enlarged. */
 			} else {
 				/* We will reduce fragment length only to the
@@ -491,6 +659,64 @@ add_fragment(struct cache_entry *cached, off_t offset,
 	return 1;
 }
 
+static struct fragment *
+get_tail_fragment(struct cache_entry *cached, off_t offset)
+{
+	ELOG
+	struct fragment *f;
+
+	if (list_empty(cached->frag)) return NULL;
+
+	f = (struct fragment *)cached->frag.prev;
+	if (f->offset + f->length != offset) return NULL;
+
+	return f;
+}
+
+char *
+get_fragment_tail(struct cache_entry *cached, off_t offset,
+		  ssize_t size, ssize_t *avail)
+{
+	ELOG
+	struct fragment *f = get_tail_fragment(cached, offset);
+
+	if (!f) return NULL;
+
+	if (f->real_length - f->length < size) {
+		/* Grows geometrically, so this is rare. */
+		f = frag_extend(f, f->length + size);
+		if (!f) return NULL;
+	}
+
+	*avail = f->real_length - f->length;
+	return f->data + f->length;
+}
+
+int
+commit_fragment_tail(struct cache_entry *cached, off_t offset,
+		     ssize_t length)
+{
+	ELOG
+	struct fragment *f = get_tail_fragment(cached, offset);
+
+	if (!f || f->length + length > f->real_length) return -1;
+	if (!length) return 0;
+
+	f->length += length;
+	if (cached->length < offset + length)
+		cached->length = offset + length;
+	cached->cache_id = id_counter++;
+	enlarge_entry(cached, length);
+
+	/* Whatever was known beyond the new data is stale now, just like
+	 * with add_fragment(). */
+	truncate_entry(cached, offset + length, 0);
+
+	dump_frags(cached, "commit_fragment_tail");
+
+	return 1;
+}
+
 /* Try to defragment the cache entry. Defragmentation will not be possible
  * if there is a gap in the fragments; if we have bytes 1-100 in one fragment
  * and bytes 201-300 in the second, we must leave those two fragments separate
@@ -545,19 +771,26 @@ get_cache_fragment(struct cache_entry *cached)
 	     frag = frag->next)
 		new_frag_len += frag->length;
 
+	/* Extend the first fragment in place so that only the data of the
+	 * following fragments needs to be copied. */
 	/* XXX: If the defragmentation fails because of allocation failure,
 	 * fall back to return the first fragment and pretend all is well. */
 	/* FIXME: Is this terribly brain-dead? It corresponds to the semantic of
 	 * the code this extended version of the old defrag_entry() is supposed
 	 * to replace. --jonas */
-	new_frag = frag_alloc(new_frag_len);
-	if (!new_frag)
-		return first_frag->length ? first_frag : NULL;
-
-	new_frag->length = new_frag_len;
-	new_frag->real_length = new_frag_len;
+	if (new_frag_len > first_frag->real_length) {
+		new_frag = frag_realloc(first_frag, new_frag_len);
+		if (!new_frag)
+			return first_frag->length ? first_frag : NULL;
+
+		new_frag->prev->next = new_frag;
+		new_frag->next->prev = new_frag;
+		new_frag->real_length = new_frag_len;
+	} else {
+		new_frag = first_frag;
+	}
 
-	for (new_frag_len = 0, frag = first_frag;
+	for (new_frag_len = new_frag->length, frag = new_frag->next;
 	     frag != adj_frag;
 	     frag = frag->next) {
 		struct fragment *tmp = frag;
@@ -570,13 +803,35 @@ get_cache_fragment(struct cache_entry *cached)
 		frag_free(tmp);
 	}
 
-	add_to_list(cached->frag, new_frag);
+	new_frag->length = new_frag_len;
 
 	dump_frags(cached, "get_cache_fragment");
 
 	return new_frag;
 }
 
+struct fragment *
+detach_cache_fragment(struct cache_entry *cached, struct fragment *f)
+{
+	ELOG
+	enlarge_entry(cached, -f->length);
+	del_from_list(f);
+
+	cached->cache_id = id_counter++;
+	cached->prefix_id = cached->cache_id;
+	cached->length = f->offset;
+	cached->incomplete = 1;
+
+	return f;
+}
+
+void
+free_cache_fragment(struct fragment *f)
+{
+	ELOG
+	frag_free(f);
+}
+
 static void
 delete_fragment(struct cache_entry *cached, struct fragment *f)
 {
@@ -600,6 +855,7 @@ truncate_entry(struct cache_entry *cached, off_t offset, int final)
 	if (cached->length > offset) {
 		cached->length = offset;
 		cached->incomplete = 1;
+		cached->prefix_id = id_counter++;
 	}
 
 	foreach (f, cached->frag) {
@@ -610,6 +866,8 @@ truncate_entry(struct cache_entry *cached, off_t offset, int final)
 
 		if (size >= f->length) continue;
 
+		cached->prefix_id = id_counter++;
+
 		if (size > 0) {
 			enlarge_entry(cached, -(f->length - size));
 			f->length = size;
@@ -643,6 +901,9 @@ free_entry_to(struct cache_entry *cached, off_t offset)
 	struct fragment *f;
 
 	foreach (f, cached->frag) {
+		if (f->offset < offset)
+			cached->prefix_id = id_counter++;
+
 		if (f->offset + f->length <= offset) {
 			struct fragment *tmp = f;
 
@@ -674,6 +935,7 @@ delete_entry_content(struct cache_entry *cached)
 		frag_free(f);
 	}
 	cached->cache_id = id_counter++;
+	cached->prefix_id = cached->cache_id;
 	cached->length = 0;
 	cached->incomplete = 1;
 
@@ -720,9 +982,20 @@ void
 delete_cache_entry(struct cache_entry *cached)
 {
 	ELOG
+	if (cached->connections)
+		detach_cache_entry_connections(cached);
+
 	del_from_list(cached);
+	del_from_list(&cached->uri_link);
+	del_from_list(&cached->proxy_link);
+	cache_entry_count--;
 
 	done_cache_entry(cached);
+
+	if (!cache_entry_count) {
+		mem_free_set(&uri_index, NULL);
+		mem_free_set(&proxy_index, NULL);
+	}
 }
 
 
@@ -955,8 +1228,10 @@ shrinked_enough:
 
 	for (; (void *) cached != &cache_entries; ) {
 		cached = cached->next;
-		if (cached->prev->gc_target)
+		if (cached->prev->gc_target) {
+			demote_to_disk_cache(cached->prev);
 			delete_cache_entry(cached->prev);
+		}
 	}
 
 
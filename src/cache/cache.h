@@ -2,6 +2,7 @@
 #define EL__CACHE_CACHE_H
 
 #include "main/object.h"
+#include "util/hash.h"
 #include "util/lists.h"
 #include "util/time.h"
 
@@ -30,6 +31,15 @@ enum cache_mode {
 
 typedef int cache_mode_T;
 
+/* Link of a cache entry into one of the URI hash indexes used by
+ * find_in_cache(). */
+struct cache_hash_link {
+	LIST_HEAD_EL(struct cache_hash_link);
+
+	struct cache_entry *cached;
+	hash_value_T hash;
+};
+
 struct cache_entry {
 	OBJECT_HEAD(struct cache_entry);
 
@@ -42,6 +52,9 @@ struct cache_entry {
 	struct uri *proxy_uri;		/* Proxy identifier or same as @uri */
 	struct uri *redirect;		/* Location we were redirected to */
 
+	struct cache_hash_link uri_link;	/* Entry in the @uri index */
+	struct cache_hash_link proxy_link;	/* Entry in the @proxy_uri index */
+
 	char *head;		/* The protocol header */
 	char *content_type;	/* MIME type: <type> "/" <subtype> */
 	char *last_modified;	/* Latest modification date */
@@ -50,6 +63,11 @@ struct cache_entry {
 	char *encoding_info;	/* Encoding used during transfer */
 
 	unsigned int cache_id;		/* Change each time entry is modified. */
+	unsigned int prefix_id;		/* Change each time data already in the
+					 * entry are modified or dropped, but not
+					 * when data are only appended. */
+
+	int connections;		/* Number of connections loading it */
 
 	time_t seconds;			/* Access time. Used by 'If-Modified-Since' */
 
@@ -133,11 +151,30 @@ struct cache_entry *get_redirected_cache_entry(struct uri *uri);
 int add_fragment(struct cache_entry *cached, off_t offset,
 		 const char *data, ssize_t length);
 
+/* Returns room for at least @size bytes right after the data ending at
+ * @offset, so that the data can be produced in place instead of being copied
+ * in by add_fragment(). The amount of room is stored in *@avail and the
+ * pointer is valid until the next call. Returns NULL unless @offset is the
+ * end of the last fragment. */
+char *get_fragment_tail(struct cache_entry *cached, off_t offset,
+			ssize_t size, ssize_t *avail);
+
+/* Turns @length bytes written to the room from get_fragment_tail() into
+ * data. Returns -1 upon error and 1 otherwise, like add_fragment(). */
+int commit_fragment_tail(struct cache_entry *cached, off_t offset,
+			 ssize_t length);
+
 /* Defragments the cache entry and returns the resulting fragment containing the
  * complete source of all currently downloaded fragments. Returns NULL if
  * validation of the fragments fails. */
 struct fragment *get_cache_fragment(struct cache_entry *cached);
 
+/* Takes the fragment @f out of @cached without copying its data, leaving the
+ * entry incomplete. The caller owns @f and releases it with
+ * free_cache_fragment(). */
+struct fragment *detach_cache_fragment(struct cache_entry *cached, struct fragment *f);
+void free_cache_fragment(struct fragment *f);
+
 /* Should be called when creation of a new cache has been completed. Most
  * importantly, it will updates cached->incomplete. */
 void normalize_cache_entry(struct cache_entry *cached, off_t length);
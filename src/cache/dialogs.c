@@ -16,6 +16,7 @@
 #include "cache/cache.h"
 #include "cache/dialogs.h"
 #include "dialogs/edit.h"
+#include "document/document.h"
 #include "intl/libintl.h"
 #include "main/object.h"
 #include "protocol/uri.h"
@@ -57,11 +58,33 @@ get_cache_entry_text(struct listbox_item *item, struct terminal *term)
 	return get_uri_string(cached->uri, URI_PUBLIC);
 }
 
+struct formatted_info {
+	struct string *msg;
+	struct terminal *term;
+};
+
+static void
+add_formatted_document_info(struct document *document, void *data)
+{
+	ELOG
+	struct formatted_info *info = (struct formatted_info *)data;
+	struct terminal *term = info->term;
+
+	add_format_to_string(info->msg, "\n%s: %" OFF_PRINT_FORMAT " (",
+			     _("Formatted size", term),
+			     (off_print_T) get_document_memory_size(document));
+	add_format_to_string(info->msg, n_("%d line", "%d lines",
+					   document->height, term),
+			     document->height);
+	add_char_to_string(info->msg, ')');
+}
+
 static char *
 get_cache_entry_info(struct listbox_item *item, struct terminal *term)
 {
 	ELOG
 	struct cache_entry *cached = (struct cache_entry *)item->udata;
+	struct formatted_info info;
 	struct string msg;
 
 	if (item->type == BI_FOLDER) return NULL;
@@ -91,6 +114,9 @@ get_cache_entry_info(struct listbox_item *item, struct terminal *term)
 			     (off_print_T) cached->length);
 	add_format_to_string(&msg, "\n%s: %" OFF_PRINT_FORMAT, _("Loaded size", term),
 			     (off_print_T) cached->data_size);
+	info.msg = &msg;
+	info.term = term;
+	foreach_cached_document(cached, add_formatted_document_info, &info);
 	if (cached->content_type) {
 		add_format_to_string(&msg, "\n%s: %s", _("Content type", term),
 				     cached->content_type);
@@ -0,0 +1,933 @@
+/* Disk cache tier */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h> /* OS/2 needs this after sys/types.h */
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#include "elinks.h"
+
+#include "cache/cache.h"
+#include "cache/disk.h"
+#include "config/home.h"
+#include "config/options.h"
+#include "intl/libintl.h"
+#include "main/module.h"
+#include "main/select.h"
+#include "protocol/protocol.h"
+#include "protocol/proxy.h"
+#include "protocol/uri.h"
+#include "util/hash.h"
+#include "util/md5.h"
+#include "util/memory.h"
+#include "util/secsave.h"
+#include "util/string.h"
+#include "util/time.h"
+
+
+#define DISK_CACHE_DIRNAME	"cache/"
+#define DISK_CACHE_INDEX	"index"
+#define DISK_CACHE_LOCK		"lock"
+
+/* Longest URI stored in the index, so that its lines always fit into the
+ * buffer used by load_disk_cache_index(). */
+#define DISK_CACHE_MAX_URI	(4 * MAX_STR_LEN)
+
+/* Files not referenced by the index are only removed once they are this
+ * old (in seconds), because they may have been just written by another
+ * ELinks instance which did not save its index yet. */
+#define DISK_CACHE_ORPHAN_AGE	3600
+
+/* The documents are stored in files named after the MD5 digest of their
+ * content, so a document reachable through several URIs is stored once. */
+struct disk_cache_file {
+	char digest[MD5_HEX_DIGEST_LENGTH + 1];
+	off_t size;
+	int refcount;
+};
+
+struct disk_cache_record {
+	LIST_HEAD_EL(struct disk_cache_record);
+
+	char *uri;			/* URI_BASE string of the entry */
+	struct disk_cache_file *file;
+
+	char *content_type;
+	char *etag;
+	char *last_modified;
+
+	time_t seconds;			/* Time of the last validation */
+	time_t max_age;			/* Expiration time if @expire is set */
+	unsigned int expire:1;
+	cache_mode_T cache_mode;
+};
+
+/* A demoted document waiting for write_disk_cache_queue(). */
+struct disk_cache_write {
+	LIST_HEAD_EL(struct disk_cache_write);
+
+	struct disk_cache_record *record; /* Without the file yet */
+	char *head;			/* Taken from the cache entry */
+	struct fragment *frag;		/* Detached from the cache entry */
+};
+
+/* The records ordered from the most recently used. */
+static INIT_LIST_OF(struct disk_cache_record, disk_cache_records);
+static int disk_cache_record_count;
+
+static struct hash *disk_cache_uris;
+static struct hash *disk_cache_files;
+
+static unsigned longlong disk_cache_size;
+static long disk_cache_hits;
+static long disk_cache_misses;
+
+static INIT_LIST_OF(struct disk_cache_write, disk_cache_writes);
+
+static int disk_cache_loaded;
+static int disk_cache_dirty;
+
+
+unsigned longlong
+get_disk_cache_size(void)
+{
+	ELOG
+	return disk_cache_size;
+}
+
+int
+get_disk_cache_entry_count(void)
+{
+	ELOG
+	return disk_cache_record_count;
+}
+
+long
+get_disk_cache_hits(void)
+{
+	ELOG
+	return disk_cache_hits;
+}
+
+long
+get_disk_cache_misses(void)
+{
+	ELOG
+	return disk_cache_misses;
+}
+
+
+static char *
+get_disk_cache_path(const char *name)
+{
+	ELOG
+	char *xdg_config_home = get_xdg_config_home();
+
+	if (!xdg_config_home) return NULL;
+
+	return straconcat(xdg_config_home, DISK_CACHE_DIRNAME, name,
+			  (char *) NULL);
+}
+
+static struct disk_cache_file *
+get_disk_cache_file(const char *digest, off_t size)
+{
+	ELOG
+	struct disk_cache_file *file;
+	struct hash_item *item;
+
+	item = get_hash_item(disk_cache_files, digest, MD5_HEX_DIGEST_LENGTH);
+	if (item) return (struct disk_cache_file *)item->value;
+
+	file = (struct disk_cache_file *)mem_calloc(1, sizeof(*file));
+	if (!file) return NULL;
+
+	memcpy(file->digest, digest, MD5_HEX_DIGEST_LENGTH);
+	file->size = size;
+
+	if (!add_hash_item(disk_cache_files, file->digest,
+			   MD5_HEX_DIGEST_LENGTH, file)) {
+		mem_free(file);
+		return NULL;
+	}
+
+	disk_cache_size += size;
+
+	return file;
+}
+
+static void
+unref_disk_cache_file(struct disk_cache_file *file)
+{
+	ELOG
+	struct hash_item *item;
+	char *path;
+
+	if (--file->refcount > 0) return;
+
+	path = get_disk_cache_path(file->digest);
+	if (path) {
+		unlink(path);
+		mem_free(path);
+	}
+
+	item = get_hash_item(disk_cache_files, file->digest, MD5_HEX_DIGEST_LENGTH);
+	if (item) del_hash_item(disk_cache_files, item);
+
+	disk_cache_size -= file->size;
+	mem_free(file);
+}
+
+static void
+free_disk_cache_record(struct disk_cache_record *record)
+{
+	ELOG
+	mem_free_if(record->uri);
+	mem_free_if(record->content_type);
+	mem_free_if(record->etag);
+	mem_free_if(record->last_modified);
+	mem_free(record);
+}
+
+/* Removes the @record and the file it refers to unless some other record
+ * shares it. */
+static void
+delete_disk_cache_record(struct disk_cache_record *record)
+{
+	ELOG
+	struct hash_item *item;
+
+	item = get_hash_item(disk_cache_uris, record->uri, strlen(record->uri));
+	if (item) del_hash_item(disk_cache_uris, item);
+
+	del_from_list(record);
+	disk_cache_record_count--;
+	disk_cache_dirty = 1;
+
+	unref_disk_cache_file(record->file);
+	free_disk_cache_record(record);
+}
+
+/* Adds @record, replacing an older record of the same URI. On failure the
+ * file of @record is removed unless some other record refers to it, and the
+ * caller has to free @record. */
+static int
+add_disk_cache_record(struct disk_cache_record *record, int at_end)
+{
+	ELOG
+	struct hash_item *item;
+
+	/* The older record may hold the last reference to the same file. */
+	record->file->refcount++;
+
+	item = get_hash_item(disk_cache_uris, record->uri, strlen(record->uri));
+	if (item) delete_disk_cache_record((struct disk_cache_record *)item->value);
+
+	if (!add_hash_item(disk_cache_uris, record->uri,
+			   strlen(record->uri), record)) {
+		unref_disk_cache_file(record->file);
+		return 0;
+	}
+
+	if (at_end)
+		add_to_list_end(disk_cache_records, record);
+	else
+		add_to_list(disk_cache_records, record);
+
+	disk_cache_record_count++;
+
+	return 1;
+}
+
+/* Evict the least recently used records until the disk cache fits into
+ * its size limit. */
+static void
+shrink_disk_cache(void)
+{
+	ELOG
+	unsigned longlong opt_size = get_opt_long("document.cache.disk.size", NULL);
+
+	while (disk_cache_size > opt_size && !list_empty(disk_cache_records)) {
+		delete_disk_cache_record(disk_cache_records.prev);
+	}
+}
+
+static int
+is_disk_cache_digest(const char *name)
+{
+	ELOG
+	int i;
+
+	for (i = 0; i < MD5_HEX_DIGEST_LENGTH; i++)
+		if (!isxdigit((unsigned char) name[i]))
+			return 0;
+
+	return !name[i];
+}
+
+/* Remove stale files no record refers to, for example because ELinks
+ * crashed before writing the index. */
+static void
+remove_orphaned_disk_cache_files(const char *dirname)
+{
+	ELOG
+	struct dirent *entry;
+	DIR *directory = opendir(dirname);
+	time_t now = time(NULL);
+
+	if (!directory) return;
+
+	while ((entry = readdir(directory))) {
+		struct stat st;
+		char *path;
+
+		if (!is_disk_cache_digest(entry->d_name)
+		    || get_hash_item(disk_cache_files, entry->d_name,
+				     MD5_HEX_DIGEST_LENGTH))
+			continue;
+
+		path = straconcat(dirname, entry->d_name, (char *) NULL);
+		if (!path) continue;
+
+		if (!stat(path, &st) && S_ISREG(st.st_mode)
+		    && st.st_mtime + DISK_CACHE_ORPHAN_AGE < now)
+			unlink(path);
+
+		mem_free(path);
+	}
+
+	closedir(directory);
+}
+
+/* Whether the file named @digest is still in the @dirname directory. */
+static int
+is_disk_cache_file_present(const char *dirname, const char *digest)
+{
+	ELOG
+	struct stat st;
+	char *path = straconcat(dirname, digest, (char *) NULL);
+	int present;
+
+	if (!path) return 0;
+
+	present = !stat(path, &st) && S_ISREG(st.st_mode);
+	mem_free(path);
+
+	return present;
+}
+
+/* Adds the records listed in the index @fp to the end of the list. With
+ * @merge, URIs which already have a record and files which are gone from
+ * @dirname are skipped, so that the records other instances wrote can be
+ * picked up. */
+static void
+read_disk_cache_index(FILE *fp, const char *dirname, int merge)
+{
+	ELOG
+	/* Enough for the longest line flush_disk_cache() writes. */
+	char in_buffer[6 * MAX_STR_LEN];
+
+	while (fgets(in_buffer, sizeof(in_buffer), fp)) {
+		struct disk_cache_record *record;
+		struct disk_cache_file *file;
+		char *p, *q = in_buffer;
+		enum { DC_DIGEST = 0, DC_SIZE, DC_SECONDS, DC_MAX_AGE, DC_EXPIRE,
+		       DC_CACHE_MODE, DC_CONTENT_TYPE, DC_ETAG, DC_LAST_MODIFIED,
+		       DC_URI, DC_MEMBERS };
+		int member;
+		struct {
+			char *pos;
+			int len;
+		} members[DC_MEMBERS];
+
+		/* First find all members. */
+		for (member = DC_DIGEST; member < DC_MEMBERS; member++, q = ++p) {
+			p = strchr(q, '\t');
+			if (!p) {
+				if (member + 1 != DC_MEMBERS) break; /* last field ? */
+				p = strchr(q, '\n');
+				if (!p) break;
+			}
+
+			*p = '\0';
+			members[member].pos = q;
+			members[member].len = p - q;
+		}
+
+		if (member != DC_MEMBERS
+		    || !is_disk_cache_digest(members[DC_DIGEST].pos)
+		    || !members[DC_URI].len)
+			continue;	/* Invalid line. */
+
+		if (merge
+		    && (get_hash_item(disk_cache_uris, members[DC_URI].pos,
+				      members[DC_URI].len)
+			|| (!get_hash_item(disk_cache_files, members[DC_DIGEST].pos,
+					   MD5_HEX_DIGEST_LENGTH)
+			    && !is_disk_cache_file_present(dirname,
+							   members[DC_DIGEST].pos))))
+			continue;
+
+		file = get_disk_cache_file(members[DC_DIGEST].pos,
+					   (off_t) atoll(members[DC_SIZE].pos));
+		if (!file) continue;
+
+		record = (struct disk_cache_record *)mem_calloc(1, sizeof(*record));
+		if (record)
+			record->uri = memacpy(members[DC_URI].pos, members[DC_URI].len);
+
+		if (!record || !record->uri) {
+			if (record) free_disk_cache_record(record);
+			if (!file->refcount) {
+				file->refcount = 1;
+				unref_disk_cache_file(file);
+			}
+			continue;
+		}
+
+		record->file = file;
+		if (members[DC_CONTENT_TYPE].len)
+			record->content_type = memacpy(members[DC_CONTENT_TYPE].pos,
+						       members[DC_CONTENT_TYPE].len);
+		if (members[DC_ETAG].len)
+			record->etag = memacpy(members[DC_ETAG].pos,
+					       members[DC_ETAG].len);
+		if (members[DC_LAST_MODIFIED].len)
+			record->last_modified = memacpy(members[DC_LAST_MODIFIED].pos,
+							members[DC_LAST_MODIFIED].len);
+		record->seconds = str_to_time_t(members[DC_SECONDS].pos);
+		record->max_age = str_to_time_t(members[DC_MAX_AGE].pos);
+		record->expire = !!atoi(members[DC_EXPIRE].pos);
+		record->cache_mode = atoi(members[DC_CACHE_MODE].pos);
+
+		if (!add_disk_cache_record(record, 1))
+			free_disk_cache_record(record);
+	}
+}
+
+static int
+load_disk_cache_index(void)
+{
+	ELOG
+	char *dirname, *index;
+	FILE *fp;
+
+	if (!get_opt_bool("document.cache.disk.enable", NULL)
+	    || get_cmd_opt_bool("anonymous"))
+		return 0;
+
+	if (disk_cache_loaded) return 1;
+
+	dirname = get_disk_cache_path("");
+	if (!dirname) return 0;
+
+	if (mkdir(dirname, 0700) && errno != EEXIST) {
+		mem_free(dirname);
+		return 0;
+	}
+
+	disk_cache_uris = init_hash8();
+	disk_cache_files = init_hash8();
+	if (!disk_cache_uris || !disk_cache_files) {
+		if (disk_cache_uris) free_hash(&disk_cache_uris);
+		if (disk_cache_files) free_hash(&disk_cache_files);
+		mem_free(dirname);
+		return 0;
+	}
+
+	disk_cache_loaded = 1;
+
+	index = straconcat(dirname, DISK_CACHE_INDEX, (char *) NULL);
+	fp = index ? fopen(index, "rb") : NULL;
+	mem_free_if(index);
+
+	if (fp) {
+		read_disk_cache_index(fp, dirname, 0);
+		fclose(fp);
+	}
+
+	remove_orphaned_disk_cache_files(dirname);
+	mem_free(dirname);
+
+	/* The size limit may have been lowered since the last run. */
+	shrink_disk_cache();
+
+	return 1;
+}
+
+/* Locks the index against other instances while it is merged and written.
+ * Returns the descriptor to pass to unlock_disk_cache_index(), or -1 if
+ * locking is not possible, in which case the index is written anyway. */
+static int
+lock_disk_cache_index(const char *dirname)
+{
+	ELOG
+#ifdef F_LOCK
+	char *path = straconcat(dirname, DISK_CACHE_LOCK, (char *) NULL);
+	int fd;
+
+	if (!path) return -1;
+
+	fd = open(path, O_RDWR | O_CREAT, 0600);
+	mem_free(path);
+	if (fd < 0) return -1;
+
+	if (lockf(fd, F_LOCK, 0) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+#else
+	return -1;
+#endif
+}
+
+static void
+unlock_disk_cache_index(int fd)
+{
+	ELOG
+	if (fd < 0) return;
+
+#ifdef F_LOCK
+	lockf(fd, F_ULOCK, 0);
+#endif
+	close(fd);
+}
+
+/* The disk cache is written with secure_open_cache(), which unlike
+ * secure_open() also works with -no-connect and -session-ring, so that -dump
+ * can fill it. Sharing the directory between instances is safe: the files
+ * are named after the digest of their content and renamed into place, so
+ * two instances writing the same one write the same bytes, and a record
+ * whose file another instance evicted is dropped on lookup. Only the index
+ * is read, merged and rewritten, which is done under a lock. */
+static void
+flush_disk_cache(void)
+{
+	ELOG
+	struct disk_cache_record *record;
+	struct secure_save_info *ssi;
+	char *dirname, *index;
+	FILE *fp;
+	int lock;
+
+	if (!disk_cache_dirty) return;
+
+	dirname = get_disk_cache_path("");
+	if (!dirname) return;
+
+	index = straconcat(dirname, DISK_CACHE_INDEX, (char *) NULL);
+	if (!index) {
+		mem_free(dirname);
+		return;
+	}
+
+	lock = lock_disk_cache_index(dirname);
+
+	/* Other instances, for example -dump running in parallel, may have
+	 * written the index since it was loaded. Keep their records. */
+	fp = fopen(index, "rb");
+	if (fp) {
+		read_disk_cache_index(fp, dirname, 1);
+		fclose(fp);
+		shrink_disk_cache();
+	}
+	mem_free(dirname);
+
+	ssi = secure_open_cache(index);
+	mem_free(index);
+	if (!ssi) {
+		unlock_disk_cache_index(lock);
+		return;
+	}
+	foreach (record, disk_cache_records) {
+		if (secure_fprintf(ssi, "%s\t%" OFF_PRINT_FORMAT
+				   "\t%" TIME_PRINT_FORMAT "\t%" TIME_PRINT_FORMAT
+				   "\t%d\t%d\t%s\t%s\t%s\t%s\n",
+				   record->file->digest,
+				   (off_print_T) record->file->size,
+				   (time_print_T) record->seconds,
+				   (time_print_T) record->max_age,
+				   record->expire, record->cache_mode,
+				   empty_string_or_(record->content_type),
+				   empty_string_or_(record->etag),
+				   empty_string_or_(record->last_modified),
+				   record->uri) < 0)
+			break;
+	}
+
+	if (!secure_close(ssi)) disk_cache_dirty = 0;
+	unlock_disk_cache_index(lock);
+}
+
+
+/* Whether the index can hold @str. */
+static inline int
+is_disk_cache_field(const char *str)
+{
+	ELOG
+	return !str || (strlen(str) < MAX_STR_LEN / 2 && !strpbrk(str, "\t\r\n"));
+}
+
+/* Writes @head and @data into a file named after their digest unless it
+ * already exists. */
+static struct disk_cache_file *
+write_disk_cache_file(char *head, int headlen, char *data, off_t length)
+{
+	ELOG
+	struct disk_cache_file *file;
+	struct secure_save_info *ssi;
+	struct md5_context context;
+	md5_digest_bin_T digest_bin;
+	char digest[MD5_HEX_DIGEST_LENGTH + 1];
+	char prefix[32];
+	int prefixlen = snprintf(prefix, sizeof(prefix), "%d\n", headlen);
+	char *path;
+	int i;
+
+	init_md5(&context);
+	update_md5(&context, prefix, prefixlen);
+	if (headlen) update_md5(&context, head, headlen);
+	update_md5(&context, data, length);
+	done_md5(&context, digest_bin);
+
+	for (i = 0; i < MD5_DIGEST_LENGTH; i++)
+		snprintf(&digest[i * 2], 3, "%02x", digest_bin[i]);
+
+	if (get_hash_item(disk_cache_files, digest, MD5_HEX_DIGEST_LENGTH))
+		return get_disk_cache_file(digest, 0);
+
+	path = get_disk_cache_path(digest);
+	if (!path) return NULL;
+
+	ssi = secure_open_cache(path);
+	mem_free(path);
+	if (!ssi) return NULL;
+
+	secure_fputs(ssi, prefix);
+	if (!ssi->err
+	    && (fwrite(head, 1, headlen, ssi->fp) != headlen
+		|| fwrite(data, 1, length, ssi->fp) != length))
+		ssi->err = errno;
+
+	if (secure_close(ssi)) return NULL;
+
+	file = get_disk_cache_file(digest, prefixlen + headlen + length);
+	if (!file) {
+		path = get_disk_cache_path(digest);
+		if (path) {
+			unlink(path);
+			mem_free(path);
+		}
+	}
+
+	return file;
+}
+
+static void
+done_disk_cache_write(struct disk_cache_write *queued)
+{
+	ELOG
+	del_from_list(queued);
+	mem_free_if(queued->head);
+	if (queued->frag) free_cache_fragment(queued->frag);
+	mem_free(queued);
+}
+
+/* Bottom half writing the documents demote_to_disk_cache() queued, so that
+ * garbage_collection() does not hash and write them while freeing memory. */
+static void
+write_disk_cache_queue(void *data)
+{
+	ELOG
+	if (list_empty(disk_cache_writes)) return;
+
+	while (!list_empty(disk_cache_writes)) {
+		struct disk_cache_write *queued = (struct disk_cache_write *)disk_cache_writes.next;
+		struct disk_cache_record *record = queued->record;
+
+		record->file = write_disk_cache_file(queued->head,
+						     queued->head ? strlen(queued->head) : 0,
+						     queued->frag->data,
+						     queued->frag->length);
+		if (record->file && add_disk_cache_record(record, 0))
+			disk_cache_dirty = 1;
+		else
+			free_disk_cache_record(record);
+
+		done_disk_cache_write(queued);
+	}
+
+	shrink_disk_cache();
+	flush_disk_cache();
+}
+
+void
+demote_to_disk_cache(struct cache_entry *cached)
+{
+	ELOG
+	struct disk_cache_write *queued;
+	struct disk_cache_record *record;
+	struct fragment *frag;
+	char *uri;
+
+	/* Only complete documents which may be served from cache. */
+	if (cached->incomplete || !cached->valid || cached->redirect
+	    || cached->cgi || cached->uri->post
+	    || cached->cache_mode > CACHE_MODE_CHECK_IF_MODIFIED
+	    || (cached->uri->protocol != PROTOCOL_HTTP
+		&& cached->uri->protocol != PROTOCOL_HTTPS))
+		return;
+
+	if (!is_disk_cache_field(cached->content_type)
+	    || !is_disk_cache_field(cached->etag)
+	    || !is_disk_cache_field(cached->last_modified))
+		return;
+
+	if (!load_disk_cache_index()) return;
+
+	frag = get_cache_fragment(cached);
+	if (!frag || frag->offset || frag->length != cached->length)
+		return;
+
+	uri = get_uri_string(cached->uri, URI_BASE);
+	if (!uri) return;
+
+	if (strlen(uri) > DISK_CACHE_MAX_URI || strpbrk(uri, "\t\r\n")) {
+		mem_free(uri);
+		return;
+	}
+
+	record = (struct disk_cache_record *)mem_calloc(1, sizeof(*record));
+	if (!record) {
+		mem_free(uri);
+		return;
+	}
+
+	record->uri = uri;
+	record->content_type = null_or_stracpy(cached->content_type);
+	record->etag = null_or_stracpy(cached->etag);
+	record->last_modified = null_or_stracpy(cached->last_modified);
+	record->seconds = cached->seconds;
+	record->max_age = timeval_to_seconds(&cached->max_age);
+	record->expire = cached->expire;
+	record->cache_mode = cached->cache_mode;
+
+	queued = (struct disk_cache_write *)mem_calloc(1, sizeof(*queued));
+	if (!queued) {
+		free_disk_cache_record(record);
+		return;
+	}
+
+	if (register_bottom_half(write_disk_cache_queue, NULL)) {
+		free_disk_cache_record(record);
+		mem_free(queued);
+		return;
+	}
+
+	/* The entry is deleted right after this, so its data is moved to the
+	 * queue rather than copied. */
+	queued->record = record;
+	queued->head = cached->head;
+	cached->head = NULL;
+	queued->frag = detach_cache_fragment(cached, frag);
+	add_to_list_end(disk_cache_writes, queued);
+}
+
+
+static struct cache_entry *
+read_disk_cache_record(struct disk_cache_record *record, struct uri *uri)
+{
+	ELOG
+	struct cache_entry *cached = NULL;
+	char *path = get_disk_cache_path(record->file->digest);
+	char *data, *head, *end;
+	size_t size = record->file->size;
+	long headlen;
+	off_t bodylen;
+	FILE *fp;
+
+	if (!path) return NULL;
+
+	fp = fopen(path, "rb");
+	mem_free(path);
+	if (!fp) return NULL;
+
+	data = (char *)mem_alloc(size + 1);
+	if (!data) {
+		fclose(fp);
+		return NULL;
+	}
+
+	if (fread(data, 1, size, fp) != size) goto end;
+	data[size] = '\0';
+
+	headlen = strtol(data, &end, 10);
+	if (*end != '\n' || headlen < 0 || headlen > size - (end + 1 - data))
+		goto end;
+
+	head = end + 1;
+	bodylen = size - (head + headlen - data);
+
+	cached = get_cache_entry(uri);
+	if (!cached) goto end;
+
+	if (headlen)
+		mem_free_set(&cached->head, memacpy(head, headlen));
+
+	if (add_fragment(cached, 0, head + headlen, bodylen) < 0) {
+		delete_cache_entry(cached);
+		cached = NULL;
+		goto end;
+	}
+
+	normalize_cache_entry(cached, bodylen);
+
+	mem_free_set(&cached->content_type, null_or_stracpy(record->content_type));
+	mem_free_set(&cached->etag, null_or_stracpy(record->etag));
+	mem_free_set(&cached->last_modified, null_or_stracpy(record->last_modified));
+	cached->seconds = record->seconds;
+	cached->expire = record->expire;
+	if (cached->expire)
+		timeval_from_seconds(&cached->max_age, record->max_age);
+	cached->cache_mode = record->cache_mode;
+
+end:
+	mem_free(data);
+	fclose(fp);
+
+	return cached;
+}
+
+struct cache_entry *
+get_disk_cache_entry(struct uri *uri)
+{
+	ELOG
+	struct disk_cache_record *record;
+	struct cache_entry *cached;
+	struct hash_item *item;
+	struct uri *proxied_uri;
+	char *key;
+
+	if (uri->post || !load_disk_cache_index()) return NULL;
+
+	proxied_uri = get_proxied_uri(uri);
+	if (!proxied_uri) return NULL;
+
+	if (proxied_uri->protocol != PROTOCOL_HTTP
+	    && proxied_uri->protocol != PROTOCOL_HTTPS) {
+		done_uri(proxied_uri);
+		return NULL;
+	}
+
+	key = get_uri_string(proxied_uri, URI_BASE);
+	done_uri(proxied_uri);
+	if (!key) return NULL;
+
+	item = get_hash_item(disk_cache_uris, key, strlen(key));
+	mem_free(key);
+
+	if (!item) {
+		disk_cache_misses++;
+		return NULL;
+	}
+
+	record = (struct disk_cache_record *)item->value;
+	cached = read_disk_cache_record(record, uri);
+	if (!cached) {
+		/* The file is gone or broken. */
+		delete_disk_cache_record(record);
+		disk_cache_misses++;
+		return NULL;
+	}
+
+	move_to_top_of_list(disk_cache_records, record);
+	disk_cache_dirty = 1;
+	disk_cache_hits++;
+
+	return cached;
+}
+
+
+static void
+done_disk_cache(struct module *module)
+{
+	ELOG
+	struct hash_item *item;
+	int i;
+
+	if (!disk_cache_loaded) return;
+
+	write_disk_cache_queue(NULL);
+	flush_disk_cache();
+
+	while (!list_empty(disk_cache_records)) {
+		struct disk_cache_record *record = (struct disk_cache_record *)disk_cache_records.next;
+
+		del_from_list(record);
+		free_disk_cache_record(record);
+	}
+
+	foreach_hash_item (item, *disk_cache_files, i)
+		mem_free(item->value);
+
+	free_hash(&disk_cache_files);
+	free_hash(&disk_cache_uris);
+
+	disk_cache_record_count = 0;
+	disk_cache_size = 0;
+	disk_cache_loaded = 0;
+	disk_cache_dirty = 0;
+}
+
+static union option_info disk_cache_options[] = {
+	INIT_OPT_TREE("document.cache", N_("Disk cache"),
+		"disk", OPT_ZERO,
+		N_("Disk cache options.")),
+
+	INIT_OPT_BOOL("document.cache.disk", N_("Enable"),
+		"enable", OPT_ZERO, 0,
+		N_("Keep complete documents dropped from the memory cache "
+		"in the cache/ subdirectory of the ELinks home directory, "
+		"so that they can be reused or cheaply revalidated even "
+		"after ELinks is restarted.\n"
+		"\n"
+		"Unlike other runtime state files, the disk cache is also "
+		"written with -no-connect (implied by -dump) and "
+		"-session-ring, so that several instances can share it.")),
+
+	INIT_OPT_LONG("document.cache.disk", N_("Size"),
+		"size", OPT_ZERO, 0, LONG_MAX, 52428800,
+		N_("Disk cache size (in bytes).")),
+
+	NULL_OPTION_INFO,
+};
+
+struct module disk_cache_module = struct_module(
+	/* Because this module is listed in main_modules rather than
+	 * in builtin_modules, its name does not appear in the user
+	 * interface and so need not be translatable.  */
+	/* name: */		"Disk cache",
+	/* options: */		disk_cache_options,
+	/* hooks: */		NULL,
+	/* submodules: */	NULL,
+	/* data: */		NULL,
+	/* init: */		NULL,
+	/* done: */		done_disk_cache,
+	/* getname: */	NULL
+);
@@ -0,0 +1,34 @@
+#ifndef EL__CACHE_DISK_H
+#define EL__CACHE_DISK_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct cache_entry;
+struct module;
+struct uri;
+
+extern struct module disk_cache_module;
+
+/* Moves the data of the complete @cached entry to the queue of the disk
+ * cache, which is written from a bottom half. Called by garbage_collection()
+ * right before the entry is deleted, as it leaves the entry empty. */
+void demote_to_disk_cache(struct cache_entry *cached);
+
+/* Looks up @uri in the disk cache and on success creates a memory cache
+ * entry with the stored content. Returns NULL if the disk cache is disabled
+ * or has no matching entry. */
+struct cache_entry *get_disk_cache_entry(struct uri *uri);
+
+/* Used by the resource info dialog. */
+unsigned longlong get_disk_cache_size(void);
+int get_disk_cache_entry_count(void);
+long get_disk_cache_hits(void);
+long get_disk_cache_misses(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -19,11 +19,15 @@
 
 #include "bfu/dialog.h"
 #include "cache/cache.h"
+#include "cache/disk.h"
 #include "config/kbdbind.h"
 #include "config/options.h"
 #include "dialogs/info.h"
+#ifdef CONFIG_CSS
+#include "document/css/css.h"
+#endif
 #include "document/renderer.h"
-#ifdef CONFIG_ECMASCRIPT_SMJS
+#if defined(CONFIG_ECMASCRIPT_SMJS) || defined(CONFIG_QUICKJS) || defined(CONFIG_MUJS)
 #include "js/ecmascript-c.h"
 #endif
 #include "intl/libintl.h"
@@ -31,7 +35,12 @@
 #include "main/timer.h"
 #include "main/version.h"
 #include "network/connection.h"
+#include "network/dns.h"
 #include "session/session.h"
+#include "terminal/screen.h"
+#ifdef CONFIG_LIBSIXEL
+#include "terminal/sixel.h"
+#endif
 #include "terminal/terminal.h"
 #include "util/conv.h"
 #include "util/memcount.h"
@@ -165,6 +174,46 @@ menu_copying(struct terminal *term, void *xxx, void *xxxx)
 }
 
 
+struct host_info_context {
+	struct string *info;
+	struct terminal *term;
+};
+
+/* Adds a line with the connection statistics of one host. */
+static void
+add_host_connection_info(struct host_connection_info *host, void *data)
+{
+	ELOG
+	struct host_info_context *context = (struct host_info_context *)data;
+	struct string *info = context->info;
+	struct terminal *term = context->term;
+	long val;
+
+	add_to_string(info, "  ");
+	add_bytes_to_string(info, host->host, host->hostlen);
+	add_to_string(info, ": ");
+
+	val = host->connections;
+	add_format_to_string(info, n_("%ld running", "%ld running", val, term), val);
+	add_to_string(info, ", ");
+
+	val = host->keepalive;
+	add_format_to_string(info, n_("%ld idle", "%ld idle", val, term), val);
+	add_to_string(info, ", ");
+
+	val = host->requests;
+	add_format_to_string(info, n_("%ld request", "%ld requests", val, term), val);
+	add_to_string(info, ", ");
+
+	val = host->requests ? host->reuses * 100 / host->requests : 0;
+	add_format_to_string(info, _("%ld%% reused", term), val);
+	add_to_string(info, ", ");
+
+	val = host->idle_time;
+	add_format_to_string(info, _("%ld ms average idle", term), val);
+	add_to_string(info, ".\n");
+}
+
 static char *
 get_resource_info(struct terminal *term, void *data)
 {
@@ -209,6 +258,12 @@ get_resource_info(struct terminal *term, void *data)
 	val_add(n_("%ld keepalive", "%ld keepalive", val, term));
 	add_to_string(&info, ".\n");
 
+	{
+		struct host_info_context context = { &info, term };
+
+		foreach_host_connection_info(add_host_connection_info, &context);
+	}
+
 	add_to_string(&info, _("Memory cache", term));
 	add_to_string(&info, ": ");
 
@@ -229,6 +284,46 @@ get_resource_info(struct terminal *term, void *data)
 	val_add(n_("%ld loading", "%ld loading", val, term));
 	add_to_string(&info, ".\n");
 
+	if (get_opt_bool("document.cache.disk.enable", NULL)) {
+		add_to_string(&info, _("Disk cache", term));
+		add_to_string(&info, ": ");
+
+		bigval = get_disk_cache_size();
+		add_format_to_string(&info, n_("%ld byte", "%ld bytes", bigval, term), bigval);
+		add_to_string(&info, ", ");
+
+		val = get_disk_cache_entry_count();
+		val_add(n_("%ld file", "%ld files", val, term));
+		add_to_string(&info, ", ");
+
+		val = get_disk_cache_hits();
+		val_add(n_("%ld hit", "%ld hits", val, term));
+		add_to_string(&info, ", ");
+
+		val = get_disk_cache_misses();
+		val_add(n_("%ld miss", "%ld misses", val, term));
+		add_to_string(&info, ".\n");
+	}
+
+	add_to_string(&info, _("DNS cache", term));
+	add_to_string(&info, ": ");
+
+	val = get_dns_cache_entry_count();
+	val_add(n_("%ld host", "%ld hosts", val, term));
+	add_to_string(&info, ", ");
+
+	val = get_dns_negative_cache_entry_count();
+	val_add(n_("%ld failed", "%ld failed", val, term));
+	add_to_string(&info, ", ");
+
+	val = get_dns_cache_hits();
+	val_add(n_("%ld hit", "%ld hits", val, term));
+	add_to_string(&info, ", ");
+
+	val = get_dns_cache_misses();
+	val_add(n_("%ld miss", "%ld misses", val, term));
+	add_to_string(&info, ".\n");
+
 	add_to_string(&info, _("Document cache", term));
 	add_to_string(&info, ": ");
 
@@ -236,14 +331,43 @@ get_resource_info(struct terminal *term, void *data)
 	val_add(n_("%ld formatted", "%ld formatted", val, term));
 	add_to_string(&info, ", ");
 
+	bigval = get_format_cache_memory_size();
+	add_format_to_string(&info, n_("%ld byte", "%ld bytes", bigval, term), bigval);
+	add_to_string(&info, ", ");
+
 	val = get_format_cache_used_count();
 	val_add(n_("%ld in use", "%ld in use", val, term));
 	add_to_string(&info, ", ");
 
 	val = get_format_cache_refresh_count();
 	val_add(n_("%ld refreshing", "%ld refreshing", val, term));
+	add_to_string(&info, ", ");
+
+	val = get_format_cache_hits();
+	val_add(n_("%ld hit", "%ld hits", val, term));
+	add_to_string(&info, ", ");
+
+	val = get_format_cache_misses();
+	val_add(n_("%ld miss", "%ld misses", val, term));
 	add_to_string(&info, ".\n");
 
+#ifdef CONFIG_CSS
+	add_to_string(&info, _("Style sheets", term));
+	add_to_string(&info, ": ");
+
+	val = get_parsed_css_count();
+	val_add(n_("%ld cached", "%ld cached", val, term));
+	add_to_string(&info, ", ");
+
+	val = get_parsed_css_parses();
+	val_add(n_("%ld parsed", "%ld parsed", val, term));
+	add_to_string(&info, ", ");
+
+	val = get_parsed_css_hits();
+	val_add(n_("%ld reused", "%ld reused", val, term));
+	add_to_string(&info, ".\n");
+#endif
+
 #ifdef CONFIG_ECMASCRIPT_SMJS
 	add_to_string(&info, _("ECMAScript", term));
 	add_to_string(&info, ": ");
@@ -253,6 +377,60 @@ get_resource_info(struct terminal *term, void *data)
 	add_to_string(&info, ".\n");
 #endif
 
+#if defined(CONFIG_ECMASCRIPT_SMJS) || defined(CONFIG_QUICKJS) || defined(CONFIG_MUJS)
+	add_to_string(&info, _("Script renders", term));
+	add_to_string(&info, ": ");
+
+	val = ecmascript_get_rerender_requests();
+	val_add(n_("%ld requested", "%ld requested", val, term));
+	add_to_string(&info, ", ");
+
+	val = ecmascript_get_rerenders();
+	val_add(n_("%ld done", "%ld done", val, term));
+	add_to_string(&info, ", ");
+
+	val = ecmascript_get_rerender_requests();
+	val = val ? (val - ecmascript_get_rerenders()) * 100 / val : 0;
+	add_format_to_string(&info, _("%ld%% coalesced", term), val);
+	add_to_string(&info, ".\n");
+#endif
+
+	add_to_string(&info, _("Screen updates", term));
+	add_to_string(&info, ": ");
+
+	val = get_screen_frames();
+	val_add(n_("%ld frame", "%ld frames", val, term));
+	add_to_string(&info, ", ");
+
+	bigval = get_screen_bytes();
+	add_format_to_string(&info, n_("%ld byte", "%ld bytes", bigval, term), bigval);
+	add_to_string(&info, ", ");
+
+	val = val ? (long) (bigval / val) : 0;
+	add_format_to_string(&info, _("%ld bytes per frame", term), val);
+	add_to_string(&info, ".\n");
+
+#ifdef CONFIG_LIBSIXEL
+	add_to_string(&info, _("Sixel images", term));
+	add_to_string(&info, ": ");
+
+	val = get_sixel_frames_encoded();
+	val_add(n_("%ld frame encoded", "%ld frames encoded", val, term));
+	add_to_string(&info, ", ");
+
+	val = get_sixel_frames_cached();
+	val_add(n_("%ld cached", "%ld cached", val, term));
+	add_to_string(&info, ", ");
+
+	bigval = get_sixel_bytes_sent();
+	add_format_to_string(&info, n_("%ld byte sent", "%ld bytes sent", bigval, term), bigval);
+	add_to_string(&info, ", ");
+
+	bigval = get_sixel_bytes_saved();
+	add_format_to_string(&info, n_("%ld byte saved", "%ld bytes saved", bigval, term), bigval);
+	add_to_string(&info, ".\n");
+#endif
+
 	add_to_string(&info, _("Interlinking", term));
 	add_to_string(&info, ": ");
 	if (term->master)
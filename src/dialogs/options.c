@@ -99,6 +99,7 @@ enum termopt {
 	TERM_OPT_UNDERLINE,
 	TERM_OPT_ITALIC,
 	TERM_OPT_STRIKE,
+	TERM_OPT_SCROLL_REGION,
 #ifdef CONFIG_KITTY
 	TERM_OPT_KITTY,
 #endif
@@ -119,6 +120,7 @@ static struct option_resolver resolvers[] = {
 	{ TERM_OPT_UNDERLINE,	 "underline"	},
 	{ TERM_OPT_ITALIC,	 "italic"	},
 	{ TERM_OPT_STRIKE,	 "strike"	},
+	{ TERM_OPT_SCROLL_REGION, "scroll_region" },
 #ifdef CONFIG_KITTY
 	{ TERM_OPT_KITTY,	 "kitty"	},
 #endif
@@ -251,6 +253,7 @@ terminal_options(struct terminal *term, void *xxx, struct session *ses)
 	add_dlg_checkbox(dlg, _("Underline", term), &values[TERM_OPT_UNDERLINE].number);
 	add_dlg_checkbox(dlg, _("Strikethrough", term), &values[TERM_OPT_STRIKE].number);
 	add_dlg_checkbox(dlg, _("UTF-8 I/O", term), &values[TERM_OPT_UTF_8_IO].number);
+	add_dlg_checkbox(dlg, _("Scroll region", term), &values[TERM_OPT_SCROLL_REGION].number);
 #ifdef CONFIG_KITTY
 	add_dlg_checkbox(dlg, _("Kitty", term), &values[TERM_OPT_KITTY].number);
 #endif
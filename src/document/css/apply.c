@@ -180,12 +180,130 @@ static const css_applier_T css_appliers[CSS_PT_LAST] = {
 	/* CSS_PT_WHITE_SPACE */	css_apply_font_attribute,
 };
 
+/** Bloom filter of the element names, ids and classes found among the
+ * ancestors of an element.  It lets examine_element() skip walking the
+ * HTML stack for selectors whose ancestor fragments cannot match.  It is
+ * filled in the first time it is needed. */
+struct css_ancestor_filter {
+	/** The element being styled.  Elements examined on the way have
+	 * a subset of its ancestors, so they can use the same filter. */
+	struct html_element *element;
+	int ready;
+	unsigned int bits[8];
+};
+
+#define CSS_ANCESTOR_FILTER_BITS	(sizeof(((struct css_ancestor_filter *) 0)->bits) * 8)
+
+static void
+add_to_ancestor_filter(struct css_ancestor_filter *filter, unsigned int hash)
+{
+	ELOG
+	unsigned int bit1 = hash % CSS_ANCESTOR_FILTER_BITS;
+	unsigned int bit2 = (hash >> 16) % CSS_ANCESTOR_FILTER_BITS;
+
+	filter->bits[bit1 / 32] |= 1U << (bit1 % 32);
+	filter->bits[bit2 / 32] |= 1U << (bit2 % 32);
+}
+
+static int
+is_in_ancestor_filter(struct css_ancestor_filter *filter, unsigned int hash)
+{
+	ELOG
+	unsigned int bit1 = hash % CSS_ANCESTOR_FILTER_BITS;
+	unsigned int bit2 = (hash >> 16) % CSS_ANCESTOR_FILTER_BITS;
+
+	return (filter->bits[bit1 / 32] & (1U << (bit1 % 32)))
+		&& (filter->bits[bit2 / 32] & (1U << (bit2 % 32)));
+}
+
+/* Adds everything examine_element() can match on the ancestors of
+ * @filter->element, except for pseudo-classes. */
+static void
+fill_ancestor_filter(struct html_context *html_context,
+		     struct css_ancestor_filter *filter)
+{
+	ELOG
+	struct html_element *ancestor;
+
+	memset(filter->bits, 0, sizeof(filter->bits));
+	filter->ready = 1;
+
+	for (ancestor = filter->element->next;
+	     (LIST_OF(struct html_element) *) ancestor != &html_context->stack;
+	     ancestor = ancestor->next) {
+		if (ancestor->namelen)
+			add_to_ancestor_filter(filter,
+				get_css_selector_hash(CST_ELEMENT, ancestor->name,
+						      ancestor->namelen));
+
+		if (!ancestor->options)
+			continue;
+
+#ifdef CONFIG_CSS
+#ifdef CONFIG_LIBCSS
+		if (html_context->options->libcss_enable)
+			continue;
+#endif
+		if (ancestor->attr.class_) {
+			const char *class_ = ancestor->attr.class_;
+
+			for (;;) {
+				const char *begin;
+
+				while (*class_ == ' ') ++class_;
+				if (*class_ == '\0') break;
+				begin = class_;
+				while (*class_ != ' ' && *class_ != '\0') ++class_;
+
+				add_to_ancestor_filter(filter,
+					get_css_selector_hash(CST_CLASS, begin,
+							      class_ - begin));
+			}
+		}
+
+		if (ancestor->attr.id)
+			add_to_ancestor_filter(filter,
+				get_css_selector_hash(CST_ID, ancestor->attr.id, -1));
+#endif
+	}
+}
+
+/* Returns whether any ancestor or parent fragment in @leaves may match
+ * one of the ancestors in @filter. */
+static int
+may_match_ancestors(struct html_context *html_context,
+		    struct css_ancestor_filter *filter,
+		    struct css_selector_set *leaves)
+{
+	ELOG
+	struct css_selector *leaf;
+
+	foreach_css_selector (leaf, leaves) {
+		if (leaf->relation != CSR_ANCESTOR
+		    && leaf->relation != CSR_PARENT)
+			continue;
+
+		if (leaf->type == CST_PSEUDO
+		    || (leaf->type == CST_ELEMENT && !strcmp(leaf->name, "*")))
+			return 1;
+
+		if (!filter->ready)
+			fill_ancestor_filter(html_context, filter);
+
+		if (is_in_ancestor_filter(filter, leaf->hash))
+			return 1;
+	}
+
+	return 0;
+}
+
 /** This looks for a match in list of selectors. */
 static void
 examine_element(struct html_context *html_context, struct css_selector *base,
 		css_selector_type_T seltype, enum css_selector_relation rel,
 		struct css_selector_set *selectors,
-		struct html_element *element)
+		struct html_element *element,
+		struct css_ancestor_filter *filter)
 {
 	ELOG
 	struct css_selector *selector;
@@ -212,7 +330,9 @@ examine_element(struct html_context *html_context, struct css_selector *base,
 		/* Ancestor matches? */ \
 		if (sel->leaves.may_contain_rel_ancestor_or_parent \
 		    && (LIST_OF(struct html_element) *) element->next \
-		     != &html_context->stack) { \
+		     != &html_context->stack \
+		    && may_match_ancestors(html_context, filter, \
+					   &sel->leaves)) { \
 			struct html_element *ancestor; \
 			/* This is less effective than doing reverse iterations,
 			 * first over sel->leaves and then over the HTML stack,
@@ -226,15 +346,17 @@ examine_element(struct html_context *html_context, struct css_selector *base,
 			     ancestor = ancestor->next) \
 				examine_element(html_context, base, \
 						CST_ELEMENT, CSR_ANCESTOR, \
-						&sel->leaves, ancestor); \
+						&sel->leaves, ancestor, \
+						filter); \
 			examine_element(html_context, base, \
 			                CST_ELEMENT, CSR_PARENT, \
-			                &sel->leaves, element->next); \
+			                &sel->leaves, element->next, \
+			                filter); \
 		} \
 		/* More specific matches? */ \
 		examine_element(html_context, base, type + 1, \
 		                CSR_SPECIFITY, \
-		                &sel->leaves, element); \
+		                &sel->leaves, element, filter); \
 	}
 
 	if (seltype <= CST_ELEMENT && element->namelen) {
@@ -302,6 +424,7 @@ get_css_selector_for_element(struct html_context *html_context,
 	ELOG
 	char *code;
 	struct css_selector *selector;
+	struct css_ancestor_filter filter;
 
 	assert(element && element->options && css);
 
@@ -313,8 +436,10 @@ get_css_selector_for_element(struct html_context *html_context,
 	DBG("Applying to element %.*s...", element->namelen, element->name);
 #endif
 
+	filter.element = element;
+	filter.ready = 0;
 	examine_element(html_context, selector, CST_ELEMENT, CSR_ROOT,
-	                &css->selectors, element);
+	                &css->selectors, element, &filter);
 
 #ifdef DEBUG_CSS
 	DBG("Element %.*s applied.", element->namelen, element->name);
@@ -18,11 +18,13 @@
 #include "encoding/encoding.h"
 #include "intl/libintl.h"
 #include "main/module.h"
+#include "main/object.h"
 #include "network/connection.h"
 #include "protocol/uri.h"
 #include "session/session.h"
 #include "util/error.h"
 #include "util/memory.h"
+#include "util/string.h"
 #include "viewer/text/draw.h"
 
 
@@ -132,12 +134,163 @@ supports_css_media_type(const char *optstr,
 	return 0;
 }
 
+/** An imported style sheet parsed into a stylesheet of its own. It is
+ * shared by all the documents importing it for as long as its cache
+ * entry does not change. */
+struct parsed_css {
+	OBJECT_HEAD(struct parsed_css);
+
+	struct uri *uri;
+
+	/** The cache_entry.cache_id of the parsed source. */
+	unsigned int cache_id;
+
+	/** The selectors of the sheet. */
+	struct css_stylesheet css;
+
+	/** The URLs of the @@import rules, in order. They are imported
+	 * before the selectors are merged into the importing stylesheet. */
+	LIST_OF(struct string_list_item) imports;
+
+	/** Some @@import rule came after a ruleset so the sheet cannot be
+	 * merged in one piece and has to be parsed each time. */
+	unsigned int unmergeable:1;
+};
+
+static INIT_LIST_OF(struct parsed_css, parsed_css_sheets);
+static int parsed_css_count;
+static long parsed_css_hits;
+static long parsed_css_parses;
+
+static void
+record_css_import(struct css_stylesheet *css, struct uri *base_uri,
+		  const char *url, int urllen)
+{
+	ELOG
+	struct parsed_css *sheet = (struct parsed_css *)css->import_data;
+
+	if (!css_selector_set_empty(&css->selectors)
+	    || !add_to_string_list(&sheet->imports, url, urllen))
+		sheet->unmergeable = 1;
+}
+
+static void
+done_parsed_css(struct parsed_css *sheet)
+{
+	ELOG
+	assert(!is_object_used(sheet));
+
+	del_from_list(sheet);
+	parsed_css_count--;
+	done_uri(sheet->uri);
+	done_css_stylesheet(&sheet->css);
+	free_string_list(&sheet->imports);
+	mem_free(sheet);
+}
+
+/* Drops the least recently used sheets not being merged right now until
+ * at most @max are left. */
+static void
+shrink_parsed_css(int max)
+{
+	ELOG
+	struct parsed_css *sheet, *prev;
+
+	foreachbacksafe (sheet, prev, parsed_css_sheets) {
+		if (parsed_css_count <= max)
+			break;
+		if (!is_object_used(sheet))
+			done_parsed_css(sheet);
+	}
+}
+
+/* Returns the locked parsed sheet for the content of @cached, parsing it
+ * if there is none yet, or NULL if the content cannot be shared. */
+static struct parsed_css *
+get_parsed_css(struct uri *uri, struct cache_entry *cached)
+{
+	ELOG
+	struct parsed_css *sheet, *next;
+	struct fragment *fragment;
+
+	foreachsafe (sheet, next, parsed_css_sheets) {
+		if (sheet->uri != uri)
+			continue;
+
+		if (sheet->cache_id == cached->cache_id) {
+			move_to_top_of_list(parsed_css_sheets, sheet);
+			object_lock(sheet);
+			parsed_css_hits++;
+			return sheet;
+		}
+
+		/* The cache entry has changed since it was parsed. */
+		if (!is_object_used(sheet))
+			done_parsed_css(sheet);
+	}
+
+	if (cached->incomplete)
+		return NULL;
+
+	fragment = get_cache_fragment(cached);
+	if (!fragment)
+		return NULL;
+
+	sheet = (struct parsed_css *)mem_calloc(1, sizeof(*sheet));
+	if (!sheet)
+		return NULL;
+
+	sheet->uri = get_uri_reference(uri);
+	sheet->cache_id = cached->cache_id;
+	sheet->css.import = record_css_import;
+	sheet->css.import_data = sheet;
+	init_css_selector_set(&sheet->css.selectors);
+	init_list(sheet->imports);
+	object_nolock(sheet, "parsed_css");
+
+	css_parse_stylesheet(&sheet->css, uri, fragment->data,
+			     fragment->data + fragment->length);
+	parsed_css_parses++;
+
+	/* Keep the sheet around only to remember not to parse it again. */
+	if (sheet->unmergeable)
+		done_css_stylesheet(&sheet->css);
+
+	add_to_list(parsed_css_sheets, sheet);
+	parsed_css_count++;
+	object_lock(sheet);
+	shrink_parsed_css(MAX_PARSED_CSS_SHEETS);
+
+	return sheet;
+}
+
+int
+get_parsed_css_count(void)
+{
+	ELOG
+	return parsed_css_count;
+}
+
+long
+get_parsed_css_hits(void)
+{
+	ELOG
+	return parsed_css_hits;
+}
+
+long
+get_parsed_css_parses(void)
+{
+	ELOG
+	return parsed_css_parses;
+}
+
 void
 import_css(struct css_stylesheet *css, struct uri *uri)
 {
 	ELOG
-	/* Do we have it in the cache? (TODO: CSS cache) */
 	struct cache_entry *cached;
+	struct parsed_css *sheet;
 	struct fragment *fragment;
 
 	if (!uri || css->import_level >= MAX_REDIRECTS)
@@ -146,17 +299,34 @@ import_css(struct css_stylesheet *css, struct uri *uri)
 	cached = get_redirected_cache_entry(uri);
 	if (!cached) return;
 
+	sheet = get_parsed_css(uri, cached);
+	if (sheet) {
+		if (!sheet->unmergeable) {
+			struct string_list_item *item;
+
+			css->import_level++;
+			foreach (item, sheet->imports)
+				css->import(css, uri, item->string.source,
+					    item->string.length);
+			merge_css_stylesheet(css, &sheet->css);
+			css->import_level--;
+			object_unlock(sheet);
+			return;
+		}
+		object_unlock(sheet);
+	}
+
 	fragment = get_cache_fragment(cached);
 	if (fragment) {
 		char *end = fragment->data + fragment->length;
 
 		css->import_level++;
 		css_parse_stylesheet(css, uri, fragment->data, end);
+		parsed_css_parses++;
 		css->import_level--;
 	}
 }
 
-
 static void
 import_css_file(struct css_stylesheet *css, struct uri *base_uri,
 		const char *url, int urllen)
@@ -216,8 +386,11 @@ change_hook_css(struct session *ses, struct option *current, struct option *chan
 		import_default_css();
 	}
 
-	if (!strcmp(changed->name, "media"))
+	if (!strcmp(changed->name, "media")) {
+		/* @@media rules were evaluated when parsing. */
+		shrink_parsed_css(0);
 		reload_css = 1;
+	}
 
 	/* Instead of using the value of the @ses parameter, iterate
 	 * through the @sessions list.  The parameter may be NULL and
@@ -245,6 +418,7 @@ done_css(struct module *module)
 {
 	ELOG
 	done_css_stylesheet(&default_stylesheet);
+	shrink_parsed_css(0);
 }
 
 
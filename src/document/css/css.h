@@ -24,9 +24,15 @@ extern struct css_stylesheet default_stylesheet;
 
 extern struct module css_module;
 
-/** This function will try to import the given @a url from the cache. */
+/** This function will try to import the given @a url from the cache.
+ * The parsed sheet is kept for the next document importing it. */
 void import_css(struct css_stylesheet *css, struct uri *uri);
 
+/** Used by the resource info dialog. */
+int get_parsed_css_count(void);
+long get_parsed_css_hits(void);
+long get_parsed_css_parses(void);
+
 int supports_css_media_type(const char *optstr,
 			    const char *token, size_t token_length);
 
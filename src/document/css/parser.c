@@ -521,9 +521,12 @@ css_parse_selector(struct css_stylesheet *css, struct scanner *scanner,
 
 			assert(prev_element_selector);
 			set_css_selector_relation(prev_element_selector, reltype);
-			add_css_selector_to_set(prev_element_selector,
-						&selector->leaves);
-			last_chained_selector = prev_element_selector;
+			/* The selector may be one from @css which already
+			 * has the same leaf from an earlier rule. */
+			last_chained_selector =
+				reparent_selector(&selector->leaves,
+						  prev_element_selector,
+						  &pkg->selector);
 
 		}
 
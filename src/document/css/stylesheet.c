@@ -13,6 +13,7 @@
 
 #include "document/css/property.h"
 #include "document/css/stylesheet.h"
+#include "util/conv.h"
 #include "util/error.h"
 #include "util/lists.h"
 #include "util/memory.h"
@@ -26,6 +27,24 @@
  * will find them useful at some time, so... Dunno. --pasky */
 
 
+unsigned int
+get_css_selector_hash(css_selector_type_T type, const char *name, int namelen)
+{
+	ELOG
+	/* FNV-1a */
+	unsigned int hash = 2166136261U ^ type;
+
+	if (namelen < 0)
+		namelen = strlen(name);
+
+	for (; namelen > 0; namelen--, name++) {
+		hash ^= (unsigned char) c_tolower(*name);
+		hash *= 16777619U;
+	}
+
+	return hash;
+}
+
 struct css_selector *
 find_css_selector(struct css_selector_set *sels,
                   css_selector_type_T type,
@@ -37,6 +56,22 @@ find_css_selector(struct css_selector_set *sels,
 
 	assert(sels && name);
 
+	if (sels->index) {
+		unsigned int hash = get_css_selector_hash(type, name, namelen);
+
+		for (selector = sels->index[hash & (sels->index_size - 1)];
+		     selector; selector = selector->index_next) {
+			if (hash != selector->hash || type != selector->type
+			    || rel != selector->relation)
+				continue;
+			if (c_strlcasecmp(name, namelen, selector->name, -1))
+				continue;
+			return selector;
+		}
+
+		return NULL;
+	}
+
 	foreach_css_selector (selector, sels) {
 		if (type != selector->type || rel != selector->relation)
 			continue;
@@ -76,6 +111,7 @@ init_css_selector(struct css_selector_set *sels,
 			return NULL;
 		}
 		set_mem_comment(selector, name, namelen);
+		selector->hash = get_css_selector_hash(type, name, namelen);
 	}
 
 	if (sels) {
@@ -210,6 +246,9 @@ init_css_selector_set(struct css_selector_set *set)
 {
 	ELOG
 	set->may_contain_rel_ancestor_or_parent = 0;
+	set->count = 0;
+	set->index = NULL;
+	set->index_size = 0;
 	init_list(set->list);
 }
 
@@ -220,6 +259,42 @@ done_css_selector_set(struct css_selector_set *set)
 	while (!css_selector_set_empty(set)) {
 		done_css_selector(css_selector_set_front(set));
 	}
+	mem_free_set(&set->index, NULL);
+	set->index_size = 0;
+}
+
+static void
+index_css_selector(struct css_selector_set *set, struct css_selector *selector)
+{
+	ELOG
+	struct css_selector **bucket = &set->index[selector->hash & (set->index_size - 1)];
+
+	selector->index_next = *bucket;
+	*bucket = selector;
+}
+
+/* Returns 0 if there is not enough memory, leaving the old index. */
+static int
+build_css_selector_index(struct css_selector_set *set, unsigned int size)
+{
+	ELOG
+	struct css_selector **index = (struct css_selector **)mem_calloc(size, sizeof(*index));
+	struct css_selector *selector;
+
+	if (!index) return 0;
+
+	mem_free_if(set->index);
+	set->index = index;
+	set->index_size = size;
+
+	/* The front of the list has to end up at the front of the
+	 * buckets so that the index finds the same selector as a linear
+	 * search would. */
+	foreachback (selector, set->list) {
+		index_css_selector(set, selector);
+	}
+
+	return 1;
 }
 
 void
@@ -230,6 +305,19 @@ add_css_selector_to_set(struct css_selector *selector,
 	assert(!css_selector_is_in_set(selector));
 
 	add_to_list(set->list, selector);
+	selector->set = set;
+	set->count++;
+
+	if (set->index && set->count <= set->index_size) {
+		index_css_selector(set, selector);
+	} else if (set->count >= CSS_SELECTOR_SET_INDEX_MIN) {
+		unsigned int size = set->index_size ? set->index_size * 2
+			: CSS_SELECTOR_SET_INDEX_MIN * 2;
+
+		if (!build_css_selector_index(set, size) && set->index)
+			index_css_selector(set, selector);
+	}
+
 	if (selector->relation == CSR_ANCESTOR
 	    || selector->relation == CSR_PARENT)
 		set->may_contain_rel_ancestor_or_parent = 1;
@@ -239,9 +327,25 @@ void
 del_css_selector_from_set(struct css_selector *selector)
 {
 	ELOG
+	struct css_selector_set *set = selector->set;
+
+	if (set->index) {
+		struct css_selector **pos = &set->index[selector->hash & (set->index_size - 1)];
+
+		for (; *pos; pos = &(*pos)->index_next) {
+			if (*pos == selector) {
+				*pos = selector->index_next;
+				break;
+			}
+		}
+	}
+	set->count--;
+
 	del_from_list(selector);
 	selector->next = NULL;
 	selector->prev = NULL;
+	selector->set = NULL;
+	selector->index_next = NULL;
 }
 
 #ifdef DEBUG_CSS
@@ -302,6 +406,36 @@ mirror_css_stylesheet(struct css_stylesheet *css1, struct css_stylesheet *css2)
 	}
 }
 
+static void
+merge_css_selector_set(struct css_selector_set *sels,
+		       struct css_selector_set *from)
+{
+	ELOG
+	struct css_selector *selector;
+
+	/* Go from the oldest selector to the newest so that the newest
+	 * one wins if @from contains some selector twice. */
+	foreachback (selector, from->list) {
+		struct css_selector *twin;
+
+		twin = get_css_selector(sels, selector->type,
+					selector->relation,
+					selector->name, -1);
+		if (!twin)
+			continue;
+
+		merge_css_selectors(twin, selector);
+		merge_css_selector_set(&twin->leaves, &selector->leaves);
+	}
+}
+
+void
+merge_css_stylesheet(struct css_stylesheet *css, struct css_stylesheet *from)
+{
+	ELOG
+	merge_css_selector_set(&css->selectors, &from->selectors);
+}
+
 #if 0
 struct css_stylesheet *
 clone_css_stylesheet(struct css_stylesheet *orig)
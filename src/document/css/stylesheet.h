@@ -40,9 +40,10 @@ extern "C" {
  * in particular. Is it obsolete now when we grok 'td.foo p#x>a:hover' without
  * hesitation? --pasky */
 
-/** A set of struct css_selector.  This is currently represented as a
- * list but that may be changed later.  Therefore please try not to
- * access the contents directly; instead define new wrapper macros.
+/** A set of struct css_selector.  This is represented as a list with
+ * a hash index on top of it once the set grows large.  Therefore please
+ * try not to access the contents directly; instead define new wrapper
+ * macros.
  *
  * According to CSS2 section 7.1 "Cascading order", if two rules have
  * the same weight, then the latter specified wins.  Regardless, the
@@ -52,21 +53,32 @@ extern "C" {
 struct css_selector_set {
 	unsigned char may_contain_rel_ancestor_or_parent;
 
-	/** The list of selectors in this set.
+	/** Number of selectors in #list. */
+	unsigned int count;
+
+	/** Hash buckets of the selectors, chained by
+	 * css_selector.index_next, or NULL.
 	 *
-	 * Sets are currently represented as lists that
-	 * find_css_selector() then has to search linearly.
-	 * Hashing was also tested but did not help in practice:
-	 * each find_css_selector() call runs approximately one
-	 * strcasecmp(), and a hash function is unlikely to be
-	 * faster than that.  See ELinks bug 789 for details.
+	 * Small sets are searched linearly: there each
+	 * find_css_selector() call runs approximately one strcasecmp(),
+	 * and a hash function is unlikely to be faster than that.  See
+	 * ELinks bug 789 for details.  The set of base selectors of a
+	 * large stylesheet has thousands of members though, so the
+	 * index is built once the set reaches
+	 * CSS_SELECTOR_SET_INDEX_MIN selectors.  */
+	struct css_selector **index;
+	unsigned int index_size;
+
+	/** The list of selectors in this set.
 	 *
 	 * Keep this away from the beginning of the structure,
 	 * so that nobody can cast the struct css_selector_set *
 	 * to LIST_OF(struct css_selector) * and get away with it.  */
 	LIST_OF(struct css_selector) list;
 };
-#define INIT_CSS_SELECTOR_SET(set) { 0, { D_LIST_HEAD_EL(set.list) } }
+#define INIT_CSS_SELECTOR_SET(set) { 0, 0, NULL, 0, { D_LIST_HEAD_EL(set.list) } }
+
+#define CSS_SELECTOR_SET_INDEX_MIN 16
 
 enum css_selector_relation {
 	CSR_ROOT, /**< First class stylesheet member. */
@@ -100,6 +112,13 @@ struct css_selector {
 	css_selector_type_T type;
 	char *name;
 
+	/** get_css_selector_hash() of #type and #name. */
+	unsigned int hash;
+	/** The set this selector is in, and the next selector in the same
+	 * bucket of its index. */
+	struct css_selector_set *set;
+	struct css_selector *index_next;
+
 	LIST_OF(struct css_property) properties;
 };
 
@@ -109,9 +128,10 @@ typedef void (*css_stylesheet_importer_T)(struct css_stylesheet *, struct uri *,
 					  const char *url, int urllen);
 
 /** The struct css_stylesheet describes all the useful data that was extracted
- * from the CSS source. Currently we don't cache anything but the default user
- * stylesheet so it can contain stuff from both @<style> tags and @@import'ed
- * CSS documents. */
+ * from the CSS source. The stylesheet of a document can contain stuff from
+ * both @<style> tags and @@import'ed CSS documents. The latter are parsed
+ * once into stylesheets of their own which are shared by all documents, see
+ * import_css(). */
 struct css_stylesheet {
 	/** The import callback function.  The caller must check the
 	 * media types first.  */
@@ -140,6 +160,11 @@ struct css_stylesheet *init_css_stylesheet(css_stylesheet_importer_T importer,
 void mirror_css_stylesheet(struct css_stylesheet *css1,
 			   struct css_stylesheet *css2);
 
+/** Merge all the selectors of @a from, including their leaves, into
+ * @a css as if the source of @a from had been parsed into @a css. */
+void merge_css_stylesheet(struct css_stylesheet *css,
+			  struct css_stylesheet *from);
+
 /** Releases all the content of the stylesheet (but not the stylesheet
  * itself). */
 void done_css_stylesheet(struct css_stylesheet *css);
@@ -166,6 +191,11 @@ struct css_selector *find_css_selector(struct css_selector_set *set,
 #define find_css_base_selector(stylesheet, type, rel, name, namelen) \
 	find_css_selector(&stylesheet->selectors, rel, type, name, namelen)
 
+/** Hashes the selector @a type and the case-insensitive @a name of
+ * length @a namelen, or up to the NUL if @a namelen is negative. */
+unsigned int get_css_selector_hash(css_selector_type_T type,
+				   const char *name, int namelen);
+
 /** Initialize the selector structure. This is a rather low-level
  * function from your POV. */
 struct css_selector *init_css_selector(struct css_selector_set *set,
@@ -6,6 +6,7 @@
 #endif
 
 #include <errno.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -85,17 +86,37 @@
 #endif
 #include "util/color.h"
 #include "util/error.h"
+#include "util/hash.h"
 #include "util/lists.h"
 #include "util/memory.h"
 #include "util/string.h"
 #include "viewer/text/link.h"
 
+struct format_cache_uri;
+
 struct document_list {
 	LIST_HEAD_EL(struct document_list);
 	struct document *document;
+
+	/* Only used by the format cache entries: the other documents
+	 * formatted from the same URI. */
+	struct format_cache_uri *bucket;
+	struct document_list *next_in_bucket;
+};
+
+/* Documents in the format cache which were formatted from the same URI.
+ * URIs are shared, so the pointer itself is used as the hash key. */
+struct format_cache_uri {
+	struct hash_item *item;
+	struct uri *uri;
+	struct document_list *documents;
 };
 
 static INIT_LIST_OF(struct document_list, format_cache);
+static struct hash *format_cache_index;
+
+static long format_cache_hits;
+static long format_cache_misses;
 
 const char *script_event_hook_name[] = {
 	"click",
@@ -112,35 +133,100 @@ const char *script_event_hook_name[] = {
 	NULL
 };
 
-static void add_to_document_list(LIST_OF(struct document_list) *list, struct document *document);
+static struct format_cache_uri *
+get_format_cache_uri(struct uri *uri)
+{
+	ELOG
+	struct hash_item *item;
+
+	if (!format_cache_index) return NULL;
+
+	item = get_hash_item(format_cache_index, (const char *) &uri, sizeof(uri));
+
+	return item ? (struct format_cache_uri *) item->value : NULL;
+}
 
 static void
-remove_document_from_format_cache(struct document *document)
+add_document_to_format_cache(struct document *document)
 {
 	ELOG
+	struct format_cache_uri *bucket;
 	struct document_list *item;
 
-	foreach (item, format_cache) {
-		if (item->document == document) {
-			del_from_list(item);
-			mem_free(item);
+	if (!format_cache_index) {
+		format_cache_index = init_hash8();
+		if (!format_cache_index) return;
+	}
+
+	bucket = get_format_cache_uri(document->uri);
+	if (!bucket) {
+		bucket = (struct format_cache_uri *)mem_calloc(1, sizeof(*bucket));
+		if (!bucket) return;
+
+		bucket->uri = document->uri;
+		bucket->item = add_hash_item(format_cache_index,
+					     (const char *) &bucket->uri,
+					     sizeof(bucket->uri), bucket);
+		if (!bucket->item) {
+			mem_free(bucket);
 			return;
 		}
 	}
+
+	item = (struct document_list *)mem_alloc(sizeof(*item));
+	if (!item) {
+		if (!bucket->documents) {
+			del_hash_item(format_cache_index, bucket->item);
+			mem_free(bucket);
+		}
+		return;
+	}
+
+	item->document = document;
+	item->bucket = bucket;
+	item->next_in_bucket = bucket->documents;
+	bucket->documents = item;
+	add_to_list_end(format_cache, item);
+	document->format_cache_item = item;
 }
 
 static void
-move_document_to_top_of_format_cache(struct document *document)
+remove_document_from_format_cache(struct document *document)
 {
 	ELOG
-	struct document_list *item;
+	struct document_list *item = document->format_cache_item;
+	struct format_cache_uri *bucket;
+	struct document_list **pos;
 
-	foreach (item, format_cache) {
-		if (item->document == document) {
-			move_to_top_of_list(format_cache, item);
-			return;
+	if (!item) return;
+
+	bucket = item->bucket;
+	for (pos = &bucket->documents; *pos; pos = &(*pos)->next_in_bucket) {
+		if (*pos == item) {
+			*pos = item->next_in_bucket;
+			break;
 		}
 	}
+
+	if (!bucket->documents) {
+		del_hash_item(format_cache_index, bucket->item);
+		mem_free(bucket);
+	}
+
+	del_from_list(item);
+	mem_free(item);
+	document->format_cache_item = NULL;
+}
+
+static void
+move_document_to_top_of_format_cache(struct document *document)
+{
+	ELOG
+	struct document_list *item = document->format_cache_item;
+
+	if (item) {
+		move_to_top_of_list(format_cache, item);
+	}
 }
 
 #if 0
@@ -215,7 +301,9 @@ init_document(struct cache_entry *cached, struct document_options *options)
 
 	object_lock(cached);
 	document->cache_id = cached->cache_id;
+	document->prefix_id = cached->prefix_id;
 	document->cached = cached;
+	document->unpacked_y = -1;
 
 	init_list(document->forms);
 	init_list(document->tags);
@@ -242,7 +330,7 @@ init_document(struct cache_entry *cached, struct document_options *options)
 	object_lock(document);
 
 	copy_opt(&document->options, options);
-	add_to_document_list(&format_cache, document);
+	add_document_to_format_cache(document);
 
 	return document;
 }
@@ -365,15 +453,52 @@ copy_link(struct link *dest, struct link *src)
 	}
 }
 
+/** Chars of a packed line which differ only in their data. */
+struct line_run {
+	/** The column after the last char of the run. */
+	unsigned int end;
+	/** The chars of the run, but for their data. */
+	struct screen_char template_;
+};
+
+/** A line as packed by pack_document(): the runs and then the text of the
+ * chars, a byte per char or, if the line needs it, an unicode_val_T. */
+struct packed_line {
+	unsigned int nruns;
+	unsigned int wide:1;
+	struct line_run runs[1];
+};
+
+#define packed_line_text(packed) ((unsigned char *) &(packed)->runs[(packed)->nruns])
+
+static size_t
+get_packed_line_size(struct packed_line *packed, int length)
+{
+	ELOG
+	size_t size = offsetof(struct packed_line, runs)
+		      + packed->nruns * sizeof(*packed->runs);
+
+#ifdef CONFIG_UTF8
+	if (packed->wide)
+		return size + length * sizeof(unicode_val_T);
+#endif
+	return size + length;
+}
+
 static void
-copy_line(struct line *dest, struct line *src)
+copy_line(struct line *dest, struct document *src_doc, int y)
 {
 	ELOG
+	struct line *src = &src_doc->data[y];
+
 	dest->length = src->length;
+	dest->packed = 0;
 	dest->ch.chars = mem_alloc(dest->length * sizeof(struct screen_char));
 
 	if (dest->ch.chars) {
-		memcpy(dest->ch.chars, src->ch.chars, dest->length * sizeof(struct screen_char));
+		/* Packed lines are copied unpacked, since the unpacking
+		 * buffer of the destination may be too short for them. */
+		memcpy(dest->ch.chars, get_line_chars(src_doc, y), dest->length * sizeof(struct screen_char));
 	}
 }
 
@@ -429,6 +554,9 @@ reset_document(struct document *document)
 		mem_free_set(&document->data, NULL);
 		document->height = 0;
 	}
+	mem_free_set(&document->unpacked, NULL);
+	document->unpacked_size = 0;
+	document->unpacked_y = -1;
 
 	mem_free_set(&document->lines1, NULL);
 	mem_free_set(&document->lines2, NULL);
@@ -453,6 +581,7 @@ reset_document(struct document *document)
 	free_list(document->nodes);
 	free_list(document->iframes);
 
+	mem_free_set(&document->checkpoint, NULL);
 	mem_free_set(&document->search, NULL);
 	mem_free_set(&document->slines1, NULL);
 	mem_free_set(&document->slines2, NULL);
@@ -498,6 +627,7 @@ done_document(struct document *document)
 
 		mem_free(document->data);
 	}
+	mem_free_if(document->unpacked);
 
 	mem_free_if(document->lines1);
 	mem_free_if(document->lines2);
@@ -549,6 +679,7 @@ done_document(struct document *document)
 	free_list(document->nodes);
 	free_list(document->iframes);
 
+	mem_free_if(document->checkpoint);
 	mem_free_if(document->search);
 	mem_free_if(document->slines1);
 	mem_free_if(document->slines2);
@@ -570,6 +701,115 @@ release_document(struct document *document)
 	}
 	object_unlock(document);
 	move_document_to_top_of_format_cache(document);
+
+	/* Remember the size while the document sits unused in the format
+	 * cache, so shrink_format_cache() need not walk it again. */
+	if (!is_object_used(document)) {
+		document->memory_size = get_document_memory_size(document);
+	}
+}
+
+unsigned longlong
+get_document_memory_size(struct document *document)
+{
+	ELOG
+	unsigned longlong size = sizeof(*document);
+	struct form *form;
+	int i;
+
+	if (document->data) {
+		size += (unsigned longlong) document->height * sizeof(*document->data);
+		for (i = 0; i < document->height; i++) {
+			struct line *line = &document->data[i];
+
+			if (line->packed)
+				size += get_packed_line_size(line->ch.packed,
+							     line->length);
+			else
+				size += (unsigned longlong) line->length
+					* sizeof(*line->ch.chars);
+		}
+	}
+	size += (unsigned longlong) document->unpacked_size
+		* sizeof(*document->unpacked);
+
+	if (document->links) {
+		size += (unsigned longlong) document->nlinks * sizeof(*document->links);
+		for (i = 0; i < document->nlinks; i++) {
+			struct link *link = &document->links[i];
+
+			size += (unsigned longlong) link->npoints * sizeof(*link->points);
+			if (link->where) size += strlen(link->where) + 1;
+		}
+	}
+	if (document->reverse_link_lookup) {
+		size += (unsigned longlong) document->nlinks * sizeof(*document->reverse_link_lookup);
+	}
+	if (document->lines1) {
+		size += (unsigned longlong) document->height * sizeof(*document->lines1);
+	}
+	if (document->lines2) {
+		size += (unsigned longlong) document->height * sizeof(*document->lines2);
+	}
+
+	if (document->search) {
+		size += (unsigned longlong) document->nsearch * sizeof(*document->search);
+	}
+	if (document->slines1) {
+		size += (unsigned longlong) document->height * sizeof(*document->slines1);
+	}
+	if (document->slines2) {
+		size += (unsigned longlong) document->height * sizeof(*document->slines2);
+	}
+	if (document->search_points) {
+		size += (unsigned longlong) document->number_of_search_points
+			* sizeof(*document->search_points);
+	}
+
+	foreach (form, document->forms) {
+		struct el_form_control *fc;
+
+		size += sizeof(*form);
+		foreach (fc, form->items) {
+			size += sizeof(*fc);
+			size += (unsigned longlong) fc->nvalues
+				* (sizeof(*fc->values) + sizeof(*fc->labels));
+		}
+	}
+
+#ifdef CONFIG_LIBDOM
+	size += document->text.length;
+#endif
+
+	return size;
+}
+
+void
+foreach_cached_document(struct cache_entry *cached,
+			void (*func)(struct document *, void *), void *data)
+{
+	ELOG
+	struct format_cache_uri *bucket = get_format_cache_uri(cached->uri);
+	struct document_list *item;
+
+	if (!bucket) return;
+
+	for (item = bucket->documents; item; item = item->next_in_bucket) {
+		if (item->document->cached == cached)
+			func(item->document, data);
+	}
+}
+
+/* Documents in use may still change, so only the size of unused ones is
+ * taken from the value remembered by release_document(). */
+static unsigned longlong
+get_format_cache_document_size(struct document *document)
+{
+	ELOG
+	if (is_object_used(document) || !document->memory_size)
+		return get_document_memory_size(document);
+
+	return document->memory_size;
 }
 
 int
@@ -664,10 +904,16 @@ get_cached_document(struct cache_entry *cached, struct document_options *options
 {
 	ELOG
 	struct document *ret = NULL;
+	struct format_cache_uri *bucket = get_format_cache_uri(cached->uri);
 	struct document_list *item, *it;
 	INIT_LIST_OF(struct document_list, to_remove);
 
-	foreach (it, format_cache) {
+	if (!bucket) {
+		format_cache_misses++;
+		return NULL;
+	}
+
+	for (it = bucket->documents; it; it = it->next_in_bucket) {
 		struct document *document = it->document;
 
 		if (!compare_uri(document->uri, cached->uri, 0)
@@ -677,6 +923,12 @@ get_cached_document(struct cache_entry *cached, struct document_options *options
 		if (
 		    cached->cache_id != document->cache_id
 		    || !check_document_css_magic(document)) {
+			/* Left for get_resumable_document(). */
+			if (document->checkpoint
+			    && document->prefix_id == cached->prefix_id
+			    && check_document_css_magic(document))
+				continue;
+
 			if (!is_object_used(document)) {
 				add_to_document_list(&to_remove, document);
 			}
@@ -694,13 +946,216 @@ get_cached_document(struct cache_entry *cached, struct document_options *options
 		/* Reactivate */
 		move_document_to_top_of_format_cache(ret);
 		object_lock(ret);
+		format_cache_hits++;
 
 		return ret;
 	}
 
+	format_cache_misses++;
 	return NULL;
 }
 
+struct document *
+get_resumable_document(struct cache_entry *cached, struct document_options *options)
+{
+	ELOG
+	struct format_cache_uri *bucket = get_format_cache_uri(cached->uri);
+	struct document_list *it;
+
+	if (!bucket) return NULL;
+
+	for (it = bucket->documents; it; it = it->next_in_bucket) {
+		struct document *document = it->document;
+
+		if (!document->checkpoint
+		    || document->prefix_id != cached->prefix_id
+		    || document->cache_id == cached->cache_id
+		    || is_object_used(document)
+		    || !compare_uri(document->uri, cached->uri, 0)
+		    || compare_opt(&document->options, options)
+		    || !check_document_css_magic(document))
+			continue;
+
+		object_lock(document);
+		return document;
+	}
+
+	return NULL;
+}
+
+void
+resume_document(struct document *document, struct document *base,
+		int lines, int nlinks)
+{
+	ELOG
+	struct node *node, *next;
+	int pos;
+
+	assert(!document->data && !document->links);
+	assert(lines <= base->height && nlinks <= base->nlinks);
+	if_assert_failed return;
+
+	/* The line and link arrays are taken over as they are, only their
+	 * tails are dropped.  Clear them since ALIGN_LINES() and ALIGN_LINK()
+	 * expect anything past the used entries to be zeroed. */
+	for (pos = lines; pos < base->height; pos++)
+		mem_free_if(base->data[pos].ch.chars);
+	if (base->height > lines)
+		memset(&base->data[lines], 0,
+		       (base->height - lines) * sizeof(*base->data));
+
+	document->data = base->data;
+	document->height = lines;
+	base->data = NULL;
+	base->height = 0;
+
+	for (pos = nlinks; pos < base->nlinks; pos++)
+		done_link_members(&base->links[pos]);
+	if (base->nlinks > nlinks)
+		memset(&base->links[nlinks], 0,
+		       (base->nlinks - nlinks) * sizeof(*base->links));
+
+	document->links = base->links;
+	document->nlinks = nlinks;
+	document->links_sorted = 0;
+	base->links = NULL;
+	base->nlinks = 0;
+
+	/* Keep the order of the nodes, the newest first. */
+	for (node = (struct node *)base->nodes.next;
+	     node != (struct node *)&base->nodes; node = next) {
+		next = node->next;
+		if (node->box.y >= lines) continue;
+
+		del_from_list(node);
+		add_to_list_end(document->nodes, node);
+		int_lower_bound(&document->width, node->box.x + node->box.width);
+	}
+}
+
+static inline int
+is_same_run(struct screen_char *a, struct screen_char *b)
+{
+	ELOG
+	return a->attr == b->attr
+		&& !memcmp(&a->c, &b->c, sizeof(a->c))
+		&& a->is_default_fg_color == b->is_default_fg_color
+		&& a->is_default_bg_color == b->is_default_bg_color
+		&& a->number == b->number;
+}
+
+static void
+pack_line(struct line *line)
+{
+	ELOG
+	struct screen_char *chars = line->ch.chars;
+	struct packed_line *packed;
+	unsigned char *text;
+	int nruns = 1, wide = 0;
+	int x, run;
+
+	for (x = 1; x < line->length; x++)
+		if (!is_same_run(&chars[x], &chars[x - 1]))
+			nruns++;
+
+#ifdef CONFIG_UTF8
+	for (x = 0; x < line->length; x++)
+		if (chars[x].data > 0xFF) {
+			wide = 1;
+			break;
+		}
+#endif
+
+	packed = (struct packed_line *)mem_alloc(offsetof(struct packed_line, runs)
+			+ nruns * sizeof(*packed->runs)
+			+ line->length * (wide ? sizeof(chars->data) : 1));
+	if (!packed) return;
+
+	packed->nruns = nruns;
+	packed->wide = wide;
+	text = packed_line_text(packed);
+
+	for (x = 0, run = -1; x < line->length; x++) {
+		if (!x || !is_same_run(&chars[x], &chars[x - 1])) {
+			run++;
+			copy_struct(&packed->runs[run].template_, &chars[x]);
+		}
+		packed->runs[run].end = x + 1;
+#ifdef CONFIG_UTF8
+		if (wide)
+			((unicode_val_T *) text)[x] = chars[x].data;
+		else
+#endif
+			text[x] = chars[x].data;
+	}
+
+	mem_free(chars);
+	line->ch.packed = packed;
+	line->packed = 1;
+}
+
+void
+pack_document(struct document *document)
+{
+	ELOG
+	int y, length = 0;
+
+	for (y = 0; y < document->height; y++)
+		int_lower_bound(&length, document->data[y].length);
+
+	/* Allocated up front, so that get_line_chars() cannot fail. */
+	if (document->unpacked_size < length) {
+		struct screen_char *unpacked;
+
+		unpacked = (struct screen_char *)mem_realloc(document->unpacked,
+				length * sizeof(*unpacked));
+		if (!unpacked) return;
+		document->unpacked = unpacked;
+		document->unpacked_size = length;
+	}
+	document->unpacked_y = -1;
+
+	for (y = 0; y < document->height; y++) {
+		struct line *line = &document->data[y];
+
+		if (!line->packed && line->length)
+			pack_line(line);
+	}
+}
+
+struct screen_char *
+get_line_chars(struct document *document, int y)
+{
+	ELOG
+	struct line *line = &document->data[y];
+	struct packed_line *packed = line->ch.packed;
+	unsigned char *text;
+	int x, run;
+
+	if (!line->packed) return line->ch.chars;
+
+	if (document->unpacked_y == y)
+		return document->unpacked;
+
+	text = packed_line_text(packed);
+	for (x = 0, run = 0; x < line->length; x++) {
+		struct screen_char *ch = &document->unpacked[x];
+
+		if (x == packed->runs[run].end) run++;
+		copy_struct(ch, &packed->runs[run].template_);
+#ifdef CONFIG_UTF8
+		if (packed->wide)
+			ch->data = ((unicode_val_T *) text)[x];
+		else
+#endif
+			ch->data = text[x];
+	}
+
+	document->unpacked_y = y;
+
+	return document->unpacked;
+}
+
 void
 shrink_format_cache(int whole)
 {
@@ -708,23 +1163,27 @@ shrink_format_cache(int whole)
 	struct document *document;
 	struct document_list *item, *it;
 	int format_cache_size = get_opt_int("document.cache.format.size", NULL);
+	unsigned longlong format_cache_memory = get_opt_long("document.cache.format.memory", NULL);
 	int format_cache_entries = 0;
+	unsigned longlong format_cache_bytes = 0;
 	INIT_LIST_OF(struct document_list, to_remove);
 
 	foreach (it, format_cache) {
 		document = it->document;
 
+		/* Documents being displayed cannot be dropped, so they
+		 * do not count towards the memory budget either. */
 		if (is_object_used(document)) continue;
 
-		format_cache_entries++;
-
 		/* Destroy obsolete renderer documents which are already
 		 * out-of-sync. */
-		if (document->cached->cache_id == document->cache_id)
+		if (document->cached->cache_id == document->cache_id) {
+			format_cache_entries++;
+			format_cache_bytes += get_format_cache_document_size(document);
 			continue;
+		}
 
 		add_to_document_list(&to_remove, document);
-		format_cache_entries--;
 	}
 
 	assertm(format_cache_entries >= 0, "format_cache_entries underflow on entry");
@@ -741,12 +1200,16 @@ shrink_format_cache(int whole)
 		if (is_object_used(document)) continue;
 
 		/* If we are not purging the whole format cache, stop
-		 * once we are below the maximum number of entries. */
-		if (!whole && format_cache_entries <= format_cache_size)
+		 * once we are below the maximum number of entries and
+		 * within the memory budget. */
+		if (!whole && format_cache_entries <= format_cache_size
+		    && (!format_cache_memory
+		        || format_cache_bytes <= format_cache_memory))
 			break;
 
 		add_to_document_list(&to_remove, document);
 		format_cache_entries--;
+		format_cache_bytes -= get_format_cache_document_size(document);
 	}
 	foreach (item, to_remove) {
 		done_document(item->document);
@@ -798,6 +1261,33 @@ get_format_cache_refresh_count(void)
 	return i;
 }
 
+unsigned longlong
+get_format_cache_memory_size(void)
+{
+	ELOG
+	struct document_list *it;
+	unsigned longlong size = 0;
+
+	foreach (it, format_cache) {
+		size += get_format_cache_document_size(it->document);
+	}
+	return size;
+}
+
+long
+get_format_cache_hits(void)
+{
+	ELOG
+	return format_cache_hits;
+}
+
+long
+get_format_cache_misses(void)
+{
+	ELOG
+	return format_cache_misses;
+}
+
 static void
 init_documents(struct module *module)
 {
@@ -811,6 +1301,10 @@ done_documents(struct module *module)
 	ELOG
 	free_tags_lookup();
 	free_table_cache();
+	/* Documents still locked at this point are never freed. */
+	if (format_cache_index && list_empty(format_cache)) {
+		free_hash(&format_cache_index);
+	}
 }
 
 #ifdef CONFIG_ECMASCRIPT
@@ -894,10 +1388,11 @@ insert_document_into_document(struct document *dest, struct document *src, int y
 		return;
 	}
 	memmove(&dest->data[y + src->height], &dest->data[y], (dest->height - y) * sizeof(struct line));
+	dest->unpacked_y = -1;
 
 	int i;
 	for (i = 0; i < src->height; i++) {
-		copy_line(&dest->data[y + i], &src->data[i]);
+		copy_line(&dest->data[y + i], src, i);
 	}
 
 	if (!ALIGN_LINK(&dest->links, dest->nlinks, dest->nlinks + src->nlinks)) {
@@ -1010,6 +1505,7 @@ remove_document_from_document(struct document *dest, struct document *src, int y
 		mem_free_if(dest->data[y + i].ch.chars);
 	}
 	memmove(&dest->data[y], &dest->data[y + src->height], (dest->height - src->height - y) * sizeof(struct line));
+	dest->unpacked_y = -1;
 
 	if (!ALIGN_LINES(&dest->data, dest->height, dest->height - src->height)) {
 		return;
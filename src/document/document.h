@@ -15,6 +15,7 @@ extern "C" {
 #endif
 
 struct cache_entry;
+struct document_list;
 struct document_refresh;
 struct ecmascript_string_list_item;
 struct ecmascript_timeout;
@@ -25,6 +26,8 @@ struct hash;
 struct iframe2;
 struct image;
 struct module;
+struct packed_line;
+struct render_checkpoint;
 struct screen_char;
 struct string;
 
@@ -47,9 +50,13 @@ struct sixel {
 struct line {
 	union {
 		struct screen_char *chars;
+		/** If #packed is set.  @see get_line_chars() */
+		struct packed_line *packed;
 		//struct sixel *sixel;
 	} ch;
 	unsigned int length;
+	/** Whether pack_document() has packed the line. */
+	unsigned int packed:1;
 };
 
 /** Codepage status */
@@ -270,6 +277,12 @@ struct document {
 
 	struct uri *uri;
 
+	/** The entry of this document in the format cache. */
+	struct document_list *format_cache_item;
+	/** Bytes used by the document when it was last released.
+	 * @see get_document_memory_size() */
+	unsigned longlong memory_size;
+
 	/* for obtaining IP */
 	void *querydns;
 	char *ip;
@@ -293,6 +306,16 @@ struct document {
 	struct link **lines2; /**< The last link on the line. */
 	/** @} */
 
+	/** Where the renderer can pick up once more data arrive, NULL if the
+	 * document can not be resumed.
+	 * @see continue_plain_document() */
+	struct render_checkpoint *checkpoint;
+
+	/** The packed line get_line_chars() last unpacked and where to. */
+	struct screen_char *unpacked;
+	int unpacked_size;
+	int unpacked_y;
+
 	struct search *search;
 	struct search **slines1;
 	struct search **slines2;
@@ -303,6 +326,7 @@ struct document {
 	unsigned char buf_length;
 #endif
 	unsigned int cache_id; /**< Used to check cache entries. */
+	unsigned int prefix_id; /**< cache_entry.prefix_id when rendered. */
 
 	int cp;
 	int width, height; /**< size of document */
@@ -356,16 +380,51 @@ void update_cached_document_options(struct session *ses);
 
 struct document *get_cached_document(struct cache_entry *cached, struct document_options *options);
 
+/** Returns an outdated document for @a cached which was rendered with the
+ * same @a options from a prefix of the current data and left a checkpoint,
+ * or NULL.  The document is locked and no longer used by anything else.
+ * @relates document */
+struct document *get_resumable_document(struct cache_entry *cached, struct document_options *options);
+
+/** Moves the first @a lines lines and @a nlinks links of @a base, which
+ * must not be used by anything else, to the empty @a document together
+ * with the nodes above @a lines.  @a base is left for done_document().
+ * @relates document */
+void resume_document(struct document *document, struct document *base,
+		     int lines, int nlinks);
+
+/** Stores the lines of the fully rendered @a document as their text and
+ * runs of otherwise equal chars, which takes a fraction of the memory.
+ * @relates document */
+void pack_document(struct document *document);
+
+/** Returns the chars of the line @a y of @a document.  A packed line is
+ * unpacked to a buffer of the document, so the chars are only valid until
+ * the next call for another line.
+ * @relates document */
+struct screen_char *get_line_chars(struct document *document, int y);
+
 /** Release a reference to the document.
  * @relates document */
 void release_document(struct document *document);
 
 void reset_document(struct document *document);
 
+/** Returns the number of bytes used by the rendered lines, links,
+ * search index and forms of the document.
+ * @relates document */
+unsigned longlong get_document_memory_size(struct document *document);
+
+/** Calls @a func for each formatted document of @a cached. */
+void foreach_cached_document(struct cache_entry *cached,
+			     void (*func)(struct document *, void *), void *data);
 
 int get_format_cache_size(void);
 int get_format_cache_used_count(void);
 int get_format_cache_refresh_count(void);
+long get_format_cache_hits(void);
+long get_format_cache_misses(void);
+unsigned longlong get_format_cache_memory_size(void);
 
 void shrink_format_cache(int);
 
@@ -575,6 +575,7 @@ again:
 	if (!im) {
 		return;
 	}
+	im->id = get_new_image_id();
 	im->data = el_string_ref(data);
 	im->width = width;
 	im->height = height;
@@ -587,7 +588,9 @@ again:
 	int how_many = (height + document->options.cell_height - 1) / document->options.cell_height;
 	int xw = (im->width + document->options.cell_width - 1) / document->options.cell_width;
 	int y;
+#ifdef CONFIG_LIBDOM
 	im->image_number = html_top->name - document->text.source;
+#endif
 
 	for (y = 0; y < how_many; y++) {
 		int x;
@@ -795,8 +795,10 @@ scan_document(struct document *document)
 	prev_element = NULL;
 
 	for (y = 0; y < document->height; y++) {
+		struct screen_char *chars = get_line_chars(document, y);
+
 		for (x = 0; x < document->data[y].length; x++) {
-			int offset = document->data[y].ch.chars[x].number;
+			int offset = chars[x].number;
 
 			if (!offset) {
 				continue;
@@ -35,6 +35,26 @@
 #include "util/string.h"
 
 
+/* The state add_document_lines() needs to go on from the start of a line
+ * once more data have been appended to the cache entry. */
+struct render_checkpoint {
+	/* The offset of the line in the source */
+	int offset;
+
+	/* The line number and number of links at that point */
+	int lineno;
+	int nlinks;
+
+	/* The codepage the lines were converted from */
+	int cp;
+
+	/* The template as changed by the escape sequences so far */
+	struct screen_char template_;
+
+	unsigned int was_empty_line:1;
+	unsigned int was_wrapped:1;
+};
+
 struct plain_renderer {
 	/* The document being renderered */
 	struct document *document;
@@ -43,6 +63,9 @@ struct plain_renderer {
 	char *source;
 	int length;
 
+	/* Where in the source to start rendering */
+	int offset;
+
 	/* The convert table that should be used for converting line strings to
 	 * the rendered strings. */
 	struct conv_table *convert_table;
@@ -56,9 +79,20 @@ struct plain_renderer {
 	/* The current line number */
 	int lineno;
 
+	/* The start of the last line added and the last one before it
+	 * which had a lower line number */
+	struct render_checkpoint checkpoints[2];
+
+	/* The state of empty line handling at the offset */
+	unsigned int was_empty_line:1;
+	unsigned int was_wrapped:1;
+
 	/* Are we doing line compression */
 	unsigned int compress:1;
 
+	/* Are we keeping checkpoints */
+	unsigned int checkpoint:1;
+
 #ifdef CONFIG_LIBSIXEL
 	unsigned int sixel:1;
 #endif
@@ -287,6 +321,9 @@ decode_esc_color(char *text, int *line_pos, int width,
 	end = buf + k;
 	begin = tail = buf;
 
+	/* Neither is fully set in all color modes. */
+	memset(&ch, 0, sizeof(ch));
+	memset(&color, 0, sizeof(color));
 	get_screen_char_color(template_, &color, 0, mode);
 
 	back_red = RED_COLOR(color.background);
@@ -783,14 +820,34 @@ add_node(struct plain_renderer *renderer, int x, int width, int height)
 	return node;
 }
 
+static void
+save_checkpoint(struct plain_renderer *renderer, int offset,
+		int was_empty_line, int was_wrapped)
+{
+	ELOG
+	struct render_checkpoint *checkpoint = renderer->checkpoints;
+
+	/* Empty lines may be squeezed without moving to the next line. */
+	if (renderer->lineno > checkpoint[0].lineno)
+		checkpoint[1] = checkpoint[0];
+
+	checkpoint[0].offset = offset;
+	checkpoint[0].lineno = renderer->lineno;
+	checkpoint[0].nlinks = renderer->document->nlinks;
+	checkpoint[0].cp = renderer->document->cp;
+	checkpoint[0].template_ = renderer->template_;
+	checkpoint[0].was_empty_line = was_empty_line;
+	checkpoint[0].was_wrapped = was_wrapped;
+}
+
 static void
 add_document_lines(struct plain_renderer *renderer)
 {
 	ELOG
-	char *source = renderer->source;
-	int length = renderer->length;
-	int was_empty_line = 0;
-	int was_wrapped = 0;
+	char *source = renderer->source + renderer->offset;
+	int length = renderer->length - renderer->offset;
+	int was_empty_line = renderer->was_empty_line;
+	int was_wrapped = renderer->was_wrapped;
 #ifdef CONFIG_UTF8
 	int utf8 = is_cp_utf8(renderer->document->cp);
 #endif
@@ -803,6 +860,10 @@ add_document_lines(struct plain_renderer *renderer)
 		int cells = 0;
 		int max_width = renderer->max_width;
 
+		if (renderer->checkpoint)
+			save_checkpoint(renderer, source - renderer->source,
+					was_empty_line, was_wrapped);
+
 #ifdef CONFIG_LIBSIXEL
 		if (renderer->sixel && max_width != INT_MAX) {
 			char *escp = elinks_strlcasestr(source, int_min(length, max_width+1), "\033P", 2);
@@ -908,12 +969,12 @@ add_document_lines(struct plain_renderer *renderer)
 }
 
 static void
-fixup_tables(struct plain_renderer *renderer)
+fixup_tables(struct plain_renderer *renderer, int start)
 {
 	ELOG
 	int y;
 
-	for (y = 0; y < renderer->lineno; y++) {
+	for (y = start; y < renderer->lineno; y++) {
 		int x;
 		struct line *prev_line = y > 0 ? &renderer->document->data[y - 1] : NULL;
 		struct line *line = &renderer->document->data[y];
@@ -1027,14 +1088,15 @@ fixup_tables(struct plain_renderer *renderer)
 	}
 }
 
-void
-render_plain_document(struct cache_entry *cached, struct document *document,
-		      struct string *buffer)
+static void
+render_plain(struct cache_entry *cached, struct document *document,
+	     struct string *buffer, struct document *base, int checkpoint)
 {
 	ELOG
 	struct conv_table *convert_table;
 	char *head = empty_string_or_(cached->head);
 	struct plain_renderer renderer;
+	int start;
 
 	convert_table = get_convert_table(head, document->options.cp,
 					  document->options.assume_cp,
@@ -1044,13 +1106,19 @@ render_plain_document(struct cache_entry *cached, struct document *document,
 
 	renderer.source = buffer->source;
 	renderer.length = buffer->length;
+	renderer.offset = 0;
 
 	renderer.document = document;
 	renderer.lineno = 0;
 	renderer.convert_table = convert_table;
+	renderer.was_empty_line = 0;
+	renderer.was_wrapped = 0;
 	renderer.compress = document->options.plain_compress_empty_lines;
+	renderer.checkpoint = checkpoint;
 #ifdef CONFIG_LIBSIXEL
 	renderer.sixel = document->options.sixel;
+	/* The images are not kept with the lines. */
+	if (renderer.sixel) renderer.checkpoint = 0;
 #endif
 	renderer.max_width = document->options.wrap ? document->options.document_width
 						    : INT_MAX;
@@ -1064,9 +1132,54 @@ render_plain_document(struct cache_entry *cached, struct document *document,
 	/* Setup the style */
 	init_template(&renderer.template_, &document->options);
 
+	if (base && base->checkpoint
+	    && base->checkpoint->cp == document->cp
+	    && base->checkpoint->offset <= buffer->length) {
+		struct render_checkpoint *resume = base->checkpoint;
+
+		resume_document(document, base, resume->lineno, resume->nlinks);
+
+		renderer.offset = resume->offset;
+		renderer.lineno = resume->lineno;
+		renderer.template_ = resume->template_;
+		renderer.was_empty_line = resume->was_empty_line;
+		renderer.was_wrapped = resume->was_wrapped;
+	}
+
+	start = renderer.lineno;
+	save_checkpoint(&renderer, renderer.offset, renderer.was_empty_line,
+			renderer.was_wrapped);
+	renderer.checkpoints[1] = renderer.checkpoints[0];
+
 	add_document_lines(&renderer);
 
 	if (document->options.plain_fixup_tables) {
-		fixup_tables(&renderer);
+		fixup_tables(&renderer, start);
 	}
+
+	if (renderer.checkpoint) {
+		/* Lines are fixed up looking at the line below, so the last
+		 * line before the last one has to be redone too. */
+		int last = !!document->options.plain_fixup_tables;
+
+		document->checkpoint = (struct render_checkpoint *)mem_alloc(sizeof(*document->checkpoint));
+		if (document->checkpoint)
+			*document->checkpoint = renderer.checkpoints[last];
+	}
+}
+
+void
+render_plain_document(struct cache_entry *cached, struct document *document,
+		      struct string *buffer)
+{
+	ELOG
+	render_plain(cached, document, buffer, NULL, 0);
+}
+
+void
+continue_plain_document(struct cache_entry *cached, struct document *document,
+			struct string *buffer, struct document *base)
+{
+	ELOG
+	render_plain(cached, document, buffer, base, cached->incomplete);
 }
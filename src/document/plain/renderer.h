@@ -12,6 +12,12 @@ struct string;
 
 void render_plain_document(struct cache_entry *cached, struct document *document, struct string *buffer);
 
+/* Renders @buffer, the data of the cache entry @cached, taking over the
+ * lines of @base, if any, which was rendered from a shorter part of the
+ * same data.  While @cached is incomplete, the document gets a checkpoint
+ * of its own for the next time. */
+void continue_plain_document(struct cache_entry *cached, struct document *document, struct string *buffer, struct document *base);
+
 #ifdef __cplusplus
 }
 #endif
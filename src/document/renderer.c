@@ -57,7 +57,8 @@
 
 
 static void
-render_encoded_document(struct cache_entry *cached, struct document *document)
+render_encoded_document(struct cache_entry *cached, struct document *document,
+			struct document *base)
 {
 	ELOG
 	struct uri *uri = cached->uri;
@@ -123,6 +124,9 @@ render_encoded_document(struct cache_entry *cached, struct document *document)
 			render_dom_document(cached, document, &buffer);
 		else
 #endif
+		if (encoding == ENCODING_NONE)
+			continue_plain_document(cached, document, &buffer, base);
+		else
 			render_plain_document(cached, document, &buffer);
 
 	} else {
@@ -380,8 +384,14 @@ render_document(struct view_state *vs, struct document_view *doc_view,
 	if (document) {
 		doc_view->document = document;
 	} else {
+		/* Taken before shrink_memory() can drop it. */
+		struct document *base = get_resumable_document(cached, options);
+
 		document = init_document(cached, options);
-		if (!document) return;
+		if (!document) {
+			if (base) object_unlock(base);
+			return;
+		}
 		doc_view->document = document;
 
 		if (doc_view->session
@@ -391,10 +401,18 @@ render_document(struct view_state *vs, struct document_view *doc_view,
 
 		shrink_memory(0);
 
-		render_encoded_document(cached, document);
+		render_encoded_document(cached, document, base);
+
+		if (base) {
+			object_unlock(base);
+			if (!is_object_used(base))
+				done_document(base);
+		}
 
 		if (!vs->plain && options->html_compress_empty_lines) {
 			compress_empty_lines(document);
+			/* The lines were moved around. */
+			mem_free_set(&document->checkpoint, NULL);
 		}
 
 		sort_links(document);
@@ -421,6 +439,10 @@ render_document(struct view_state *vs, struct document_view *doc_view,
 #ifdef CONFIG_CSS
 		document->css_magic = get_document_css_magic(document);
 #endif
+
+		if (!cached->incomplete && !document->checkpoint
+		    && get_opt_bool("document.cache.format.compact", NULL))
+			pack_document(document);
 	}
 #if defined(CONFIG_ECMASCRIPT_SMJS) || defined(CONFIG_QUICKJS) || defined(CONFIG_MUJS)
 	check_for_snippets(vs, options, document);
@@ -176,6 +176,51 @@ brotli_decode_buffer(struct stream_encoded *st, char *datac, int len, int *new_l
 	return NULL;
 }
 
+/* Unlike brotli_decode_buffer(), which keeps everything until the end
+ * of the stream, this hands out the decoded data as soon as there is
+ * some, straight into the room given by @sink. */
+static int
+brotli_decode_to(struct stream_encoded *st, char *datac, int len,
+		 struct decoding_sink *sink)
+{
+	ELOG
+	struct br_enc_data *enc_data = (struct br_enc_data *)st->data;
+	BrotliDecoderState *state = enc_data->state;
+	const uint8_t *next_in = (const uint8_t *)datac;
+	size_t avail_in = len;
+	int total = 0;
+	int error;
+
+	if (!len || enc_data->after_end) return 0;
+
+	do {
+		int avail, produced;
+		char *room = sink->reserve(sink->data, ELINKS_BROTLI_BUFFER_LENGTH, &avail);
+		uint8_t *next_out = (uint8_t *)room;
+		size_t avail_out = avail;
+
+		if (!room) {
+			error = BROTLI_DECODER_RESULT_ERROR;
+			break;
+		}
+
+		error = BrotliDecoderDecompressStream(state, &avail_in, &next_in,
+						      &avail_out, &next_out, NULL);
+
+		produced = avail - avail_out;
+		if (produced && sink->commit(sink->data, produced) < 0) {
+			error = BROTLI_DECODER_RESULT_ERROR;
+			break;
+		}
+		total += produced;
+	} while (error == BROTLI_DECODER_RESULT_NEEDS_MORE_OUTPUT);
+
+	if (error == BROTLI_DECODER_RESULT_SUCCESS)
+		enc_data->after_end = 1;
+
+	return error == BROTLI_DECODER_RESULT_ERROR ? -1 : total;
+}
+
 static void
 brotli_close(struct stream_encoded *stream)
 {
@@ -218,5 +263,6 @@ const struct decoding_backend brotli_decoding_backend = {
 	brotli_open,
 	brotli_read,
 	brotli_decode_buffer,
+	brotli_decode_to,
 	brotli_close,
 };
@@ -198,6 +198,57 @@ bzip2_decode_buffer(struct stream_encoded *st, char *data, int len, int *new_len
 	}
 }
 
+/* Same as bzip2_decode_buffer() but decompresses straight into the room
+ * given by @sink instead of a buffer of its own. */
+static int
+bzip2_decode_to(struct stream_encoded *st, char *data, int len,
+		struct decoding_sink *sink)
+{
+	ELOG
+	struct bz2_enc_data *enc_data = (struct bz2_enc_data *)st->data;
+	bz_stream *stream = &enc_data->fbz_stream;
+	int total = 0;
+	int error;
+
+	if (!len || enc_data->after_end) return 0;
+	stream->next_in = data;
+	stream->avail_in = len;
+
+	do {
+		int avail, produced;
+		char *room = sink->reserve(sink->data, MAX_STR_LEN, &avail);
+
+		if (!room) {
+			error = BZ_MEM_ERROR;
+			break;
+		}
+
+		stream->next_out  = room;
+		stream->avail_out = avail;
+
+		error = BZ2_bzDecompress(stream);
+
+		produced = avail - stream->avail_out;
+		if (produced && sink->commit(sink->data, produced) < 0) {
+			error = BZ_MEM_ERROR;
+			break;
+		}
+		total += produced;
+
+		/* BZ_STREAM_END is not forced when the end of input is
+		 * reached, see bzip2_decode_buffer(). Keep going only while
+		 * there is input left or the output window was filled. */
+	} while (error == BZ_OK && (stream->avail_in > 0 || !stream->avail_out));
+
+	if (error == BZ_STREAM_END) {
+		BZ2_bzDecompressEnd(stream);
+		enc_data->after_end = 1;
+		error = BZ_OK;
+	}
+
+	return error == BZ_OK ? total : -1;
+}
+
 static void
 bzip2_close(struct stream_encoded *stream)
 {
@@ -241,5 +292,6 @@ const struct decoding_backend bzip2_decoding_backend = {
 	bzip2_open,
 	bzip2_read,
 	bzip2_decode_buffer,
+	bzip2_decode_to,
 	bzip2_close,
 };
@@ -22,6 +22,7 @@
 #include "encoding/encoding.h"
 #include "network/state.h"
 #include "osdep/osdep.h"
+#include "util/math.h"
 #include "util/memory.h"
 #include "util/string.h"
 
@@ -65,6 +66,26 @@ dummy_decode_buffer(struct stream_encoded *stream, char *data, int len, int *new
 	return buffer;
 }
 
+static int
+dummy_decode_to(struct stream_encoded *stream, char *data, int len, struct decoding_sink *sink)
+{
+	ELOG
+	int done = 0;
+
+	while (done < len) {
+		int avail;
+		char *room = sink->reserve(sink->data, len - done, &avail);
+
+		if (!room) return -1;
+		int_upper_bound(&avail, len - done);
+		memcpy(room, data + done, avail);
+		if (sink->commit(sink->data, avail) < 0) return -1;
+		done += avail;
+	}
+
+	return done;
+}
+
 static void
 dummy_close(struct stream_encoded *stream)
 {
@@ -81,6 +102,7 @@ static const struct decoding_backend dummy_decoding_backend = {
 	dummy_open,
 	dummy_read,
 	dummy_decode_buffer,
+	dummy_decode_to,
 	dummy_close,
 };
 
@@ -147,6 +169,32 @@ decode_encoded_buffer(struct stream_encoded *stream, stream_encoding_T encoding,
 	return decoding_backends[encoding]->decode_buffer(stream, data, len, new_len);
 }
 
+/* Decode the next chunk of a stream. Unlike decode_encoded_buffer(),
+ * @data may be any part of the stream; the decoded data are written
+ * to @sink as they come out of the decoder. Backends without their own
+ * decode_to() handler go through decode_buffer() and a copy.
+ * Returns the number of decoded bytes, or -1 on error. */
+int
+decode_encoded_to(struct stream_encoded *stream, char *data, int len,
+		  struct decoding_sink *sink)
+{
+	ELOG
+	const struct decoding_backend *backend = decoding_backends[stream->encoding];
+	char *buffer;
+	int new_len, ret;
+
+	if (backend->decode_to)
+		return backend->decode_to(stream, data, len, sink);
+
+	buffer = backend->decode_buffer(stream, data, len, &new_len);
+	if (!buffer) return len ? -1 : 0;
+
+	ret = dummy_decode_to(stream, buffer, new_len, sink);
+	mem_free(buffer);
+
+	return ret;
+}
+
 /* Closes encoded stream. Note that fd associated with the stream will be
  * closed here. */
 void
@@ -27,18 +27,39 @@ struct stream_encoded {
 	void *data;
 };
 
+/* Where decode_encoded_to() puts the decoded data. The decoder asks for
+ * room with reserve() and writes straight into it, so that the consumer
+ * (usually the cache entry being loaded) does not need to copy the data
+ * out of an intermediate buffer. */
+struct decoding_sink {
+	/* Returns room for at least @size bytes, or less if it can not do
+	 * better. The real amount of room is stored in *@avail. The room is
+	 * only valid until the next reserve() call. */
+	char *(*reserve)(void *data, int size, int *avail);
+
+	/* Marks @len bytes written to the reserved room as decoded data.
+	 * Returns -1 on error. */
+	int (*commit)(void *data, int len);
+
+	void *data;
+};
+
 struct decoding_backend {
 	const char *name;
 	const char *const *extensions;
 	int (*eopen)(struct stream_encoded *stream, int fd);
 	int (*eread)(struct stream_encoded *stream, char *data, int len);
 	char *(*decode_buffer)(struct stream_encoded *stream, char *data, int len, int *new_len);
+	/* Optional. Returns the number of bytes committed to @sink or -1 on
+	 * error. */
+	int (*decode_to)(struct stream_encoded *stream, char *data, int len, struct decoding_sink *sink);
 	void (*eclose)(struct stream_encoded *stream);
 };
 
 struct stream_encoded *open_encoded(int, stream_encoding_T);
 int read_encoded(struct stream_encoded *, char *, int);
 char *decode_encoded_buffer(struct stream_encoded *stream, stream_encoding_T encoding, char *data, int len, int *new_len);
+int decode_encoded_to(struct stream_encoded *stream, char *data, int len, struct decoding_sink *sink);
 void close_encoded(struct stream_encoded *);
 
 const char *const *listext_encoded(stream_encoding_T);
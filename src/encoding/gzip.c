@@ -213,6 +213,71 @@ restart2:
 	}
 }
 
+/* Same as deflate_decode_buffer() but inflates straight into the room
+ * given by @sink instead of a buffer of its own. */
+static int
+deflate_decode_to(struct stream_encoded *st, char *datac, int len,
+		  struct decoding_sink *sink)
+{
+	ELOG
+	unsigned char *data = (unsigned char *)datac;
+	struct deflate_enc_data *enc_data = (struct deflate_enc_data *) st->data;
+	z_stream *stream = &enc_data->deflate_stream;
+	int total = 0;
+	int error;
+
+	/* Anything following the end of the deflate stream is ignored. */
+	if (!len || enc_data->after_end) return 0;
+	stream->next_in = data;
+	stream->avail_in = len;
+
+	do {
+		int avail, produced;
+		char *room = sink->reserve(sink->data, MAX_STR_LEN, &avail);
+
+		if (!room) {
+			error = Z_MEM_ERROR;
+			break;
+		}
+
+		stream->next_out  = (unsigned char *)room;
+		stream->avail_out = avail;
+restart2:
+		error = inflate(stream, Z_SYNC_FLUSH);
+		if (error == Z_DATA_ERROR && !enc_data->after_first_read) {
+			(void)inflateEnd(stream);
+			error = inflateInit2(stream, -MAX_WBITS);
+			if (error == Z_OK) {
+				enc_data->after_first_read = 1;
+				stream->next_in = data;
+				stream->avail_in = len;
+				goto restart2;
+			}
+		}
+
+		produced = avail - stream->avail_out;
+		if (produced && sink->commit(sink->data, produced) < 0) {
+			error = Z_MEM_ERROR;
+			break;
+		}
+		total += produced;
+
+		/* A full output window may mean there is more output
+		 * pending even if all the input was consumed. */
+	} while (error == Z_OK && (stream->avail_in > 0 || !stream->avail_out));
+
+	if (error == Z_STREAM_END) {
+		inflateEnd(stream);
+		enc_data->after_end = 1;
+		error = Z_OK;
+	}
+
+	/* No progress was possible with the last window, which is fine. */
+	if (error == Z_BUF_ERROR) error = Z_OK;
+
+	return error == Z_OK ? total : -1;
+}
+
 static char *
 deflate_gzip_decode_buffer(struct stream_encoded *st, char *data, int len, int *new_len)
 {
@@ -254,5 +319,6 @@ const struct decoding_backend gzip_decoding_backend = {
 	deflate_gzip_open,
 	deflate_read,
 	deflate_gzip_decode_buffer,
+	deflate_decode_to,
 	deflate_close,
 };
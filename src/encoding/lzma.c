@@ -162,6 +162,57 @@ lzma_decode_buffer(struct stream_encoded *st, char *data, int len, int *new_len)
 	}
 }
 
+/* Unlike lzma_decode_buffer(), which restarts the decoder for every
+ * call, this continues the stream set up by lzma_open() and writes the
+ * decoded data straight into the room given by @sink. */
+static int
+lzma_decode_to(struct stream_encoded *st, char *data, int len,
+	       struct decoding_sink *sink)
+{
+	ELOG
+	struct lzma_enc_data *enc_data = (struct lzma_enc_data *) st->data;
+	lzma_stream *stream = &enc_data->flzma_stream;
+	int total = 0;
+	int error;
+
+	if (!len || enc_data->after_end) return 0;
+	stream->next_in = (unsigned char *)data;
+	stream->avail_in = len;
+
+	do {
+		int avail, produced;
+		char *room = sink->reserve(sink->data, MAX_STR_LEN, &avail);
+
+		if (!room) {
+			error = LZMA_MEM_ERROR;
+			break;
+		}
+
+		stream->next_out  = (unsigned char *)room;
+		stream->avail_out = avail;
+
+		error = lzma_code(stream, LZMA_RUN);
+
+		produced = avail - stream->avail_out;
+		if (produced && sink->commit(sink->data, produced) < 0) {
+			error = LZMA_MEM_ERROR;
+			break;
+		}
+		total += produced;
+	} while (error == LZMA_OK && (stream->avail_in > 0 || !stream->avail_out));
+
+	if (error == LZMA_STREAM_END) {
+		lzma_end(stream);
+		enc_data->after_end = 1;
+		error = LZMA_OK;
+	}
+
+	/* No progress was possible with the last window, which is fine. */
+	if (error == LZMA_BUF_ERROR) error = LZMA_OK;
+
+	return error == LZMA_OK ? total : -1;
+}
+
 static void
 lzma_close(struct stream_encoded *stream)
 {
@@ -195,5 +246,6 @@ const struct decoding_backend lzma_decoding_backend = {
 	lzma_open,
 	lzma_read,
 	lzma_decode_buffer,
+	lzma_decode_to,
 	lzma_close,
 };
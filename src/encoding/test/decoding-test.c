@@ -0,0 +1,268 @@
+/* Test and benchmark decoding into a sink against decode_buffer() */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef CONFIG_BZIP2
+#include <bzlib.h>
+#endif
+#ifdef CONFIG_GZIP
+#include <zlib.h>
+#endif
+
+#include "elinks.h"
+
+#include "encoding/bzip2.h"
+#include "encoding/encoding.h"
+#include "encoding/gzip.h"
+#include "util/memory.h"
+#include "util/time.h"
+
+/* fake tty get function, needed for charsets.c */
+int
+get_ctl_handle(void)
+{
+	return -1;
+}
+
+char *
+gettext(const char *text)
+{
+	return (char *)text;
+}
+
+int
+os_default_charset(void)
+{
+	return -1;
+}
+
+#define TEXT_LENGTH	(4 * 1024 * 1024)
+#define CHUNK_LENGTH	4096
+#define ROUNDS		8
+
+/* Collects the decoded data much like the cache entry does: one buffer
+ * growing geometrically, written to in place. */
+struct test_sink {
+	char *data;
+	int length;
+	int real_length;
+};
+
+static char *
+test_sink_reserve(void *data, int size, int *avail)
+{
+	struct test_sink *sink = (struct test_sink *)data;
+
+	if (sink->real_length - sink->length < size) {
+		int real_length = sink->real_length + sink->real_length / 2;
+		char *new_data;
+
+		if (real_length < sink->length + size)
+			real_length = sink->length + size;
+		new_data = (char *)mem_realloc(sink->data, real_length);
+		if (!new_data) return NULL;
+		sink->data = new_data;
+		sink->real_length = real_length;
+	}
+
+	*avail = sink->real_length - sink->length;
+	return sink->data + sink->length;
+}
+
+static int
+test_sink_commit(void *data, int len)
+{
+	struct test_sink *sink = (struct test_sink *)data;
+
+	sink->length += len;
+	return 0;
+}
+
+static char *text;
+
+static void
+make_text(void)
+{
+	static const char *const words[] = {
+		"<p>", "</p>", "the", "cache", "entry", "and", "<a href=\"",
+		"\">", "</a>", "document", "of", "fragment", "\n",
+	};
+	unsigned int seed = 1;
+	int pos = 0;
+
+	text = (char *)mem_alloc(TEXT_LENGTH);
+	if (!text) {
+		fputs("Out of memory.\n", stderr);
+		exit(EXIT_FAILURE);
+	}
+
+	while (pos < TEXT_LENGTH) {
+		const char *word;
+		int len;
+
+		seed = seed * 1103515245 + 12345;
+		word = words[(seed >> 8) % (sizeof(words) / sizeof(*words))];
+		len = strlen(word);
+		if (len > TEXT_LENGTH - pos - 1) len = TEXT_LENGTH - pos - 1;
+		memcpy(text + pos, word, len);
+		pos += len;
+		text[pos++] = ' ';
+	}
+}
+
+/* Decodes @encoded like the HTTP backend sees it, in @CHUNK_LENGTH pieces,
+ * either with decode_buffer() and a copy or straight into the sink. */
+static int
+decode(const struct decoding_backend *backend, char *encoded, int length,
+       int use_sink, struct test_sink *sink)
+{
+	struct stream_encoded stream;
+	struct decoding_sink decoding_sink = {
+		test_sink_reserve, test_sink_commit, sink
+	};
+	int pos;
+
+	if (backend->eopen(&stream, -1) < 0) return 0;
+
+	for (pos = 0; pos < length; pos += CHUNK_LENGTH) {
+		int len = length - pos < CHUNK_LENGTH ? length - pos : CHUNK_LENGTH;
+
+		if (use_sink) {
+			if (backend->decode_to(&stream, encoded + pos, len,
+					       &decoding_sink) < 0)
+				break;
+		} else {
+			int new_len, avail;
+			char *data = backend->decode_buffer(&stream, encoded + pos,
+							   len, &new_len);
+			char *room = NULL;
+
+			if (!data) break;
+			if (new_len)
+				room = test_sink_reserve(sink, new_len, &avail);
+			if (room) {
+				memcpy(room, data, new_len);
+				test_sink_commit(sink, new_len);
+			}
+			mem_free(data);
+			if (new_len && !room) break;
+		}
+	}
+
+	backend->eclose(&stream);
+
+	return pos >= length;
+}
+
+static int
+bench(const char *name, const struct decoding_backend *backend,
+      char *encoded, int length)
+{
+	timeval_T start, end, duration[2];
+	int use_sink;
+
+	for (use_sink = 0; use_sink < 2; use_sink++) {
+		int round;
+
+		timeval_now(&start);
+		for (round = 0; round < ROUNDS; round++) {
+			struct test_sink sink = { NULL, 0, 0 };
+
+			if (!decode(backend, encoded, length, use_sink, &sink)
+			    || sink.length != TEXT_LENGTH
+			    || memcmp(sink.data, text, TEXT_LENGTH)) {
+				fprintf(stderr, "%s: %s decoding failed\n", name,
+					use_sink ? "sink" : "buffer");
+				mem_free_if(sink.data);
+				return 0;
+			}
+			mem_free(sink.data);
+		}
+		timeval_now(&end);
+		timeval_sub(&duration[use_sink], &start, &end);
+	}
+
+	printf("%s: %d x %d kB in %d byte chunks: buffer %ld ms, sink %ld ms\n",
+	       name, ROUNDS, TEXT_LENGTH / 1024, CHUNK_LENGTH,
+	       (long) timeval_to_milliseconds(&duration[0]),
+	       (long) timeval_to_milliseconds(&duration[1]));
+
+	return 1;
+}
+
+#ifdef CONFIG_GZIP
+static int
+bench_gzip(void)
+{
+	z_stream stream;
+	uLong bound;
+	char *encoded;
+	int ret;
+
+	memset(&stream, 0, sizeof(stream));
+	if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+			 MAX_WBITS + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+		return 0;
+
+	bound = deflateBound(&stream, TEXT_LENGTH);
+	encoded = (char *)mem_alloc(bound);
+	if (!encoded) return 0;
+
+	stream.next_in = (unsigned char *)text;
+	stream.avail_in = TEXT_LENGTH;
+	stream.next_out = (unsigned char *)encoded;
+	stream.avail_out = bound;
+	ret = deflate(&stream, Z_FINISH);
+	deflateEnd(&stream);
+
+	ret = ret == Z_STREAM_END
+	      && bench("gzip", &gzip_decoding_backend, encoded, stream.total_out);
+	mem_free(encoded);
+
+	return ret;
+}
+#endif
+
+#ifdef CONFIG_BZIP2
+static int
+bench_bzip2(void)
+{
+	unsigned int length = TEXT_LENGTH + TEXT_LENGTH / 100 + 600;
+	char *encoded = (char *)mem_alloc(length);
+	int ret;
+
+	if (!encoded) return 0;
+
+	ret = BZ2_bzBuffToBuffCompress(encoded, &length, text, TEXT_LENGTH,
+				       9, 0, 0) == BZ_OK
+	      && bench("bzip2", &bzip2_decoding_backend, encoded, length);
+	mem_free(encoded);
+
+	return ret;
+}
+#endif
+
+int
+main(int argc, char **argv)
+{
+	ELOG
+	int ret = 1;
+
+	make_text();
+
+#ifdef CONFIG_GZIP
+	ret &= bench_gzip();
+#endif
+#ifdef CONFIG_BZIP2
+	ret &= bench_bzip2();
+#endif
+
+	mem_free(text);
+
+	return ret ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -109,6 +109,41 @@ zstd_decode_buffer(struct stream_encoded *st, char *data, int len, int *new_len)
 	return (char *)enc_data->output.dst;
 }
 
+/* Same as zstd_decode_buffer() but decompresses straight into the room
+ * given by @sink instead of a buffer of its own. */
+static int
+zstd_decode_to(struct stream_encoded *st, char *data, int len,
+	       struct decoding_sink *sink)
+{
+	ELOG
+	struct zstd_enc_data *enc_data = (struct zstd_enc_data *)st->data;
+	ZSTD_inBuffer input = { data, (size_t)len, 0 };
+	int total = 0;
+	size_t ret;
+
+	if (!len) return 0;
+
+	do {
+		int avail;
+		char *room = sink->reserve(sink->data, ELINKS_ZSTD_BUFFER_LENGTH, &avail);
+		ZSTD_outBuffer output = { room, (size_t)avail, 0 };
+
+		if (!room) return -1;
+
+		ret = ZSTD_decompressStream(enc_data->zstd_stream, &output, &input);
+		if (ZSTD_isError(ret)) return -1;
+
+		if (output.pos && sink->commit(sink->data, output.pos) < 0)
+			return -1;
+		total += output.pos;
+
+		/* A full output buffer may mean there is more to flush
+		 * even if all the input was consumed. */
+	} while (input.pos < input.size || output.pos == output.size);
+
+	return total;
+}
+
 static int
 zstd_read(struct stream_encoded *stream, char *buf, int len)
 {
@@ -198,5 +233,6 @@ const struct decoding_backend zstd_decoding_backend = {
 	zstd_open,
 	zstd_read,
 	zstd_decode_buffer,
+	zstd_decode_to,
 	zstd_close,
 };
@@ -400,6 +400,12 @@ ecmascript_put_interpreter(struct ecmascript_interpreter *interpreter)
 	interpreter->vs->ecmascript = NULL;
 	interpreter->vs->ecmascript_fragile = 1;
 	kill_timer(&interpreter->ani);
+	kill_timer(&interpreter->rerender_timer);
+	if (interpreter->rerender) {
+		/* Locked by schedule_rerender() */
+		object_unlock(interpreter->rerender->document);
+		mem_free(interpreter->rerender);
+	}
 	del_from_list(interpreter);
 	mem_free(interpreter);
 	--interpreter_count;
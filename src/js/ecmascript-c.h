@@ -55,6 +55,13 @@ struct el_dom_html_collection {
 };
 
 int ecmascript_get_interpreter_count(void);
+long ecmascript_get_rerender_requests(void);
+long ecmascript_get_rerenders(void);
+
+/* Renders the script changes that were held back while @ses was in
+ * a background tab. */
+void ecmascript_show_rerenders(struct session *ses);
+
 void ecmascript_put_interpreter(struct ecmascript_interpreter *interpreter);
 void toggle_ecmascript(struct session *ses);
 
@@ -46,6 +46,7 @@
 #include "protocol/uri.h"
 #include "session/session.h"
 #include "session/task.h"
+#include "terminal/tab.h"
 #include "terminal/terminal.h"
 #include "terminal/window.h"
 #include "util/conv.h"
@@ -107,11 +108,23 @@ static union option_info ecmascript_options[] = {
 		"max_exec_time", OPT_ZERO, 1, 3600, 5,
 		N_("Maximum execution time in seconds for a script.")),
 
+	INIT_OPT_INT("ecmascript", N_("Maximum renders per second"),
+		"max_renders_per_second", OPT_ZERO, 1, 100, 10,
+		N_("Maximum number of times per second a document is\n"
+		"rendered again after scripts changed it. Changes made\n"
+		"in between are shown together by the next render.\n"
+		"Documents in background tabs are not rendered until\n"
+		"the tab is shown.")),
+
 	NULL_OPTION_INFO,
 };
 
 int interpreter_count;
 
+/* Used by the resource info dialog. */
+static long rerender_requests;
+static long rerenders;
+
 static INIT_LIST_OF(struct string_list_item, allowed_urls);
 static INIT_LIST_OF(struct string_list_item, disallowed_urls);
 static INIT_LIST_OF(struct ecmascript_interpreter, ecmascript_interpreters);
@@ -312,6 +325,107 @@ delayed_reload(void *data)
 	mem_free(rel);
 }
 
+/* Timer callback for @interpreter->rerender_timer.  Renders the pending
+ * changes unless the tab is in the background, in which case they wait
+ * for ecmascript_show_rerenders(). */
+static void
+ecmascript_rerender(void *data)
+{
+	ELOG
+	struct ecmascript_interpreter *interpreter = (struct ecmascript_interpreter *)data;
+	struct delayed_rel *rel = interpreter->rerender;
+	struct session *ses = rel->ses;
+
+	interpreter->rerender_timer = TIMER_ID_UNDEF;
+
+	if (ses->tab != get_current_tab(ses->tab->term)) {
+		return;
+	}
+
+	interpreter->rerender = NULL;
+	timeval_now(&interpreter->last_rerender);
+	rerenders++;
+	delayed_reload(rel);
+}
+
+static void
+schedule_rerender(struct ecmascript_interpreter *interpreter,
+		  struct cache_entry *cached, struct document *document,
+		  struct session *ses)
+{
+	ELOG
+	struct delayed_rel *rel = interpreter->rerender;
+	timeval_T now, elapsed;
+	milliseconds_T delay;
+
+	rerender_requests++;
+
+	if (rel) {
+		/* Fold the change into the pending render. */
+		if (rel->document != document) {
+			object_unlock(rel->document);
+			object_lock(document);
+			rel->document = document;
+		}
+		rel->cached = cached;
+		rel->ses = ses;
+		rel->was_write |= interpreter->was_write;
+		return;
+	}
+
+	rel = (struct delayed_rel *)mem_calloc(1, sizeof(*rel));
+	if (!rel) {
+		return;
+	}
+	rel->cached = cached;
+	rel->document = document;
+	rel->ses = ses;
+	rel->was_write = interpreter->was_write;
+	object_lock(document);
+	interpreter->rerender = rel;
+
+	/* Wait until a frame interval has passed since the last render. */
+	timeval_now(&now);
+	timeval_sub(&elapsed, &interpreter->last_rerender, &now);
+	delay = 1000 / get_opt_int("ecmascript.max_renders_per_second", ses)
+		- timeval_to_milliseconds(&elapsed);
+	if (delay < 0) {
+		delay = 0;
+	}
+
+	install_timer(&interpreter->rerender_timer, delay, ecmascript_rerender, interpreter);
+}
+
+void
+ecmascript_show_rerenders(struct session *ses)
+{
+	ELOG
+	struct ecmascript_interpreter *interpreter;
+
+	foreach(interpreter, ecmascript_interpreters) {
+		if (interpreter->rerender
+		    && interpreter->rerender->ses == ses
+		    && interpreter->rerender_timer == TIMER_ID_UNDEF) {
+			install_timer(&interpreter->rerender_timer, 0,
+				      ecmascript_rerender, interpreter);
+		}
+	}
+}
+
+long
+ecmascript_get_rerender_requests(void)
+{
+	ELOG
+	return rerender_requests;
+}
+
+long
+ecmascript_get_rerenders(void)
+{
+	ELOG
+	return rerenders;
+}
+
 static void
 run_jobs(void *data)
 {
@@ -393,16 +507,7 @@ check_for_rerender(struct ecmascript_interpreter *interpreter, const char* text)
 		}
 
 		if (document->dom) {
-			struct delayed_rel *rel = (struct delayed_rel *)mem_calloc(1, sizeof(*rel));
-
-			if (rel) {
-				rel->cached = cached;
-				rel->document = document;
-				rel->ses = ses;
-				rel->was_write = interpreter->was_write;
-				object_lock(document);
-				register_bottom_half(delayed_reload, rel);
-			}
+			schedule_rerender(interpreter, cached, document, ses);
 			interpreter->changed = 0;
 			interpreter->was_write = 0;
 		}
@@ -40,6 +40,7 @@
 extern "C" {
 #endif
 
+struct delayed_rel;
 struct document;
 struct document_view;
 struct ecmascript_timeout;
@@ -119,6 +120,12 @@ struct ecmascript_interpreter {
 #endif
 	uttime time_origin;
 	timer_id_T ani;
+
+	/* Re-render waiting for the frame interval to pass or for the tab
+	 * to be shown.  Further changes are folded into it. */
+	struct delayed_rel *rerender;
+	timer_id_T rerender_timer;
+	timeval_T last_rerender;
 	int element_offset;
 	int request;
 	double timestamp;
@@ -42,6 +42,7 @@
 #include "main/version.h"
 #include "network/connection.h"
 #include "network/dns.h"
+#include "network/socket.h"
 #include "network/state.h"
 #include "osdep/osdep.h"
 #include "osdep/signals.h"
@@ -323,6 +324,8 @@ terminate_all_subsystems(void)
 		done_saved_session_info();
 	}
 
+	done_dns_resolver();
+	free_ipv4_first_hosts();
 	shrink_memory(1);
 	free_charsets_lookup();
 	free_colors_lookup();
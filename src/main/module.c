@@ -14,6 +14,7 @@
 
 #include "bfu/dialog.h"
 #include "bookmarks/bookmarks.h"
+#include "cache/disk.h"
 #include "config/kbdbind.h"
 #include "config/timer.h"
 #include "config/urlhist.h"
@@ -38,6 +39,7 @@
 
 
 struct module *main_modules[] = {
+	&disk_cache_module,
 	&document_module,
 	&kbdbind_module,
 	&terminal_module,
@@ -727,6 +727,27 @@ static fd_set x_error;
 
 static int w_max;
 
+#ifdef USE_EPOLL
+/* Number of events fetched from the kernel by one epoll_wait() call.
+ * The epoll set is level-triggered, so descriptors that do not fit are
+ * simply reported again in the next round. */
+#define EPOLL_MAX_EVENTS 256
+
+static int epoll_fd = -1;
+static struct epoll_event epoll_events[EPOLL_MAX_EVENTS];
+/* The number of events in @epoll_events not dispatched yet. */
+static int epoll_pending;
+/* The number of descriptors with the epoll_always flag. */
+static int epoll_always_count;
+
+/* The data of an event holds the descriptor in the low half and its
+ * epoll_tag in the high half. */
+#define set_epoll_data(ev, fd) \
+	((ev).data.u64 = ((uint64_t) threads[fd].epoll_tag << 32) | (uint32_t) (fd))
+#define get_epoll_data_fd(ev)	((int) (uint32_t) (ev).data.u64)
+#define get_epoll_data_tag(ev)	((unsigned int) ((ev).data.u64 >> 32))
+#endif
+
 int
 get_file_handles_count(void)
 {
@@ -980,6 +1001,277 @@ do_event_loop(int flags)
 }
 #endif
 
+#ifdef USE_EPOLL
+static int
+get_epoll_fd(void)
+{
+	ELOG
+	if (epoll_fd < 0) {
+		epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+		if (epoll_fd < 0)
+			elinks_internal("ERROR: epoll_create1 failed: %s", strerror(errno));
+	}
+
+	return epoll_fd;
+}
+
+/* Forget the pending events of @fd for which it has no handler now.  The
+ * descriptor may have been closed, or even reused, by a handler called
+ * earlier in the same round; the select() loop clears its x_* sets in
+ * set_handlers() for the same reason. */
+static void
+clear_pending_epoll_events(int fd, unsigned int events)
+{
+	ELOG
+	int i;
+
+	/* Hangups and errors go to any handler, like in the fd_sets. */
+	if (events) events |= EPOLLHUP | EPOLLERR;
+
+	for (i = 0; i < epoll_pending; i++) {
+		if (get_epoll_data_fd(epoll_events[i]) == fd)
+			epoll_events[i].events &= events;
+	}
+}
+
+/* Update the registration of @fd in the epoll set to match the handlers
+ * in @threads.  Error handlers are registered as EPOLLPRI, which is what
+ * select() reports in the exception set. */
+static void
+set_epoll_events(int fd)
+{
+	ELOG
+	struct epoll_event ev;
+	unsigned int events = 0;
+	int op, rs;
+
+	if (threads[fd].read_func) events |= EPOLLIN;
+	if (threads[fd].write_func) events |= EPOLLOUT;
+	if (threads[fd].error_func) events |= EPOLLPRI;
+
+	clear_pending_epoll_events(fd, events);
+
+	if (threads[fd].epoll_always) {
+		if (!events) {
+			threads[fd].epoll_always = 0;
+			epoll_always_count--;
+		}
+		threads[fd].epoll_events = events;
+		return;
+	}
+
+	if (!events && !threads[fd].epoll_events)
+		return;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = events;
+
+	if (!events) {
+		/* This fails if the descriptor is already closed.  If no
+		 * other process holds it, that removed it from the set
+		 * implicitly; otherwise dispatch_epoll_events() drops it
+		 * when it reports events nobody wants.  Handlers should
+		 * therefore be cleared before closing. */
+		EINTRLOOP(rs, epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, &ev));
+		threads[fd].epoll_events = 0;
+		return;
+	}
+
+	/* If the descriptor was closed and its number reused without
+	 * clearing the handlers in between, the epoll set no longer
+	 * knows it, so fall back to the other operation. */
+	op = threads[fd].epoll_events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+	if (op == EPOLL_CTL_ADD) threads[fd].epoll_tag++;
+	set_epoll_data(ev, fd);
+	EINTRLOOP(rs, epoll_ctl(get_epoll_fd(), op, fd, &ev));
+	if (rs < 0 && op == EPOLL_CTL_MOD && errno == ENOENT) {
+		threads[fd].epoll_tag++;
+		set_epoll_data(ev, fd);
+		EINTRLOOP(rs, epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev));
+	} else if (rs < 0 && op == EPOLL_CTL_ADD && errno == EEXIST)
+		EINTRLOOP(rs, epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev));
+
+	if (rs < 0 && errno == EPERM) {
+		/* Regular files and the like, e.g. stdin of -dump. */
+		threads[fd].epoll_always = 1;
+		epoll_always_count++;
+		threads[fd].epoll_events = events;
+		return;
+	}
+
+	if (rs < 0) {
+		const int errno_from_epoll = errno;
+
+		EL_ERROR(gettext("The call to %s failed: %d (%s)"),
+		      "epoll_ctl()", errno_from_epoll, (char *) strerror(errno_from_epoll));
+		threads[fd].epoll_events = 0;
+		return;
+	}
+
+	threads[fd].epoll_events = events;
+}
+
+/* Create the epoll set again from the registrations in @threads.  This
+ * gets rid of registrations which can no longer be removed, because their
+ * descriptor was closed while a child process still holds it. */
+static void
+rebuild_epoll_set(void)
+{
+	ELOG
+	int fd;
+
+	close(epoll_fd);
+	epoll_fd = -1;
+	get_epoll_fd();
+
+	for (fd = 0; fd < w_max; fd++) {
+		struct epoll_event ev;
+		int rs;
+
+		if (!threads[fd].epoll_events || threads[fd].epoll_always)
+			continue;
+
+		memset(&ev, 0, sizeof(ev));
+		ev.events = threads[fd].epoll_events;
+		set_epoll_data(ev, fd);
+		EINTRLOOP(rs, epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev));
+		if (rs < 0) threads[fd].epoll_events = 0;
+	}
+}
+
+/* Remove @fd, which reported events no handler wants, from the epoll
+ * set. */
+static void
+forget_epoll_fd(int fd)
+{
+	ELOG
+	struct epoll_event ev;
+	int rs;
+
+	memset(&ev, 0, sizeof(ev));
+	EINTRLOOP(rs, epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, &ev));
+
+	/* The number is closed or refers to another file now, so the
+	 * registration which reported the events is out of reach. */
+	if (rs < 0) rebuild_epoll_set();
+}
+
+/* Add the events of the descriptors which are always ready to the @n
+ * events in @epoll_events, as far as there is room for them. */
+static int
+add_epoll_always_events(int n)
+{
+	ELOG
+	int fd;
+
+	for (fd = 0; fd < w_max && n < EPOLL_MAX_EVENTS; fd++) {
+		if (!threads[fd].epoll_always) continue;
+
+		epoll_events[n].events = threads[fd].epoll_events & (EPOLLIN | EPOLLOUT);
+		set_epoll_data(epoll_events[n], fd);
+		n++;
+	}
+
+	return n;
+}
+
+/* Wait for the registered descriptors, for at most @tv if it is not NULL.
+ * Returns the number of events stored in @epoll_events or -1 on error. */
+static int
+wait_epoll_events(struct timeval *tv)
+{
+	ELOG
+	int timeout = -1;
+	int n;
+
+	if (epoll_always_count) {
+		/* Do not sleep while some descriptor is ready. */
+		timeout = 0;
+	} else if (tv) {
+		/* Round up so that the timer is due when we wake up. */
+		timeout = tv->tv_sec * 1000 + (tv->tv_usec + 999) / 1000;
+	}
+
+	n = epoll_wait(get_epoll_fd(), epoll_events, EPOLL_MAX_EVENTS, timeout);
+	if (n >= 0 && epoll_always_count)
+		n = add_epoll_always_events(n);
+
+	/* Timers run before the dispatching may clear them already. */
+	epoll_pending = n > 0 ? n : 0;
+
+	return n;
+}
+
+/* Call the handlers for the @n events returned by wait_epoll_events().
+ * A hangup or error is reported both as readable and writable, like
+ * select() does; if no read or write handler takes it, it goes to the
+ * error handler.  If nobody takes an event at all, the descriptor is
+ * dropped from the set so that it does not wake us up forever.  The
+ * events are read again before each handler, because set_handlers() may
+ * clear them meanwhile. */
+static void
+dispatch_epoll_events(int n)
+{
+	ELOG
+	int rebuilt = 0;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		int fd = get_epoll_data_fd(epoll_events[i]);
+		int handled = 0;
+
+		/* A registration which outlived its descriptor, perhaps
+		 * while the number already belongs to another one.  It
+		 * cannot be removed by the number, so start afresh. */
+		if (fd >= w_max
+		    || get_epoll_data_tag(epoll_events[i]) != threads[fd].epoll_tag) {
+			if (epoll_events[i].events && !rebuilt) {
+				rebuild_epoll_set();
+				rebuilt = 1;
+			}
+			continue;
+		}
+
+		if ((epoll_events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+		    && threads[fd].read_func) {
+			threads[fd].read_func(threads[fd].data);
+			check_bottom_halves();
+			handled = 1;
+		}
+
+		if (fd >= w_max) continue;
+
+		if ((epoll_events[i].events & (EPOLLOUT | EPOLLERR))
+		    && threads[fd].write_func) {
+			threads[fd].write_func(threads[fd].data);
+			check_bottom_halves();
+			handled = 1;
+		}
+
+		if (fd >= w_max) continue;
+
+		if ((epoll_events[i].events & EPOLLPRI
+		     || (!handled && (epoll_events[i].events & (EPOLLHUP | EPOLLERR))))
+		    && threads[fd].error_func) {
+			threads[fd].error_func(threads[fd].data);
+			check_bottom_halves();
+			handled = 1;
+		}
+
+		/* Events of a descriptor without handlers come from a
+		 * registration which outlived them. */
+		if (!handled && epoll_events[i].events && fd < w_max
+		    && !threads[fd].epoll_always
+		    && (!threads[fd].epoll_events
+			|| (epoll_events[i].events & (EPOLLHUP | EPOLLERR)))) {
+			threads[fd].epoll_events = 0;
+			forget_epoll_fd(fd);
+		}
+	}
+
+	epoll_pending = 0;
+}
+#endif
 
 select_handler_T
 get_handler(int fd, enum select_handler_type tp)
@@ -1018,7 +1310,7 @@ set_handlers(int fd, select_handler_T read_func, select_handler_T write_func,
 	if (fd < 0) {
 		return;
 	}
-#ifndef CONFIG_OS_WIN32
+#if !defined(CONFIG_OS_WIN32) && !defined(USE_EPOLL)
 	assertm(fd >= 0 && fd < FD_SETSIZE,
 		"set_handlers: handle %d >= FD_SETSIZE %d",
 		fd, FD_SETSIZE);
@@ -1040,6 +1332,7 @@ set_handlers(int fd, select_handler_T read_func, select_handler_T write_func,
 	}
 #endif /* __GNU__ */
 
+#ifndef USE_EPOLL
 #if defined(USE_POLL) && defined(USE_LIBEVENT)
 	if (!event_enabled)
 #endif
@@ -1047,6 +1340,7 @@ set_handlers(int fd, select_handler_T read_func, select_handler_T write_func,
 			elinks_internal("too big handle %d", fd);
 			return;
 		}
+#endif
 	if (fd >= n_threads) {
 		struct thread *tmp_threads = (struct thread *)mem_realloc(threads, (fd + 1) * sizeof(struct thread));
 
@@ -1086,6 +1380,10 @@ set_handlers(int fd, select_handler_T read_func, select_handler_T write_func,
 		set_events_for_handle(fd);
 		return;
 	}
+#endif
+#ifdef USE_EPOLL
+	set_epoll_events(fd);
+	return;
 #endif
 	if (read_func) {
 		FD_SET(fd, &w_read);
@@ -1326,16 +1624,18 @@ select_loop(void (*init)(void))
 		struct timeval timeout = { 0, 0 };
 		struct timeval *timeout_ptr = NULL;
 #endif
-		int n, i, has_timer;
+		int n, has_timer;
 		timeval_T t;
 
 		check_signals();
 		check_timers(&last_time);
 		try_redraw_all_terminals();
 
+#ifndef USE_EPOLL
 		memcpy(&x_read, &w_read, sizeof(fd_set));
 		memcpy(&x_write, &w_write, sizeof(fd_set));
 		memcpy(&x_error, &w_error, sizeof(fd_set));
+#endif
 
 		if (program.terminate) break;
 
@@ -1374,15 +1674,24 @@ select_loop(void (*init)(void))
 #endif
 		}
 
+#ifdef USE_EPOLL
+		n = wait_epoll_events(timeout_ptr);
+#else
 		n = loop_select(w_max, &x_read, &x_write, &x_error, timeout_ptr);
+#endif
 		if (n < 0) {
 			/* The following calls (especially gettext)
 			 * might change errno.  */
 			const int errno_from_select = errno;
 
 			if (errno_from_select != EINTR) {
+#ifdef USE_EPOLL
+				EL_ERROR(gettext("The call to %s failed: %d (%s)"),
+				      "epoll_wait()", errno_from_select, (char *) strerror(errno_from_select));
+#else
 				EL_ERROR(gettext("The call to %s failed: %d (%s)"),
 				      "select()", errno_from_select, (char *) strerror(errno_from_select));
+#endif
 				if (++select_errors > 10) /* Infinite loop prevention. */
 					INTERNAL(gettext("%d select() failures."),
 						 select_errors);
@@ -1395,7 +1704,11 @@ select_loop(void (*init)(void))
 		/*printf("sel: %d\n", n);*/
 		check_timers(&last_time);
 
-		i = -1;
+#ifdef USE_EPOLL
+		dispatch_epoll_events(n);
+#else
+		int i = -1;
+
 		while (n > 0 && ++i < w_max) {
 			int k = 0;
 
@@ -1431,6 +1744,7 @@ select_loop(void (*init)(void))
 
 			n -= k;
 		}
+#endif
 	}
 #if defined(CONFIG_LIBCURL)
 		curl_multi_cleanup(g.multi);
@@ -1498,6 +1812,12 @@ terminate_select(void)
 	ELOG
 #ifdef USE_LIBEVENT
 	terminate_libevent();
+#endif
+#ifdef USE_EPOLL
+	if (epoll_fd >= 0) {
+		close(epoll_fd);
+		epoll_fd = -1;
+	}
 #endif
 	mem_free_if(threads);
 }
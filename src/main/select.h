@@ -21,6 +21,11 @@
 #define USE_LIBEVENT
 #endif
 
+#if defined(CONFIG_EPOLL) && defined(HAVE_SYS_EPOLL_H) && !defined(USE_LIBEVENT)
+#include <sys/epoll.h>
+#define USE_EPOLL
+#endif
+
 #ifdef CONFIG_LIBCURL
 #include <curl/curl.h>
 #endif
@@ -158,6 +163,16 @@ struct thread {
 	struct event *read_event;
 	struct event *write_event;
 #endif
+#ifdef USE_EPOLL
+	/* The events the descriptor is registered for in the epoll set. */
+	unsigned int epoll_events;
+	/* Stored with the registration, so that events of an older one
+	 * which outlived its descriptor can be told apart. */
+	unsigned int epoll_tag;
+	/* Regular files cannot be added to the epoll set.  Like select()
+	 * does, treat them as always ready for the registered events. */
+	unsigned int epoll_always:1;
+#endif
 };
 
 extern struct thread *threads;
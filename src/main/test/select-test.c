@@ -0,0 +1,215 @@
+/* Test the select loop with descriptors whose handlers outlived them */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#include "elinks.h"
+
+#include "main/main.h"
+#include "main/select.h"
+#include "main/timer.h"
+#include "osdep/osdep.h"
+#include "osdep/signals.h"
+#include "session/download.h"
+#include "terminal/terminal.h"
+#include "util/memory.h"
+
+#if (defined(HAVE_LIBEV) || defined(HAVE_LIBEVENT)) && !defined(OPENVMS) && !defined(DOS)
+int event_enabled = 0;
+#ifdef HAVE_EVENT_BASE_SET
+struct event_base *event_base;
+#endif
+#endif
+
+struct program program;
+
+/* fake tty get function, needed for charsets.c */
+int
+get_ctl_handle(void)
+{
+	return -1;
+}
+
+char *
+gettext(const char *text)
+{
+	return (char *)text;
+}
+
+int
+os_default_charset(void)
+{
+	return -1;
+}
+
+int
+c_pipe(int *fd)
+{
+	return pipe(fd);
+}
+
+int
+set_nonblocking_fd(int fd)
+{
+	int flags = fcntl(fd, F_GETFL, 0);
+
+	if (flags < 0) return -1;
+	return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+int
+are_there_downloads(void)
+{
+	return 0;
+}
+
+void
+redraw_all_terminals(void)
+{
+}
+
+void
+clear_signal_mask_and_handlers(void)
+{
+}
+
+/* Called once per round of the loop. */
+static int rounds;
+
+int
+check_signals(void)
+{
+	rounds++;
+	return 0;
+}
+
+#define TEST_DURATION	300	/* in milliseconds */
+#define MAX_ROUNDS	100
+
+static int stale_calls;
+static int fresh_calls;
+static pid_t holder = -1;
+static timer_id_T stop_timer = TIMER_ID_UNDEF;
+
+static void
+stale_handler(void *data)
+{
+	stale_calls++;
+}
+
+static void
+fresh_handler(void *data)
+{
+	fresh_calls++;
+}
+
+static void
+stop(void *data)
+{
+	stop_timer = TIMER_ID_UNDEF;
+	program.terminate = 1;
+}
+
+static void
+open_pair(int *sv)
+{
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+		perror("socketpair");
+		exit(1);
+	}
+}
+
+static void
+make_readable(int fd)
+{
+	if (write(fd, "x", 1) != 1) {
+		perror("write");
+		exit(1);
+	}
+}
+
+/* Registers read handlers for two sockets which a child process also
+ * holds.  The first one is closed before its handler is cleared, the
+ * second one without clearing it, and its number is then reused by a new
+ * socket with a handler of its own.  The peers of the closed sockets are
+ * made readable, the new socket is not.  The loop must neither call any
+ * of the handlers nor keep waking up for the closed sockets. */
+static void
+init(void)
+{
+	int closed[2], reused[2], fresh[2];
+
+	open_pair(closed);
+	open_pair(reused);
+	set_handlers(closed[0], stale_handler, NULL, NULL, NULL);
+	set_handlers(reused[0], stale_handler, NULL, NULL, NULL);
+
+	holder = fork();
+	if (holder < 0) {
+		perror("fork");
+		exit(1);
+	}
+	if (!holder) {
+		sleep(5);
+		_exit(0);
+	}
+
+	close(reused[0]);
+	open_pair(fresh);
+	if (fresh[0] != reused[0]) {
+		fprintf(stderr, "descriptor %d not reused\n", reused[0]);
+		exit(1);
+	}
+	set_handlers(fresh[0], fresh_handler, NULL, NULL, NULL);
+
+	close(closed[0]);
+	clear_handlers(closed[0]);
+
+	make_readable(closed[1]);
+	make_readable(reused[1]);
+
+	install_timer(&stop_timer, TEST_DURATION, stop, NULL);
+}
+
+int
+main(int argc, char **argv)
+{
+	select_loop(init);
+
+	kill(holder, SIGKILL);
+	waitpid(holder, NULL, 0);
+
+	if (stale_calls) {
+		fprintf(stderr, "handler of a closed descriptor called %d times\n",
+			stale_calls);
+		return 1;
+	}
+
+	if (fresh_calls) {
+		fprintf(stderr, "handler of a reused descriptor called %d times\n",
+			fresh_calls);
+		return 1;
+	}
+
+	if (rounds > MAX_ROUNDS) {
+		fprintf(stderr, "the loop ran %d rounds in %d ms\n",
+			rounds, TEST_DURATION);
+		return 1;
+	}
+
+	printf("%d rounds in %d ms\n", rounds, TEST_DURATION);
+
+	return 0;
+}
@@ -0,0 +1,187 @@
+/* Test and benchmark the timer queue */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#include "elinks.h"
+
+#include "main/select.h"
+#include "main/timer.h"
+#include "util/memory.h"
+#include "util/time.h"
+
+#if (defined(HAVE_LIBEV) || defined(HAVE_LIBEVENT)) && !defined(OPENVMS) && !defined(DOS)
+int event_enabled = 0;
+#ifdef HAVE_EVENT_BASE_SET
+struct event_base *event_base;
+#endif
+#endif
+
+/* fake tty get function, needed for charsets.c */
+int
+get_ctl_handle(void)
+{
+	return -1;
+}
+
+char *
+gettext(const char *text)
+{
+	return (char *)text;
+}
+
+int
+os_default_charset(void)
+{
+	return -1;
+}
+
+void
+check_bottom_halves(void)
+{
+}
+
+#define ORDER_TIMERS	64
+#define BENCH_TIMERS	1000000
+
+static int fired[ORDER_TIMERS];
+static int fired_count;
+static int last_delay;
+static int order_failed;
+
+static void
+order_timer(void *data)
+{
+	int delay = (int) (long) data;
+
+	if (delay < last_delay)
+		order_failed = 1;
+	last_delay = delay;
+	fired[delay]++;
+	fired_count++;
+}
+
+static void
+bench_timer(void *data)
+{
+}
+
+/* Install timers in scrambled order, kill every third one and check
+ * that the rest fire exactly once, in order of their delays. */
+static int
+test_order(void)
+{
+	timer_id_T ids[ORDER_TIMERS];
+	timeval_T last_time;
+	int i, expected = 0;
+
+	for (i = 0; i < ORDER_TIMERS; i++) {
+		int delay = (i * 37) % ORDER_TIMERS;
+
+		install_timer(&ids[delay], delay, order_timer, (void *) (long) delay);
+		if (ids[delay] == TIMER_ID_UNDEF) {
+			fputs("install_timer() failed\n", stderr);
+			return 0;
+		}
+	}
+
+	for (i = 0; i < ORDER_TIMERS; i += 3)
+		kill_timer(&ids[i]);
+
+	if (get_timers_count() != ORDER_TIMERS - (ORDER_TIMERS + 2) / 3) {
+		fprintf(stderr, "get_timers_count() returned %d\n",
+			get_timers_count());
+		return 0;
+	}
+
+	timeval_now(&last_time);
+	while (get_timers_count()) {
+		usleep(1000);
+		check_timers(&last_time);
+	}
+
+	for (i = 0; i < ORDER_TIMERS; i++) {
+		int want = (i % 3) ? 1 : 0;
+
+		if (fired[i] != want) {
+			fprintf(stderr, "timer %d fired %d times\n", i, fired[i]);
+			return 0;
+		}
+		expected += want;
+	}
+
+	if (order_failed || fired_count != expected) {
+		fputs("timers fired out of order\n", stderr);
+		return 0;
+	}
+
+	return 1;
+}
+
+/* Install BENCH_TIMERS timers with pseudo-random delays and cancel
+ * them in a different pseudo-random order. */
+static int
+bench_install_cancel(void)
+{
+	timer_id_T *ids = (timer_id_T *)mem_alloc(BENCH_TIMERS * sizeof(*ids));
+	unsigned int seed = 1;
+	timeval_T start, end, duration;
+	int i;
+
+	if (!ids) {
+		fputs("Out of memory.\n", stderr);
+		return 0;
+	}
+
+	timeval_now(&start);
+	for (i = 0; i < BENCH_TIMERS; i++) {
+		seed = seed * 1103515245 + 12345;
+		install_timer(&ids[i], 60000 + (seed >> 8) % 600000,
+			      bench_timer, NULL);
+		if (ids[i] == TIMER_ID_UNDEF) {
+			fputs("install_timer() failed\n", stderr);
+			return 0;
+		}
+	}
+
+	for (i = 0; i < BENCH_TIMERS; i++) {
+		/* 7919 is a prime not dividing BENCH_TIMERS, so this
+		 * visits every timer exactly once. */
+		kill_timer(&ids[(int) ((i * 7919LL) % BENCH_TIMERS)]);
+	}
+	timeval_now(&end);
+	timeval_sub(&duration, &start, &end);
+
+	mem_free(ids);
+
+	if (get_timers_count()) {
+		fprintf(stderr, "%d timers left after cancelling\n",
+			get_timers_count());
+		return 0;
+	}
+
+	printf("installed and cancelled %d timers in %ld ms\n",
+	       BENCH_TIMERS, (long) timeval_to_milliseconds(&duration));
+
+	return 1;
+}
+
+int
+main(int argc, char **argv)
+{
+	ELOG
+	if (!test_order())
+		return EXIT_FAILURE;
+
+	if (!bench_install_cancel())
+		return EXIT_FAILURE;
+
+	return EXIT_SUCCESS;
+}
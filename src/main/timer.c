@@ -37,16 +37,125 @@
 #include "js/timer.h"
 #endif
 
-/* @timers.next points to the timer with the smallest interval,
- * @timers.next->next to the second smallest, and so on.  */
-static INIT_LIST_OF(struct timer, timers);
+/* The pending timers are kept in a binary min-heap ordered by their
+ * expiration time, so @timer_heap[0] is always the timer that expires
+ * first.  Each timer remembers its index in the heap, which makes
+ * installing and killing a timer O(log n) and lets check_timers() look
+ * only at the timers that actually expire. */
+static struct timer **timer_heap;
+static int timer_heap_size;
+static int timer_heap_alloc;
 
 int
 get_timers_count(void)
 {
 	ELOG
-	return list_size(&timers);
+	return timer_heap_size;
+}
+
+static inline int
+timer_before(struct timer *t1, struct timer *t2)
+{
+	ELOG
+	return timeval_cmp(&t1->expire, &t2->expire) < 0;
+}
+
+static inline void
+set_heap_timer(int index, struct timer *timer)
+{
+	ELOG
+	timer_heap[index] = timer;
+	timer->index = index;
+}
+
+static void
+sift_timer_up(int index)
+{
+	ELOG
+	struct timer *timer = timer_heap[index];
+
+	while (index > 0) {
+		int parent = (index - 1) / 2;
+
+		if (!timer_before(timer, timer_heap[parent]))
+			break;
+
+		set_heap_timer(index, timer_heap[parent]);
+		index = parent;
+	}
+
+	set_heap_timer(index, timer);
+}
 
+static void
+sift_timer_down(int index)
+{
+	ELOG
+	struct timer *timer = timer_heap[index];
+
+	for (;;) {
+		int child = 2 * index + 1;
+
+		if (child >= timer_heap_size)
+			break;
+
+		if (child + 1 < timer_heap_size
+		    && timer_before(timer_heap[child + 1], timer_heap[child]))
+			child++;
+
+		if (!timer_before(timer_heap[child], timer))
+			break;
+
+		set_heap_timer(index, timer_heap[child]);
+		index = child;
+	}
+
+	set_heap_timer(index, timer);
+}
+
+static int
+add_to_timer_heap(struct timer *timer)
+{
+	ELOG
+	if (timer_heap_size >= timer_heap_alloc) {
+		int new_alloc = timer_heap_alloc ? timer_heap_alloc * 2 : 16;
+		struct timer **new_heap;
+
+		new_heap = (struct timer **)mem_realloc(timer_heap,
+							new_alloc * sizeof(*new_heap));
+		if (!new_heap) return 0;
+
+		timer_heap = new_heap;
+		timer_heap_alloc = new_alloc;
+	}
+
+	set_heap_timer(timer_heap_size++, timer);
+	sift_timer_up(timer->index);
+
+	return 1;
+}
+
+static void
+del_from_timer_heap(struct timer *timer)
+{
+	ELOG
+	int index = timer->index;
+
+	assertm(index >= 0 && index < timer_heap_size
+		&& timer_heap[index] == timer, "bad timer heap index");
+	if_assert_failed return;
+
+	timer_heap_size--;
+	if (index == timer_heap_size) return;
+
+	/* Move the last timer to the hole and restore the heap order;
+	 * it can need to go either way. */
+	set_heap_timer(index, timer_heap[timer_heap_size]);
+	if (index > 0 && timer_before(timer_heap[index],
+				      timer_heap[(index - 1) / 2]))
+		sift_timer_up(index);
+	else
+		sift_timer_down(index);
 }
 
 #ifdef HAVE_EVENT_BASE_SET
@@ -80,28 +189,32 @@ struct event *timer_event(struct timer *tm)
 }
 #endif
 
+static void
+free_timer(struct timer *timer)
+{
+	ELOG
+#ifdef USE_LIBEVENT
+	mem_free(timer_event(timer));
+#else
+	mem_free(timer);
+#endif
+}
+
 void
 check_timers(timeval_T *last_time)
 {
 	ELOG
 	timeval_T now;
-	timeval_T interval;
-	struct timer *timer;
 
 	timeval_now(&now);
-	timeval_sub(&interval, last_time, &now);
-
-	foreach (timer, timers) {
-		timeval_sub_interval(&timer->interval, &interval);
-	}
 
-	while (!list_empty(timers)) {
-		timer = (struct timer *)timers.next;
+	while (timer_heap_size > 0) {
+		struct timer *timer = timer_heap[0];
 
-		if (timeval_is_positive(&timer->interval))
+		if (timeval_cmp(&timer->expire, &now) > 0)
 			break;
 
-		del_from_list(timer);
+		del_from_timer_heap(timer);
 		/* At this point, *@timer is to be considered invalid
 		 * outside timers.c; if anything e.g. passes it to
 		 * @kill_timer, that's a bug.  However, @timer->func
@@ -109,11 +222,7 @@ check_timers(timeval_T *last_time)
 		 * on other timers, so this loop must be careful not to
 		 * keep pointers to them.  (bug 868) */
 		timer->func(timer->data);
-#ifdef USE_LIBEVENT
-		mem_free(timer_event(timer));
-#else
-		mem_free(timer);
-#endif
+		free_timer(timer);
 		check_bottom_halves();
 	}
 	timeval_copy(last_time, &now);
@@ -125,16 +234,21 @@ set_event_for_timer(timer_id_T tm)
 {
 	ELOG
 	struct timeval tv;
+	timeval_T now, interval;
 	struct event *ev = timer_event(tm);
 	timeout_set(ev, timer_callback, tm);
 #ifdef HAVE_EVENT_BASE_SET
 	if (event_base_set(event_base, ev) == -1)
 		elinks_internal("ERROR: event_base_set failed: %s", strerror(errno));
 #endif
-	tv.tv_sec = tm->interval.sec;
-	tv.tv_usec = tm->interval.usec;
+	timeval_now(&now);
+	timeval_sub(&interval, &now, &tm->expire);
+	if (!timeval_is_positive(&interval))
+		timeval_from_milliseconds(&interval, 0);
+	tv.tv_sec = interval.sec;
+	tv.tv_usec = interval.usec;
 #if defined(HAVE_LIBEV)
-	if (!tm->interval.usec && ev_version_major() < 4) {
+	if (!interval.usec && ev_version_major() < 4) {
 		/* libev bug */
 		tv.tv_usec = 1;
 	}
@@ -156,36 +270,36 @@ void
 install_timer(timer_id_T *id, milliseconds_T delay, void (*func)(void *), void *data)
 {
 	ELOG
-	struct timer *new_timer, *timer;
+	struct timer *new_timer;
+	timeval_T interval;
 
 	assert(id && delay >= 0);
 
 #ifdef USE_LIBEVENT
 	char *q = (char *)mem_alloc(sizeof_struct_event + sizeof(struct timer));
-	new_timer = (struct timer *)(q + sizeof_struct_event);
+	new_timer = q ? (struct timer *)(q + sizeof_struct_event) : NULL;
 #else
 	new_timer = (struct timer *)mem_alloc(sizeof(*new_timer));
 #endif
 	*id = (timer_id_T) new_timer; /* TIMER_ID_UNDEF is NULL */
 	if (!new_timer) return;
 
-	timeval_from_milliseconds(&new_timer->interval, delay);
+	timeval_now(&new_timer->expire);
+	timeval_from_milliseconds(&interval, delay);
+	timeval_add_interval(&new_timer->expire, &interval);
 	new_timer->func = func;
 	new_timer->data = data;
+
+	if (!add_to_timer_heap(new_timer)) {
+		free_timer(new_timer);
+		*id = TIMER_ID_UNDEF;
+		return;
+	}
+
 #if defined(USE_LIBEVENT)
-	if (event_enabled) {
+	if (event_enabled)
 		set_event_for_timer(new_timer);
-		add_to_list(timers, new_timer);
-	} else
 #endif
-	{
-		foreach (timer, timers) {
-			if (timeval_cmp(&timer->interval, &new_timer->interval) >= 0)
-				break;
-		}
-
-		add_at_pos(timer->prev, new_timer);
-	}
 }
 
 void
@@ -197,7 +311,7 @@ kill_timer(timer_id_T *id)
 	assert(id != NULL);
 	if (*id == TIMER_ID_UNDEF) return;
 	timer = *id;
-	del_from_list(timer);
+	del_from_timer_heap(timer);
 #if defined(CONFIG_ECMASCRIPT_SMJS) || defined(CONFIG_QUICKJS) || defined(CONFIG_MUJS)
 	//del_from_map_timer(timer->data);
 #endif
@@ -206,23 +320,28 @@ kill_timer(timer_id_T *id)
 	if (event_enabled) {
 		timeout_del(timer_event(timer));
 	}
-	mem_free(timer_event(timer));
-#else
-	mem_free(timer);
 #endif
+	free_timer(timer);
 	*id = TIMER_ID_UNDEF;
 }
 
+/* Store to @t the time left until the first timer expires.  Returns 0
+ * if there are no timers. */
 int
 get_next_timer_time(timeval_T *t)
 {
 	ELOG
-	if (!list_empty(timers)) {
-		timeval_copy(t, &((struct timer *) &timers)->next->interval);
-		return 1;
-	}
+	timeval_T now;
+
+	if (!timer_heap_size)
+		return 0;
+
+	timeval_now(&now);
+	timeval_sub(t, &now, &timer_heap[0]->expire);
+	if (!timeval_is_positive(t))
+		timeval_from_milliseconds(t, 0);
 
-	return 0;
+	return 1;
 }
 
 
@@ -231,9 +350,9 @@ set_events_for_timer(void)
 {
 	ELOG
 #if defined(USE_LIBEVENT)
-	timer_id_T tm;
+	int i;
 
-	foreach(tm, timers)
-		set_event_for_timer(tm);
+	for (i = 0; i < timer_heap_size; i++)
+		set_event_for_timer(timer_heap[i]);
 #endif
 }
@@ -1,7 +1,6 @@
 #ifndef EL__MAIN_TIMER_H
 #define EL__MAIN_TIMER_H
 
-#include "util/lists.h"
 #include "util/time.h"
 
 #ifdef __cplusplus
@@ -9,9 +8,10 @@ extern "C" {
 #endif
 
 struct timer {
-	LIST_HEAD_EL(struct timer);
-
-	timeval_T interval;
+	/* Absolute time at which the timer expires. */
+	timeval_T expire;
+	/* Position of the timer in the timer heap. */
+	int index;
 	void (*func)(void *);
 	void *data;
 };
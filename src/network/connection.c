@@ -37,6 +37,7 @@
 #include "protocol/uri.h"
 #include "session/session.h"
 #include "util/error.h"
+#include "util/hash.h"
 #include "util/memory.h"
 #include "util/string.h"
 #include "util/time.h"
@@ -45,6 +46,10 @@
 struct keepalive_connection {
 	LIST_HEAD_EL(struct keepalive_connection);
 
+	/* The host the connection belongs to. It is kept in the
+	 * @host->keepalive_connections list. */
+	struct host_connection *host;
+
 	/* XXX: This is just the URI of the connection that registered the
 	 * keepalive connection so only rely on the protocol, user, password,
 	 * host and port part. */
@@ -63,14 +68,14 @@ struct keepalive_connection {
 
 static unsigned int connection_id = 0;
 static int active_connections = 0;
+static int keepalive_connections_count = 0;
 static timer_id_T keepalive_timeout = TIMER_ID_UNDEF;
 
 static INIT_LIST_OF(struct connection, connection_queue);
-static INIT_LIST_OF(struct host_connection, host_connections);
-static INIT_LIST_OF(struct keepalive_connection, keepalive_connections);
 
 /* Prototypes */
 static void check_keepalive_connections(void);
+static void keepalive_timer(void *);
 static void notify_connection_callbacks(struct connection *conn);
 
 static /* inline */ connection_priority_T
@@ -100,7 +105,7 @@ int
 get_keepalive_connections_count(void)
 {
 	ELOG
-	return list_size(&keepalive_connections);
+	return keepalive_connections_count;
 }
 
 int
@@ -150,33 +155,108 @@ connection_disappeared(struct connection *conn, unsigned int id)
 
 /* Host connection management: */
 /* Used to keep track on the number of connections to any given host. When
- * trying to setup a new connection the list is searched to see if the maximum
+ * trying to setup a new connection the host is looked up to see if the maximum
  * number of connection has been reached. If that is the case we try to suspend
  * an already established connection. */
+/* The host connection also holds the idle keepalive connections to the host
+ * and statistics about how they are reused. Hosts without any connections are
+ * kept around for their statistics, up to MAX_HOST_CONNECTION_STATS of them. */
 /* Some connections (like file://) that do not involve hosts are not maintained
  * in the list. */
 
 struct host_connection {
+	/* The refcount is the number of running connections to the host. */
 	OBJECT_HEAD(struct host_connection);
 
 	/* XXX: This is just the URI of the connection that registered the
 	 * host connection so only rely on the host part. */
 	struct uri *uri;
+
+	/* Entry in the @host_index. */
+	struct hash_item *item;
+
+	/* Idle keepalive connections, the most recently added first. */
+	LIST_OF(struct keepalive_connection) keepalive_connections;
+	int keepalive_count;
+
+	/* Statistics: */
+	long requests;		/* Connections started to the host */
+	long reuses;		/* How many of them got a keepalive connection */
+	timeval_T idle_time;	/* Total idle time of the reused connections */
 };
 
+/* The most recently used host first. */
+static INIT_LIST_OF(struct host_connection, host_connections);
+static struct hash *host_index;
+static int unused_host_connections = 0;
+static int checking_keepalive_connections = 0;
+
+static inline int
+is_host_connection_used(struct host_connection *host_conn)
+{
+	ELOG
+	return is_object_used(host_conn) || host_conn->keepalive_count;
+}
+
 static struct host_connection *
 get_host_connection(struct connection *conn)
 {
 	ELOG
-	struct host_connection *host_conn;
+	struct hash_item *item;
 
-	if (!conn->uri->host) return NULL;
+	if (!conn->uri->host || !host_index) return NULL;
 
-	foreach (host_conn, host_connections)
-		if (compare_uri(host_conn->uri, conn->uri, URI_HOST))
-			return host_conn;
+	item = get_hash_item(host_index, conn->uri->host, conn->uri->hostlen);
+	return item ? (struct host_connection *)item->value : NULL;
+}
 
-	return NULL;
+static void
+free_host_connection(struct host_connection *host_conn)
+{
+	ELOG
+	del_hash_item(host_index, host_conn->item);
+	del_from_list(host_conn);
+	done_uri(host_conn->uri);
+	mem_free(host_conn);
+}
+
+/* Frees the least recently used host connections without any connections,
+ * leaving at most @keep of them. */
+static void
+shrink_host_connections(int keep)
+{
+	ELOG
+	struct host_connection *host_conn, *prev;
+
+	if (checking_keepalive_connections) return;
+
+	foreachbacksafe (host_conn, prev, host_connections) {
+		if (unused_host_connections <= keep)
+			break;
+		if (is_host_connection_used(host_conn))
+			continue;
+
+		free_host_connection(host_conn);
+		unused_host_connections--;
+	}
+}
+
+/* Call before adding a connection or keepalive connection to @host_conn. */
+static inline void
+use_host_connection(struct host_connection *host_conn)
+{
+	ELOG
+	if (!is_host_connection_used(host_conn))
+		unused_host_connections--;
+}
+
+/* Call after removing a connection or keepalive connection from @host_conn. */
+static inline void
+release_host_connection(struct host_connection *host_conn)
+{
+	ELOG
+	if (!is_host_connection_used(host_conn))
+		unused_host_connections++;
 }
 
 /* Returns if the connection was successfully added. */
@@ -188,19 +268,45 @@ add_host_connection(struct connection *conn)
 	struct host_connection *host_conn = get_host_connection(conn);
 
 	if (!host_conn && conn->uri->host) {
+		if (!host_index) {
+			host_index = init_hash8();
+			if (!host_index) return 0;
+		}
+
+		shrink_host_connections(MAX_HOST_CONNECTION_STATS);
+
 		host_conn = (struct host_connection *)mem_calloc(1, sizeof(*host_conn));
 		if (!host_conn) return 0;
 
 		host_conn->uri = get_uri_reference(conn->uri);
+		host_conn->item = add_hash_item(host_index, host_conn->uri->host,
+						host_conn->uri->hostlen, host_conn);
+		if (!host_conn->item) {
+			done_uri(host_conn->uri);
+			mem_free(host_conn);
+			return 0;
+		}
+
+		init_list(host_conn->keepalive_connections);
 		object_nolock(host_conn, "host_connection");
 		add_to_list(host_connections, host_conn);
+		unused_host_connections++;
+
+	} else if (host_conn) {
+		move_to_top_of_list(host_connections, host_conn);
+	}
+
+	if (host_conn) {
+		use_host_connection(host_conn);
+		object_lock(host_conn);
+		host_conn->requests++;
 	}
-	if (host_conn) object_lock(host_conn);
 
 	return 1;
 }
 
-/* Decrements and free()s the host connection if it is the last 'refcount'. */
+/* Decrements the host connection refcount. The host connection itself is
+ * kept for its keepalive connections and statistics. */
 static void
 done_host_connection(struct connection *conn)
 {
@@ -210,11 +316,31 @@ done_host_connection(struct connection *conn)
 	if (!host_conn) return;
 
 	object_unlock(host_conn);
-	if (is_object_used(host_conn)) return;
+	release_host_connection(host_conn);
+}
 
-	del_from_list(host_conn);
-	done_uri(host_conn->uri);
-	mem_free(host_conn);
+void
+foreach_host_connection_info(void (*func)(struct host_connection_info *, void *),
+			     void *data)
+{
+	ELOG
+	struct host_connection *host_conn;
+
+	foreach (host_conn, host_connections) {
+		struct host_connection_info info;
+
+		info.host = host_conn->uri->host;
+		info.hostlen = host_conn->uri->hostlen;
+		info.connections = get_object_refcount(host_conn);
+		info.keepalive = host_conn->keepalive_count;
+		info.requests = host_conn->requests;
+		info.reuses = host_conn->reuses;
+		info.idle_time = host_conn->reuses
+			? timeval_to_milliseconds(&host_conn->idle_time) / host_conn->reuses
+			: 0;
+
+		func(&info, data);
+	}
 }
 
 
@@ -506,6 +632,9 @@ done_connection(struct connection *conn)
 		set_connection_state(conn, connection_state(S_INTERNAL));
 
 	del_from_list(conn);
+	/* The callbacks still get to see conn->cached but the entry is no
+	 * longer considered in use by this connection. */
+	if (conn->cached) conn->cached->connections--;
 	notify_connection_callbacks(conn);
 	if (conn->referrer) done_uri(conn->referrer);
 	done_uri(conn->uri);
@@ -583,6 +712,9 @@ done_keepalive_connection(struct keepalive_connection *keep_conn)
 		return;
 
 	del_from_list(keep_conn);
+	keep_conn->host->keepalive_count--;
+	keepalive_connections_count--;
+	release_host_connection(keep_conn->host);
 	if (keep_conn->socket != -1) close(keep_conn->socket);
 	done_uri(keep_conn->uri);
 	mem_free(keep_conn);
@@ -595,13 +727,15 @@ init_keepalive_connection(struct connection *conn, long timeout_in_seconds,
 	ELOG
 	struct keepalive_connection *keep_conn;
 	struct uri *uri = conn->uri;
+	struct host_connection *host_conn = get_host_connection(conn);
 
-	assert(uri->host);
+	assert(uri->host && host_conn);
 	if_assert_failed return NULL;
 
 	keep_conn = (struct keepalive_connection *)mem_calloc(1, sizeof(*keep_conn));
 	if (!keep_conn) return NULL;
 
+	keep_conn->host = host_conn;
 	keep_conn->uri = get_uri_reference(uri);
 	keep_conn->done = done;
 	keep_conn->protocol_family = conn->socket->protocol_family;
@@ -612,16 +746,22 @@ init_keepalive_connection(struct connection *conn, long timeout_in_seconds,
 	return keep_conn;
 }
 
+/* Only the keepalive connections to the same host are searched. Connections
+ * that became readable in the meantime were closed by the server (or have
+ * unexpected data waiting) so they are skipped and left for
+ * check_keepalive_connections() to clean up. */
 static struct keepalive_connection *
 get_keepalive_connection(struct connection *conn)
 {
 	ELOG
+	struct host_connection *host_conn = get_host_connection(conn);
 	struct keepalive_connection *keep_conn;
 
-	if (!conn->uri->host) return NULL;
+	if (!host_conn) return NULL;
 
-	foreach (keep_conn, keepalive_connections)
-		if (compare_uri(keep_conn->uri, conn->uri, URI_KEEPALIVE))
+	foreach (keep_conn, host_conn->keepalive_connections)
+		if (compare_uri(keep_conn->uri, conn->uri, URI_KEEPALIVE)
+		    && !can_read(keep_conn->socket))
 			return keep_conn;
 
 	return NULL;
@@ -632,9 +772,15 @@ has_keepalive_connection(struct connection *conn)
 {
 	ELOG
 	struct keepalive_connection *keep_conn = get_keepalive_connection(conn);
+	timeval_T now, idle;
 
 	if (!keep_conn) return 0;
 
+	timeval_now(&now);
+	timeval_sub(&idle, &keep_conn->creation_time, &now);
+	timeval_add_interval(&keep_conn->host->idle_time, &idle);
+	keep_conn->host->reuses++;
+
 	conn->socket->fd = keep_conn->socket;
 	conn->socket->protocol_family = keep_conn->protocol_family;
 
@@ -663,7 +809,14 @@ add_keepalive_connection(struct connection *conn, long timeout_in_seconds,
 		 * checked or closed by free_connection_data(). */
 		clear_handlers(conn->socket->fd);
 		conn->socket->fd = -1;
-		add_to_list(keepalive_connections, keep_conn);
+		use_host_connection(keep_conn->host);
+		add_to_list(keep_conn->host->keepalive_connections, keep_conn);
+		keep_conn->host->keepalive_count++;
+		keepalive_connections_count++;
+
+		if (keepalive_timeout == TIMER_ID_UNDEF)
+			install_timer(&keepalive_timeout, KEEPALIVE_CHECK_TIME,
+				      keepalive_timer, NULL);
 
 	} else if (done) {
 		/* It will take just a little more time */
@@ -688,42 +841,77 @@ keepalive_timer(void *x)
 	check_keepalive_connections();
 }
 
+/* Closes the least recently added keepalive connections until there are no
+ * more than connection.max_keepalive_connections of them. */
+static void
+limit_keepalive_connections(void)
+{
+	ELOG
+	int max_keepalive = get_opt_int("connection.max_keepalive_connections", NULL);
+
+	while (keepalive_connections_count > max_keepalive) {
+		struct keepalive_connection *oldest = NULL;
+		struct host_connection *host_conn;
+
+		foreach (host_conn, host_connections) {
+			struct keepalive_connection *keep_conn;
+
+			if (list_empty(host_conn->keepalive_connections))
+				continue;
+
+			keep_conn = (struct keepalive_connection *)host_conn->keepalive_connections.prev;
+			if (!oldest || timeval_cmp(&keep_conn->creation_time,
+						   &oldest->creation_time) < 0)
+				oldest = keep_conn;
+		}
+
+		assertm(oldest != NULL, "keepalive count out of sync");
+		if_assert_failed return;
+
+		done_keepalive_connection(oldest);
+	}
+}
+
 void
 check_keepalive_connections(void)
 {
 	ELOG
-	struct keepalive_connection *keep_conn, *next;
+	struct host_connection *host_conn;
 	timeval_T now;
-	int p = 0;
 
 	timeval_now(&now);
 
 	kill_timer(&keepalive_timeout);
 
-	foreachsafe (keep_conn, next, keepalive_connections) {
-		timeval_T age;
+	/* Host connections are not freed while walking them here, even if
+	 * some callback of done_keepalive_connection() adds a new one. */
+	checking_keepalive_connections = 1;
 
-		if (can_read(keep_conn->socket)) {
-			done_keepalive_connection(keep_conn);
-			continue;
-		}
+	foreach (host_conn, host_connections) {
+		struct keepalive_connection *keep_conn, *next;
 
-		timeval_sub(&age, &keep_conn->creation_time, &now);
-		if (timeval_cmp(&age, &keep_conn->timeout) > 0) {
-			done_keepalive_connection(keep_conn);
-			continue;
-		}
+		foreachsafe (keep_conn, next, host_conn->keepalive_connections) {
+			timeval_T age;
 
-		p++;
-	}
+			if (can_read(keep_conn->socket)) {
+				done_keepalive_connection(keep_conn);
+				continue;
+			}
 
-	for (; p > MAX_KEEPALIVE_CONNECTIONS; p--) {
-		assertm(!list_empty(keepalive_connections), "keepalive list empty");
-		if_assert_failed return;
-		done_keepalive_connection((struct keepalive_connection *)keepalive_connections.prev);
+			timeval_sub(&age, &keep_conn->creation_time, &now);
+			if (timeval_cmp(&age, &keep_conn->timeout) > 0) {
+				done_keepalive_connection(keep_conn);
+				continue;
+			}
+		}
 	}
 
-	if (!list_empty(keepalive_connections))
+	limit_keepalive_connections();
+
+	checking_keepalive_connections = 0;
+	shrink_host_connections(MAX_HOST_CONNECTION_STATS);
+
+	if (keepalive_connections_count)
 		install_timer(&keepalive_timeout, KEEPALIVE_CHECK_TIME,
 			      keepalive_timer, NULL);
 }
@@ -732,13 +920,15 @@ static inline void
 abort_all_keepalive_connections(void)
 {
 	ELOG
-	while (!list_empty(keepalive_connections))
-		done_keepalive_connection((struct keepalive_connection *)keepalive_connections.next);
+	struct host_connection *host_conn;
+
+	foreach (host_conn, host_connections)
+		while (!list_empty(host_conn->keepalive_connections))
+			done_keepalive_connection((struct keepalive_connection *)host_conn->keepalive_connections.next);
 
 	check_keepalive_connections();
 }
 
-
 static void
 sort_queue(void)
 {
@@ -892,7 +1082,7 @@ check_queue(void)
 again:
 	conn = (struct connection *)connection_queue.next;
 	check_queue_bugs();
-	check_keepalive_connections();
+	limit_keepalive_connections();
 
 	while (conn != (struct connection *) &connection_queue) {
 		struct connection *c;
@@ -1325,6 +1515,7 @@ abort_all_connections(void)
 	}
 
 	abort_all_keepalive_connections();
+	shrink_host_connections(0);
 }
 
 void
@@ -1341,13 +1532,34 @@ abort_background_connections(void)
 
 int
 is_entry_used(struct cache_entry *cached)
+{
+	ELOG
+	return cached->connections > 0;
+}
+
+void
+set_connection_cache_entry(struct connection *conn, struct cache_entry *cached)
+{
+	ELOG
+	if (conn->cached == cached)
+		return;
+
+	if (conn->cached) {
+		assert(conn->cached->connections > 0);
+		conn->cached->connections--;
+	}
+
+	conn->cached = cached;
+	if (cached) cached->connections++;
+}
+
+void
+detach_cache_entry_connections(struct cache_entry *cached)
 {
 	ELOG
 	struct connection *conn;
 
 	foreach (conn, connection_queue)
 		if (conn->cached == cached)
-			return 1;
-
-	return 0;
+			set_connection_cache_entry(conn, NULL);
 }
@@ -96,6 +96,20 @@ int get_keepalive_connections_count(void);
 int get_connections_connecting_count(void);
 int get_connections_transfering_count(void);
 
+/* Per-host connection statistics, used by the resource info dialog. */
+struct host_connection_info {
+	const char *host;	/* Not zero-terminated */
+	int hostlen;
+	int connections;	/* Running connections */
+	int keepalive;		/* Idle keepalive connections */
+	long requests;		/* Connections started */
+	long reuses;		/* Connections that reused a keepalive one */
+	milliseconds_T idle_time; /* Average idle time before reuse */
+};
+
+void foreach_host_connection_info(void (*func)(struct host_connection_info *, void *),
+				  void *data);
+
 void set_connection_state(struct connection *, struct connection_state);
 
 int has_keepalive_connection(struct connection *);
@@ -129,6 +143,14 @@ void try_to_load_image(struct uri *uri, struct uri *referrer);
 
 int is_entry_used(struct cache_entry *cached);
 
+/* Makes @conn load into @cached, keeping cache_entry.connections in sync.
+ * Protocol handlers must use this instead of assigning conn->cached. */
+void set_connection_cache_entry(struct connection *conn, struct cache_entry *cached);
+
+/* Detaches all connections still loading into @cached. Called when the
+ * entry is deleted while in use. */
+void detach_cache_entry_connections(struct cache_entry *cached);
+
 #ifdef __cplusplus
 }
 #endif
@@ -7,6 +7,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
+#ifdef HAVE_DIRENT_H
+#include <dirent.h>
+#endif
 #ifdef HAVE_NETDB_H
 #include <netdb.h> /* OS/2 needs this after sys/types.h */
 #endif
@@ -38,11 +41,14 @@
 #include "network/dns.h"
 #include "osdep/osdep.h"
 #include "protocol/uri.h"
+#include "util/conv.h"
 #include "util/error.h"
+#include "util/hash.h"
 #include "util/memory.h"
 #include "util/time.h"
 
-#ifdef WIN32
+/* On DOS start_thread() runs the function synchronously. */
+#if defined(WIN32) || defined(CONFIG_OS_DOS)
 #define NO_ASYNC_LOOKUP
 #endif
 
@@ -50,42 +56,75 @@
 struct dnsentry {
 	LIST_HEAD_EL(struct dnsentry);
 
+	struct hash_item *item;		/* Entry in the @dns_index. */
 	struct sockaddr_storage *addr;	/* Pointer to array of addresses. */
 	int addrno;			/* Adress array length. */
 	timeval_T creation_time;	/* Creation time; let us do timeouts. */
+	timeval_T expiration_time;	/* When the record should be refreshed. */
 	char name[1];		/* Associated host; XXX: Must be last. */
 };
 
+/* A failed lookup has no addresses. */
+#define dns_entry_failed(dnsentry) (!(dnsentry)->addr)
+
 struct dnsquery {
-#ifdef THREAD_SAFE_LOOKUP
-	struct dnsquery *next_in_queue;	/* Got queued? */
-#endif
+	LIST_HEAD_EL(struct dnsquery);
+
 	dns_callback_T done;		/* Used for reporting back DNS result. */
 	void *data;			/* Private callback data. */
 
-	/* The @done callback is called with these members. Thus, when
-	 * free()ing, *always* set pointer to NULL ! */
-	struct sockaddr_storage *addr;	/* Reference to array of addresses. */
-	int addrno;			/* Reference to array len. */
-
-	/* As with the two members above, when stopping a DNS query *always* set
-	 * this pointer to NULL. */
+	/* When stopping a DNS query *always* set this pointer to NULL. */
 	struct dnsquery **queryref;	/* Reference to callers DNS member. */
 
 #ifndef NO_ASYNC_LOOKUP
-	int h;				/* One end of the async thread pipe. */
+	/* The worker looking up the name or NULL while the query is waiting
+	 * for a free one. */
+	struct dns_worker *worker;
 #endif
 	char name[1];		/* Associated host; XXX: Must be last. */
 };
 
+#ifndef NO_ASYNC_LOOKUP
+/* Asynchronous lookups are handed to a small pool of long-lived helper
+ * processes started with start_thread(). Each of them reads host names from
+ * the request pipe, one at a time, and writes the found addresses back to the
+ * result pipe which is watched by the select loop. */
+struct dns_worker {
+	int request_h;			/* Names to look up are written here. */
+	int result_h;			/* Addresses are read from here. */
+	char *name;			/* Name being looked up, NULL if idle. */
+	unsigned int running:1;
+};
 
 #ifdef THREAD_SAFE_LOOKUP
-static struct dnsquery *dns_queue = NULL;
+/* The resolver library cannot be used by more threads at once. */
+#define DNS_WORKERS	1
+#else
+#define DNS_WORKERS	DNS_RESOLVER_WORKERS
+#endif
+
+static struct dns_worker dns_workers[DNS_WORKERS];
+
+/* Pending asynchronous queries. Queries for the same host share the worker
+ * and are all answered by a single lookup. */
+static INIT_LIST_OF(struct dnsquery, dns_queries);
 #endif
 
 static INIT_LIST_OF(struct dnsentry, dns_cache);
 
-static void done_dns_lookup(struct dnsquery *query, enum dns_result res);
+/* Failed lookups are kept in their own list so that the number of them can be
+ * bounded to DNS_NEGATIVE_CACHE_SIZE. */
+static INIT_LIST_OF(struct dnsentry, dns_negative_cache);
+static int dns_negative_cache_count;
+
+/* Both lists are indexed by the lowercased host name. */
+static struct hash *dns_index;
+
+static long dns_cache_hits;
+static long dns_cache_misses;
+
+static void done_dns_lookup(struct dnsquery *query,
+			    struct sockaddr_storage *addr, int addrno);
 
 
 /* DNS cache management: */
@@ -94,54 +133,140 @@ static struct dnsentry *
 find_in_dns_cache(char *name)
 {
 	ELOG
+	int namelen = strlen(name);
+	struct hash_item *item;
 	struct dnsentry *dnsentry;
+	char *key;
 
-	foreach (dnsentry, dns_cache)
-		if (!c_strcasecmp(dnsentry->name, name)) {
-			move_to_top_of_list(dns_cache, dnsentry);
-			return dnsentry;
-		}
+	if (!dns_index) return NULL;
 
-	return NULL;
+	key = memacpy(name, namelen);
+	if (!key) return NULL;
+
+	convert_to_lowercase_locale_indep(key, namelen);
+	item = get_hash_item(dns_index, key, namelen);
+	mem_free(key);
+
+	if (!item) return NULL;
+
+	dnsentry = (struct dnsentry *)item->value;
+	if (dns_entry_failed(dnsentry))
+		move_to_top_of_list(dns_negative_cache, dnsentry);
+	else
+		move_to_top_of_list(dns_cache, dnsentry);
+
+	return dnsentry;
+}
+
+static void
+del_dns_cache_entry(struct dnsentry *dnsentry)
+{
+	ELOG
+	if (dns_entry_failed(dnsentry))
+		dns_negative_cache_count--;
+
+	del_from_list(dnsentry);
+	del_hash_item(dns_index, dnsentry->item);
+	mem_free_if(dnsentry->addr);
+	mem_free(dnsentry);
 }
 
+/* Records the result of looking up @name. A failed lookup is passed with
+ * @addrno being zero and is remembered for a shorter time. */
 static void
 add_to_dns_cache(char *name, struct sockaddr_storage *addr, int addrno)
 {
 	ELOG
 	int namelen = strlen(name);
 	struct dnsentry *dnsentry;
-	int size;
+	timeval_T ttl;
 
-	assert(addrno > 0);
+	if (!dns_index) {
+		dns_index = init_hash8();
+		if (!dns_index) return;
+	}
 
 	dnsentry = (struct dnsentry *)mem_calloc(1, sizeof(*dnsentry) + namelen);
 	if (!dnsentry) return;
 
-	size = addrno * sizeof(*dnsentry->addr);
-	dnsentry->addr = (struct sockaddr_storage *)mem_alloc(size);
-	if (!dnsentry->addr) {
-		mem_free(dnsentry);
-		return;
+	if (addrno > 0) {
+		int size = addrno * sizeof(*dnsentry->addr);
+
+		dnsentry->addr = (struct sockaddr_storage *)mem_alloc(size);
+		if (!dnsentry->addr) {
+			mem_free(dnsentry);
+			return;
+		}
+
+		memcpy(dnsentry->addr, addr, size);
+		dnsentry->addrno = addrno;
 	}
 
 	/* calloc() sets NUL char for us. */
 	memcpy(dnsentry->name, name, namelen);
-	memcpy(dnsentry->addr, addr, size);;
+	convert_to_lowercase_locale_indep(dnsentry->name, namelen);
 
-	dnsentry->addrno = addrno;
+	dnsentry->item = add_hash_item(dns_index, dnsentry->name, namelen, dnsentry);
+	if (!dnsentry->item) {
+		mem_free_if(dnsentry->addr);
+		mem_free(dnsentry);
+		return;
+	}
 
+	/* The resolver interface does not tell the TTL of the records so
+	 * use a fixed one, depending on whether the lookup succeeded. */
+	timeval_from_seconds(&ttl, dns_entry_failed(dnsentry)
+				   ? DNS_NEGATIVE_CACHE_TIMEOUT
+				   : DNS_CACHE_TIMEOUT);
 	timeval_now(&dnsentry->creation_time);
-	add_to_list(dns_cache, dnsentry);
+	el_timeval_add(&dnsentry->expiration_time, &dnsentry->creation_time, &ttl);
+
+	if (!dns_entry_failed(dnsentry)) {
+		add_to_list(dns_cache, dnsentry);
+		return;
+	}
+
+	if (dns_negative_cache_count >= DNS_NEGATIVE_CACHE_SIZE)
+		del_dns_cache_entry((struct dnsentry *) dns_negative_cache.prev);
+
+	add_to_list(dns_negative_cache, dnsentry);
+	dns_negative_cache_count++;
 }
 
+static int
+is_dns_entry_expired(struct dnsentry *dnsentry, timeval_T *now)
+{
+	ELOG
+	return timeval_cmp(now, &dnsentry->expiration_time) >= 0;
+}
+
+/* Records the result of looking up @name in the DNS cache. A failed lookup
+ * is passed with @addrno being zero. In that case the addresses of an older
+ * entry for the host are returned in @addr and @addrno if there is one. */
 static void
-del_dns_cache_entry(struct dnsentry *dnsentry)
+store_dns_result(char *name, struct sockaddr_storage **addr, int *addrno)
 {
 	ELOG
-	del_from_list(dnsentry);
-	mem_free_if(dnsentry->addr);
-	mem_free(dnsentry);
+	struct dnsentry *dnsentry = find_in_dns_cache(name);
+
+	if (dnsentry) {
+		/* If the query failed, use the existing DNS cache entry even if
+		 * it is too old. */
+		if (!*addrno && !dns_entry_failed(dnsentry)) {
+			int size = dnsentry->addrno * sizeof(**addr);
+
+			*addr = (struct sockaddr_storage *)mem_alloc(size);
+			if (!*addr) return;
+
+			memcpy(*addr, dnsentry->addr, size);
+			*addrno = dnsentry->addrno;
+			return;
+		}
+
+		del_dns_cache_entry(dnsentry);
+	}
+
+	add_to_dns_cache(name, *addr, *addrno);
 }
 
 
@@ -280,37 +405,6 @@ write_dns_data(int h, void *data, size_t datalen)
 	return DNS_SUCCESS;
 }
 
-static void
-async_dns_writer(void *data, int h)
-{
-	ELOG
-	char *name = (char *) data;
-	struct sockaddr_storage *addrs;
-	int addrno, i;
-
-	if (do_real_lookup(name, &addrs, &addrno, 1) == DNS_ERROR)
-		return;
-
-	/* We will do blocking I/O here, however it's only local communication
-	 * and it's supposed to be just a flash talk, so it shouldn't matter.
-	 * And it would be incredibly more complicated and messy (and mainly
-	 * useless) to do this in non-blocking way. */
-	if (set_blocking_fd(h) < 0) return;
-
-	if (write_dns_data(h, &addrno, sizeof(addrno)) == DNS_ERROR)
-		return;
-
-	for (i = 0; i < addrno; i++) {
-		struct sockaddr_storage *addr = &addrs[i];
-
-		if (write_dns_data(h, addr, sizeof(*addr)) == DNS_ERROR)
-			return;
-	}
-
-	/* We're in thread, thus we must do plain free(). */
-	free(addrs);
-}
-
 static enum dns_result
 read_dns_data(int h, void *data, size_t datalen)
 {
@@ -329,171 +423,405 @@ read_dns_data(int h, void *data, size_t datalen)
 	return DNS_SUCCESS;
 }
 
+#ifndef THREAD_SAFE_LOOKUP
+/* A forked worker inherits every descriptor ELinks had open at the time:
+ * sockets of connections, the pipes of the other workers, the interlink
+ * socket.  It would keep them open until it quits, so close all of them
+ * except its own pipe ends.  Stdin and stdout go to /dev/null, stderr is
+ * left for the diagnostics of the resolver library. */
 static void
-async_dns_reader(struct dnsquery *query)
+close_inherited_fds(int request_h, int h)
 {
 	ELOG
-	enum dns_result result = DNS_ERROR;
-	int i;
+	int max_fd = -1;
+	int fd;
+#ifdef HAVE_DIRENT_H
+	DIR *dir;
+#endif
+
+	fd = open("/dev/null", O_RDWR);
+	if (fd >= 0) {
+		int std_fd;
+
+		/* The pipes may have got the numbers of closed ones. */
+		for (std_fd = STDIN_FILENO; std_fd <= STDOUT_FILENO; std_fd++) {
+			if (std_fd != fd && std_fd != request_h && std_fd != h)
+				dup2(fd, std_fd);
+		}
+	}
+
+#ifdef HAVE_DIRENT_H
+	dir = opendir("/proc/self/fd");
+	if (dir) {
+		struct dirent *entry;
+
+		while ((entry = readdir(dir))) {
+			fd = atoi(entry->d_name);
+			if (fd > max_fd) max_fd = fd;
+		}
+		closedir(dir);
+	}
+#endif
+	if (max_fd < 0) {
+		long open_max = sysconf(_SC_OPEN_MAX);
+
+		max_fd = open_max > 0 && open_max < 65536 ? open_max - 1 : 65535;
+	}
+
+	for (fd = STDERR_FILENO + 1; fd <= max_fd; fd++) {
+		if (fd != request_h && fd != h)
+			close(fd);
+	}
+}
+#endif
+
+/* The main loop of a worker. Each request is the length of the name followed
+ * by the name, each reply is the number of addresses (zero if the lookup
+ * failed) followed by the addresses. The worker quits when the request pipe
+ * is closed. */
+static void
+dns_worker_loop(void *data, int h)
+{
+	ELOG
+	int *request_pipe = (int *) data;
+	int request_h = request_pipe[0];
+
+#ifndef THREAD_SAFE_LOOKUP
+	/* The worker is a forked process here.  This also drops its copy
+	 * of the write end, so that it gets EOF when ELinks closes it or
+	 * exits. */
+	close_inherited_fds(request_h, h);
+#endif
 
 	/* We will do blocking I/O here, however it's only local communication
 	 * and it's supposed to be just a flash talk, so it shouldn't matter.
 	 * And it would be incredibly more complicated and messy (and mainly
 	 * useless) to do this in non-blocking way. */
-	if (set_blocking_fd(query->h) < 0) goto done;
+	if (set_blocking_fd(h) < 0) return;
 
-	if (read_dns_data(query->h, &query->addrno, sizeof(query->addrno)) == DNS_ERROR)
-		goto done;
+	while (1) {
+		struct sockaddr_storage *addrs = NULL;
+		int namelen, addrno = 0;
+		char *name;
 
-	query->addr = (struct sockaddr_storage *)mem_calloc(query->addrno, sizeof(*query->addr));
-	if (!query->addr) goto done;
+		if (read_dns_data(request_h, &namelen, sizeof(namelen)) == DNS_ERROR)
+			break;
 
-	for (i = 0; i < query->addrno; i++) {
-		struct sockaddr_storage *addr = &query->addr[i];
+		/* We're in thread, thus we must do plain malloc(). */
+		name = (char *)malloc(namelen + 1);
+		if (!name) break;
 
-		if (read_dns_data(query->h, addr, sizeof(*addr)) == DNS_ERROR)
-			goto done;
-	}
+		if (read_dns_data(request_h, name, namelen) == DNS_ERROR) {
+			free(name);
+			break;
+		}
+		name[namelen] = '\0';
 
-	result = DNS_SUCCESS;
+		if (do_real_lookup(name, &addrs, &addrno, 1) == DNS_ERROR)
+			addrno = 0;
+		free(name);
 
-done:
-	if (result == DNS_ERROR)
-		mem_free_set(&query->addr, NULL);
+		if (write_dns_data(h, &addrno, sizeof(addrno)) == DNS_ERROR
+		    || (addrno > 0
+			&& write_dns_data(h, addrs, addrno * sizeof(*addrs)) == DNS_ERROR)) {
+			free(addrs);
+			break;
+		}
 
-	done_dns_lookup(query, result);
-}
+		/* We're in thread, thus we must do plain free(). */
+		free(addrs);
+	}
 
-static void
-async_dns_error(struct dnsquery *query)
-{
-	ELOG
-	done_dns_lookup(query, DNS_ERROR);
+	close(request_h);
 }
 
+static void read_dns_worker_reply(struct dns_worker *worker);
+static void stop_dns_worker(struct dns_worker *worker);
+static void close_dns_worker(struct dns_worker *worker);
+
 static int
-init_async_dns_lookup(struct dnsquery *dnsquery, int force_async)
+start_dns_worker(struct dns_worker *worker)
 {
 	ELOG
-	if (!force_async && !get_opt_bool("connection.async_dns", NULL)) {
-		dnsquery->h = -1;
+	int request_pipe[2];
+
+	if (c_pipe(request_pipe) < 0)
 		return 0;
-	}
 
-	dnsquery->h = start_thread(async_dns_writer, dnsquery->name,
-				   strlen(dnsquery->name) + 1);
-	if (dnsquery->h == -1)
+	worker->result_h = start_thread(dns_worker_loop, request_pipe,
+					sizeof(request_pipe));
+	if (worker->result_h == -1) {
+		close(request_pipe[0]);
+		close(request_pipe[1]);
 		return 0;
+	}
 
-	set_handlers(dnsquery->h, (select_handler_T) async_dns_reader, NULL,
-		     (select_handler_T) async_dns_error, dnsquery);
+#ifndef THREAD_SAFE_LOOKUP
+	close(request_pipe[0]);
+#endif
+	worker->request_h = request_pipe[1];
+	worker->running = 1;
+
+	set_handlers(worker->result_h, (select_handler_T) read_dns_worker_reply,
+		     NULL, (select_handler_T) stop_dns_worker, worker);
 
 	return 1;
 }
 
-static void
-done_async_dns_lookup(struct dnsquery *dnsquery)
+/* Returns an idle worker, starting a new one if all are busy. */
+static struct dns_worker *
+get_idle_dns_worker(void)
 {
 	ELOG
-	if (dnsquery->h == -1) return;
+	int i;
 
-	clear_handlers(dnsquery->h);
-	close(dnsquery->h);
-	dnsquery->h = -1;
-}
-#else
-#define init_async_dns_lookup(dnsquery, force)	(0)
-#define done_async_dns_lookup(dnsquery)		/* Nada. */
-#endif /* NO_ASYNC_LOOKUP */
+	for (i = 0; i < DNS_WORKERS; i++)
+		if (dns_workers[i].running && !dns_workers[i].name)
+			return &dns_workers[i];
 
+	for (i = 0; i < DNS_WORKERS; i++)
+		if (!dns_workers[i].running)
+			return start_dns_worker(&dns_workers[i])
+			       ? &dns_workers[i] : NULL;
 
-static enum dns_result
-do_lookup(struct dnsquery *query, int force_async)
+	return NULL;
+}
+
+static int
+is_dns_worker_running(void)
 {
 	ELOG
-	enum dns_result result;
+	int i;
 
-	/* DBG("starting lookup for %s", query->name); */
+	for (i = 0; i < DNS_WORKERS; i++)
+		if (dns_workers[i].running)
+			return 1;
 
-	/* Async lookup */
-	if (init_async_dns_lookup(query, force_async))
-		return DNS_ASYNC;
+	return 0;
+}
 
-	/* Sync lookup */
-	result = do_real_lookup(query->name, &query->addr, &query->addrno, 0);
-	done_dns_lookup(query, result);
+static int
+send_dns_request(struct dns_worker *worker, char *name)
+{
+	ELOG
+	int namelen = strlen(name);
+
+	if (write_dns_data(worker->request_h, &namelen, sizeof(namelen)) == DNS_ERROR
+	    || write_dns_data(worker->request_h, name, namelen) == DNS_ERROR)
+		return 0;
 
-	return result;
+	worker->name = stracpy(name);
+	return !!worker->name;
 }
 
-static enum dns_result
-do_queued_lookup(struct dnsquery *query)
+/* Calls the callbacks of all queries handled by @worker, NULL meaning the
+ * queries still waiting for a worker. */
+static void
+done_dns_worker_queries(struct dns_worker *worker,
+			struct sockaddr_storage *addr, int addrno)
 {
 	ELOG
-#ifdef THREAD_SAFE_LOOKUP
-	query->next_in_queue = NULL;
+	INIT_LIST_OF(struct dnsquery, queries);
+	struct dnsquery *query, *next;
 
-	if (dns_queue) {
-		/* DBG("queuing lookup for %s", q->name); */
-		assertm(!dns_queue->next_in_queue, "DNS queue corrupted");
-		dns_queue->next_in_queue = query;
-		dns_queue = query;
-		return DNS_ERROR;
+	/* Move the queries aside first since the callbacks may start or kill
+	 * other queries. */
+	foreachsafe (query, next, dns_queries) {
+		if (query->worker != worker) continue;
+
+		del_from_list(query);
+		add_to_list_end(queries, query);
 	}
 
-	dns_queue = query;
-#endif
-	/* DBG("direct lookup"); */
-	return do_lookup(query, 0);
+	while (!list_empty(queries)) {
+		query = (struct dnsquery *) queries.next;
+		del_from_list(query);
+		done_dns_lookup(query, addr, addrno);
+	}
 }
 
+/* Hands the waiting queries to idle workers. */
+static void
+run_dns_queue(void)
+{
+	ELOG
+	struct dnsquery *query, *other;
+
+	foreach (query, dns_queries) {
+		struct dns_worker *worker;
+
+		if (query->worker) continue;
+
+		worker = get_idle_dns_worker();
+		if (!worker) break;
+
+		if (!send_dns_request(worker, query->name)) {
+			close_dns_worker(worker);
+			break;
+		}
+
+		query->worker = worker;
+		for (other = query->next; (void *) other != &dns_queries;
+		     other = other->next)
+			if (!other->worker && !c_strcasecmp(other->name, query->name))
+				other->worker = worker;
+	}
+}
 
 static void
-done_dns_lookup(struct dnsquery *query, enum dns_result result)
+close_dns_worker(struct dns_worker *worker)
 {
 	ELOG
-	struct dnsentry *dnsentry;
+	clear_handlers(worker->result_h);
+	close(worker->result_h);
+	close(worker->request_h);
+	worker->running = 0;
+	mem_free_set(&worker->name, NULL);
+}
 
-	/* DBG("end lookup %s (%d)", query->name, res); */
+static void
+stop_dns_worker(struct dns_worker *worker)
+{
+	ELOG
+	close_dns_worker(worker);
+	done_dns_worker_queries(worker, NULL, 0);
+
+	/* Without any worker the waiting queries would never finish. */
+	if (!is_dns_worker_running()) {
+		run_dns_queue();
+		if (!is_dns_worker_running())
+			done_dns_worker_queries(NULL, NULL, 0);
+	}
+}
 
-	/* do_lookup() might start a new async thread */
-	done_async_dns_lookup(query);
+static void
+read_dns_worker_reply(struct dns_worker *worker)
+{
+	ELOG
+	struct sockaddr_storage *addr = NULL;
+	char *name = worker->name;
+	int addrno;
+
+	/* See dns_worker_loop() on blocking I/O. */
+	if (!name
+	    || set_blocking_fd(worker->result_h) < 0
+	    || read_dns_data(worker->result_h, &addrno, sizeof(addrno)) == DNS_ERROR) {
+		stop_dns_worker(worker);
+		return;
+	}
 
-#ifdef THREAD_SAFE_LOOKUP
-	if (query->next_in_queue) {
-		/* DBG("processing next in queue: %s", query->next_in_queue->name); */
-		do_lookup(query->next_in_queue, 1);
+	if (addrno > 0) {
+		addr = (struct sockaddr_storage *)mem_calloc(addrno, sizeof(*addr));
+		if (!addr
+		    || read_dns_data(worker->result_h, addr, addrno * sizeof(*addr)) == DNS_ERROR) {
+			mem_free_if(addr);
+			stop_dns_worker(worker);
+			return;
+		}
 	} else {
-		dns_queue = NULL;
+		addrno = 0;
 	}
-#endif
 
-	/* Make sure the query is unregister _before_ calling any callbacks. */
-	*query->queryref = NULL;
+	/* The worker can take the next request right away. */
+	worker->name = NULL;
 
-	/* If the callback was cleared skip to the freeing part. */
-	if (!query->done)
-		goto done;
+	store_dns_result(name, &addr, &addrno);
+	done_dns_worker_queries(worker, addr, addrno);
+	run_dns_queue();
 
-	dnsentry = find_in_dns_cache(query->name);
-	if (dnsentry) {
-		/* If the query failed, use the existing DNS cache entry even if
-		 * it is too old. */
-		if (result == DNS_ERROR) {
-			query->done(query->data, dnsentry->addr, dnsentry->addrno);
-			goto done;
-		}
+	mem_free_if(addr);
+	mem_free(name);
+}
 
-		del_dns_cache_entry(dnsentry);
+/* Returns whether the query was queued for one of the workers. */
+static int
+init_async_dns_lookup(struct dnsquery *query)
+{
+	ELOG
+	struct dnsquery *other;
+
+	if (!get_opt_bool("connection.async_dns", NULL))
+		return 0;
+
+	/* Join a lookup of the same host which is running or waiting. */
+	foreach (other, dns_queries) {
+		if (c_strcasecmp(other->name, query->name)) continue;
+
+		query->worker = other->worker;
+		add_to_list_end(dns_queries, query);
+		return 1;
 	}
 
-	if (result == DNS_SUCCESS)
-		add_to_dns_cache(query->name, query->addr, query->addrno);
+	query->worker = NULL;
+	add_to_list_end(dns_queries, query);
+	run_dns_queue();
 
-	query->done(query->data, query->addr, query->addrno);
+	if (query->worker || is_dns_worker_running())
+		return 1;
+
+	/* No worker could be started so look the name up directly. */
+	del_from_list(query);
+	return 0;
+}
+
+void
+done_dns_resolver(void)
+{
+	ELOG
+	int i;
+
+	for (i = 0; i < DNS_WORKERS; i++)
+		if (dns_workers[i].running)
+			stop_dns_worker(&dns_workers[i]);
+}
+#else
+#define init_async_dns_lookup(query)	(0)
+
+void
+done_dns_resolver(void)
+{
+	ELOG
+}
+#endif /* NO_ASYNC_LOOKUP */
+
+
+static enum dns_result
+do_lookup(struct dnsquery *query)
+{
+	ELOG
+	struct sockaddr_storage *addr = NULL;
+	int addrno = 0;
+
+	/* DBG("starting lookup for %s", query->name); */
+
+	/* Async lookup */
+	if (init_async_dns_lookup(query))
+		return DNS_ASYNC;
+
+	/* Sync lookup */
+	if (do_real_lookup(query->name, &addr, &addrno, 0) == DNS_ERROR)
+		addrno = 0;
+
+	store_dns_result(query->name, &addr, &addrno);
+	done_dns_lookup(query, addr, addrno);
+	mem_free_if(addr);
+
+	return addrno ? DNS_SUCCESS : DNS_ERROR;
+}
+
+static void
+done_dns_lookup(struct dnsquery *query, struct sockaddr_storage *addr,
+		int addrno)
+{
+	ELOG
+	/* DBG("end lookup %s (%d)", query->name, addrno); */
+
+	/* Make sure the query is unregister _before_ calling any callbacks. */
+	*query->queryref = NULL;
+
+	if (query->done)
+		query->done(query->data, addrno ? addr : NULL, addrno);
 
-done:
-	mem_free_set(&query->addr, NULL);
 	mem_free(query);
 }
 
@@ -520,7 +848,7 @@ init_dns_lookup(char *name, void **queryref,
 	query->queryref = (struct dnsquery **) queryref;
 	*(query->queryref) = query;
 
-	return do_queued_lookup(query);
+	return do_lookup(query);
 }
 
 
@@ -539,23 +867,29 @@ find_host(char *name, void **queryref,
 
 	/* Check if the DNS name is in the cache. If the cache entry is too old
 	 * do a new lookup. However, old cache entries will be used as a
-	 * fallback if the new lookup fails. */
+	 * fallback if the new lookup fails. Recently failed lookups are not
+	 * retried until their entry expires. */
 	dnsentry = find_in_dns_cache(name);
 	if (dnsentry) {
-		timeval_T age, now, max_age;
-
-		assert(dnsentry && dnsentry->addrno > 0);
+		timeval_T now;
 
-		timeval_from_seconds(&max_age, DNS_CACHE_TIMEOUT);
 		timeval_now(&now);
-		timeval_sub(&age, &dnsentry->creation_time, &now);
 
-		if (timeval_cmp(&age, &max_age) <= 0) {
+		if (!is_dns_entry_expired(dnsentry, &now)) {
+			dns_cache_hits++;
+
+			if (dns_entry_failed(dnsentry)) {
+				done(data, NULL, 0);
+				return DNS_ERROR;
+			}
+
 			done(data, dnsentry->addr, dnsentry->addrno);
 			return DNS_SUCCESS;
 		}
 	}
 
+	dns_cache_misses++;
+
 	return init_dns_lookup(name, queryref, done, data);
 }
 
@@ -567,8 +901,10 @@ kill_dns_request(void **queryref)
 
 	assert(query);
 
+	/* Only asynchronous queries can be pending. */
 	query->done = NULL;
-	done_dns_lookup(query, DNS_ERROR);
+	del_from_list(query);
+	done_dns_lookup(query, NULL, 0);
 }
 
 void
@@ -581,19 +917,50 @@ shrink_dns_cache(int whole)
 		foreachsafe (dnsentry, next, dns_cache)
 			del_dns_cache_entry(dnsentry);
 
+		foreachsafe (dnsentry, next, dns_negative_cache)
+			del_dns_cache_entry(dnsentry);
+
+		if (dns_index) free_hash(&dns_index);
+
 	} else {
-		timeval_T now, max_age;
+		timeval_T now;
 
-		timeval_from_seconds(&max_age, DNS_CACHE_TIMEOUT);
 		timeval_now(&now);
 
-		foreachsafe (dnsentry, next, dns_cache) {
-			timeval_T age;
-
-			timeval_sub(&age, &dnsentry->creation_time, &now);
+		foreachsafe (dnsentry, next, dns_cache)
+			if (is_dns_entry_expired(dnsentry, &now))
+				del_dns_cache_entry(dnsentry);
 
-			if (timeval_cmp(&age, &max_age) > 0)
+		foreachsafe (dnsentry, next, dns_negative_cache)
+			if (is_dns_entry_expired(dnsentry, &now))
 				del_dns_cache_entry(dnsentry);
-		}
 	}
 }
+
+int
+get_dns_cache_entry_count(void)
+{
+	ELOG
+	return list_size(&dns_cache);
+}
+
+int
+get_dns_negative_cache_entry_count(void)
+{
+	ELOG
+	return dns_negative_cache_count;
+}
+
+long
+get_dns_cache_hits(void)
+{
+	ELOG
+	return dns_cache_hits;
+}
+
+long
+get_dns_cache_misses(void)
+{
+	ELOG
+	return dns_cache_misses;
+}
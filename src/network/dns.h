@@ -43,6 +43,15 @@ void kill_dns_request(void **queryref);
  * cache entries will be removed. */
 void shrink_dns_cache(int whole);
 
+/* Stops the workers doing asynchronous lookups. */
+void done_dns_resolver(void);
+
+/* Used by the resource info dialog. */
+int get_dns_cache_entry_count(void);
+int get_dns_negative_cache_entry_count(void);
+long get_dns_cache_hits(void);
+long get_dns_cache_misses(void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -43,6 +43,7 @@
 
 #include "config/options.h"
 #include "main/select.h"
+#include "main/timer.h"
 #include "network/connection.h"
 #include "network/dns.h"
 #include "network/socket.h"
@@ -52,11 +53,24 @@
 #include "protocol/http/blacklist.h"
 #include "protocol/protocol.h"
 #include "protocol/uri.h"
+#include "util/conv.h"
 #include "util/error.h"
+#include "util/hash.h"
 #include "util/memory.h"
 #include "util/string.h"
 
 
+/* A connect() which is still in progress. When a host has several addresses
+ * a new attempt is started every CONNECT_ATTEMPT_DELAY milliseconds while the
+ * earlier ones keep waiting, and the first one to succeed wins (RFC 8305). */
+struct connect_attempt {
+	LIST_HEAD_EL(struct connect_attempt);
+
+	struct socket *socket;
+	int fd;
+	int protocol_family;		 /* EL_PF_INET, EL_PF_INET6 */
+};
+
 /* Holds information used during the connection establishing phase. */
 struct connect_info {
 	struct sockaddr_storage *addr;	 /* Array of found addresses. */
@@ -67,8 +81,26 @@ struct connect_info {
 	int port;			 /* Which port to bind to. */
 	int ip_family;			 /* If non-zero, force to IP version. */
 	struct uri *uri;		 /* For updating the blacklist. */
+
+	LIST_OF(struct connect_attempt) attempts;
+	timer_id_T attempt_timer;	 /* Starts the next attempt. */
+	unsigned int ipv6_tried:1;	 /* An IPv6 connect() was started. */
+};
+
+/* Hosts where IPv4 connected before IPv6 the last time, so that the next
+ * connection to them starts with IPv4. The most recently used are at the top
+ * and there are at most IPV4_FIRST_HOSTS of them. */
+struct ipv4_first_host {
+	LIST_HEAD_EL(struct ipv4_first_host);
+
+	struct hash_item *item;
+	char host[1]; /* Lowercased, must be last. */
 };
 
+static INIT_LIST_OF(struct ipv4_first_host, ipv4_first_hosts);
+static struct hash *ipv4_first_index;
+static int ipv4_first_hosts_count;
+
 /** For detecting whether a struct socket has been deleted while a
  * function was using it.  */
 struct socket_weak_ref {
@@ -119,10 +151,33 @@ init_connection_info(struct uri *uri, struct socket *socket,
 	connect_info->triedno = -1;
 	connect_info->addr = NULL;
 	connect_info->uri = get_uri_reference(uri);
+	init_list(connect_info->attempts);
+	connect_info->attempt_timer = TIMER_ID_UNDEF;
 
 	return connect_info;
 }
 
+static void
+done_connect_attempt(struct connect_attempt *attempt, int close_fd)
+{
+	ELOG
+	clear_handlers(attempt->fd);
+	if (close_fd) close(attempt->fd);
+	del_from_list(attempt);
+	mem_free(attempt);
+}
+
+/* Gives up all attempts still in progress. */
+static void
+done_connect_attempts(struct connect_info *connect_info)
+{
+	ELOG
+	kill_timer(&connect_info->attempt_timer);
+
+	while (!list_empty(connect_info->attempts))
+		done_connect_attempt((struct connect_attempt *) connect_info->attempts.next, 1);
+}
+
 static void
 done_connection_info(struct socket *socket)
 {
@@ -133,6 +188,8 @@ done_connection_info(struct socket *socket)
 
 	if (connect_info->dnsquery) kill_dns_request(&connect_info->dnsquery);
 
+	done_connect_attempts(connect_info);
+
 	mem_free_if(connect_info->addr);
 	done_uri(connect_info->uri);
 	mem_free_set(&socket->connect_info, NULL);
@@ -182,8 +239,9 @@ close_socket(struct socket *socket)
 #ifdef CONFIG_SSL
 	if (socket->ssl) ssl_close(socket);
 #endif
-	close(socket->fd);
+	/* Before close() so that the descriptor leaves the epoll set. */
 	clear_handlers(socket->fd);
+	close(socket->fd);
 	socket->fd = -1;
 }
 
@@ -218,6 +276,7 @@ timeout_socket(struct socket *socket)
 	}
 
 	/* Try the next address, */
+	done_connect_attempts(socket->connect_info);
 	connect_socket(socket, connection_state(S_TIMEOUT));
 
 	/* Reset the timeout if connect_socket() started a new attempt
@@ -226,6 +285,127 @@ timeout_socket(struct socket *socket)
 		socket->ops->set_timeout(socket, connection_state(0));
 }
 
+static void
+del_ipv4_first_host(struct ipv4_first_host *entry)
+{
+	ELOG
+	del_from_list(entry);
+	del_hash_item(ipv4_first_index, entry->item);
+	mem_free(entry);
+	ipv4_first_hosts_count--;
+}
+
+
+/* Returns the entry of the host of @uri and, if @create, adds one when there
+ * is none yet. */
+static struct ipv4_first_host *
+get_ipv4_first_host(struct uri *uri, int create)
+{
+	ELOG
+	struct ipv4_first_host *entry;
+	struct hash_item *item;
+	int hostlen = uri->hostlen;
+	char *key;
+
+	if (!uri->host || hostlen <= 0) return NULL;
+
+	if (!ipv4_first_index) {
+		if (!create) return NULL;
+		ipv4_first_index = init_hash8();
+		if (!ipv4_first_index) return NULL;
+	}
+
+	key = memacpy(uri->host, hostlen);
+	if (!key) return NULL;
+
+	convert_to_lowercase_locale_indep(key, hostlen);
+	item = get_hash_item(ipv4_first_index, key, hostlen);
+	mem_free(key);
+
+	if (item) {
+		entry = (struct ipv4_first_host *)item->value;
+		move_to_top_of_list(ipv4_first_hosts, entry);
+		return entry;
+	}
+
+	if (!create) return NULL;
+
+	entry = (struct ipv4_first_host *)mem_calloc(1, sizeof(*entry) + hostlen);
+	if (!entry) return NULL;
+
+	/* calloc() sets NUL char for us. */
+	memcpy(entry->host, uri->host, hostlen);
+	convert_to_lowercase_locale_indep(entry->host, hostlen);
+
+	entry->item = add_hash_item(ipv4_first_index, entry->host, hostlen, entry);
+	if (!entry->item) {
+		mem_free(entry);
+		return NULL;
+	}
+
+	if (ipv4_first_hosts_count >= IPV4_FIRST_HOSTS)
+		del_ipv4_first_host((struct ipv4_first_host *) ipv4_first_hosts.prev);
+
+	add_to_list(ipv4_first_hosts, entry);
+	ipv4_first_hosts_count++;
+
+	return entry;
+}
+
+void
+free_ipv4_first_hosts(void)
+{
+	ELOG
+	while (!list_empty(ipv4_first_hosts))
+		del_ipv4_first_host((struct ipv4_first_host *) ipv4_first_hosts.next);
+
+	if (ipv4_first_index)
+		free_hash(&ipv4_first_index);
+}
+
+
+/* Orders the addresses so that the IP families alternate, starting with
+ * IPv6 unless @ipv4_first says IPv4 won the last time. A host with a broken
+ * IPv6 route then loses at most one attempt delay. */
+static void
+sort_connect_addresses(struct connect_info *connect_info, int ipv4_first)
+{
+	ELOG
+#ifdef CONFIG_IPV6
+	int families[2] = { AF_INET6, AF_INET };
+	int next[2] = { 0, 0 };	/* Where to look for the next one. */
+	int addrno = connect_info->addrno;
+	struct sockaddr_storage *addr;
+	int turn = !!ipv4_first;
+	int i, n;
+
+	if (addrno < 2) return;
+
+	addr = (struct sockaddr_storage *)mem_alloc(addrno * sizeof(*addr));
+	if (!addr) return;
+
+	for (n = 0; n < addrno; turn = !turn) {
+		for (i = next[turn]; i < addrno; i++)
+			if (connect_info->addr[i].ss_family == families[turn])
+				break;
+
+		next[turn] = i + 1;
+		if (i < addrno)
+			addr[n++] = connect_info->addr[i];
+		else if (next[!turn] > addrno)
+			break;
+	}
+
+	/* Keep addresses of other families at the end. */
+	for (i = 0; i < addrno; i++)
+		if (connect_info->addr[i].ss_family != AF_INET
+		    && connect_info->addr[i].ss_family != AF_INET6)
+			addr[n++] = connect_info->addr[i];
+
+	mem_free(connect_info->addr);
+	connect_info->addr = addr;
+#endif
+}
 
 /* DNS callback. */
 static void
@@ -253,6 +433,9 @@ dns_found(struct socket *socket, struct sockaddr_storage *addr, int addrlen)
 	memcpy(connect_info->addr, addr, size);
 	connect_info->addrno = addrlen;
 
+	sort_connect_addresses(connect_info,
+			       !!get_ipv4_first_host(connect_info->uri, 0));
+
 	/* XXX: Passing non-result state here is bad but a lack of alternatives
 	 * makes it so. Well adding get_state() socket operation could maybe fix
 	 * it but the returned state would most likely be a non-result one at
@@ -504,13 +687,44 @@ complete_connect_socket(struct socket *socket, struct uri *uri,
 	done_connection_info(socket);
 }
 
+/* Makes @fd the descriptor of @socket, giving up all other attempts, and
+ * remembers which IP family won for the next connection to the host. */
+static void
+use_connected_socket(struct socket *socket, int fd, int protocol_family)
+{
+	ELOG
+	struct connect_info *connect_info = socket->connect_info;
+
+	done_connect_attempts(connect_info);
+
+	socket->fd = fd;
+	socket->protocol_family = protocol_family;
+
+	/* IPv4 only beat IPv6 if an IPv6 attempt had been started, which
+	 * also means that the host has addresses of both families. */
+	if (connect_info->uri) {
+		if (protocol_family == EL_PF_INET6) {
+			struct ipv4_first_host *entry;
+
+			entry = get_ipv4_first_host(connect_info->uri, 0);
+			if (entry) del_ipv4_first_host(entry);
+
+		} else if (connect_info->ipv6_tried) {
+			get_ipv4_first_host(connect_info->uri, 1);
+		}
+	}
+
+	complete_connect_socket(socket, NULL, NULL);
+}
+
 /* Select handler which is set for the socket descriptor when connect() has
  * indicated (via errno) that it is in progress. On completion this handler gets
  * called. */
 static void
-connected(struct socket *socket)
+connected(struct connect_attempt *attempt)
 {
 	ELOG
+	struct socket *socket = attempt->socket;
 	int err = 0;
 	struct connection_state state = connection_state(0);
 	socklen_t len = sizeof(err);
@@ -518,7 +732,7 @@ connected(struct socket *socket)
 	assertm(socket->connect_info != NULL, "Lost connect_info!");
 	if_assert_failed return;
 
-	if (getsockopt(socket->fd, SOL_SOCKET, SO_ERROR, (void *) &err, &len) == 0) {
+	if (getsockopt(attempt->fd, SOL_SOCKET, SO_ERROR, (void *) &err, &len) == 0) {
 		/* Why does EMX return so large values? */
 		if (err >= 10000) err -= 10000;
 		if (err != 0)
@@ -535,11 +749,38 @@ connected(struct socket *socket)
 
 	if (!is_in_state(state, 0)) {
 		/* There are maybe still some more candidates. */
+		done_connect_attempt(attempt, 1);
 		connect_socket(socket, state);
 		return;
 	}
 
-	complete_connect_socket(socket, NULL, NULL);
+	{
+		int fd = attempt->fd;
+		int protocol_family = attempt->protocol_family;
+
+		done_connect_attempt(attempt, 0);
+		use_connected_socket(socket, fd, protocol_family);
+	}
+}
+
+static void
+connect_attempt_exception(struct connect_attempt *attempt)
+{
+	ELOG
+	struct socket *socket = attempt->socket;
+
+	done_connect_attempt(attempt, 1);
+	connect_socket(socket, connection_state(S_EXCEPT));
+}
+
+/* Timer handler starting the next attempt while the earlier ones are still
+ * in progress. */
+static void
+start_next_connect_attempt(struct socket *socket)
+{
+	ELOG
+	socket->connect_info->attempt_timer = TIMER_ID_UNDEF;
+	connect_socket(socket, connection_state(S_CONN));
 }
 
 #ifdef HAVE_INET_PTON
@@ -616,6 +857,10 @@ connect_socket(struct socket *csocket, struct connection_state state)
 	if (csocket->fd >= 0)
 		close_socket(csocket);
 
+	/* Either the timer fired or we are going to start the next attempt
+	 * right away because one has failed. */
+	kill_timer(&connect_info->attempt_timer);
+
 	for (i = connect_info->triedno + 1; i < connect_info->addrno; i++) {
 #ifdef CONFIG_IPV6
 		struct sockaddr_in6 addr = *((struct sockaddr_in6 *) &connect_info->addr[i]);
@@ -624,7 +869,7 @@ connect_socket(struct socket *csocket, struct connection_state state)
 		struct sockaddr_in addr = *((struct sockaddr_in *) &connect_info->addr[i]);
 		int family = addr.sin_family;
 #endif
-		int pf;
+		int pf, protocol_family;
 		int force_family = connect_info->ip_family;
 
 		connect_info->triedno++;
@@ -709,37 +954,30 @@ connect_socket(struct socket *csocket, struct connection_state state)
 		}
 #endif
 #endif
-		csocket->fd = sock;
-
 #ifdef CONFIG_IPV6
 		addr.sin6_port = htons(connect_info->port);
 #else
 		addr.sin_port = htons(connect_info->port);
 #endif
 
-		/* We can set csocket->protocol_family here even if the connection
-		 * will fail, as we will use it only when it will be successfully
-		 * established. At least I hope that noone else will want to do
-		 * something else ;-). --pasky */
-		/* And in fact we must set it early, because of EINPROGRESS.  */
-
 #ifdef CONFIG_IPV6
 		if (family == AF_INET6) {
-			csocket->protocol_family = EL_PF_INET6;
+			protocol_family = EL_PF_INET6;
+			connect_info->ipv6_tried = 1;
 			if (connect(sock, (struct sockaddr *) &addr,
 					sizeof(struct sockaddr_in6)) == 0) {
 				/* Success */
-				complete_connect_socket(csocket, NULL, NULL);
+				use_connected_socket(csocket, sock, protocol_family);
 				return;
 			}
 		} else
 #endif
 		{
-			csocket->protocol_family = EL_PF_INET;
+			protocol_family = EL_PF_INET;
 			if (connect(sock, (struct sockaddr *) &addr,
 					sizeof(struct sockaddr_in)) == 0) {
 				/* Success */
-				complete_connect_socket(csocket, NULL, NULL);
+				use_connected_socket(csocket, sock, protocol_family);
 				return;
 			}
 		}
@@ -749,10 +987,33 @@ connect_socket(struct socket *csocket, struct connection_state state)
 		    || errno == EWOULDBLOCK
 #endif
 		    || errno == EINPROGRESS) {
+			struct connect_attempt *attempt;
+
+			attempt = (struct connect_attempt *)mem_alloc(sizeof(*attempt));
+			if (!attempt) {
+				if (!saved_errno) saved_errno = ENOMEM;
+				close(sock);
+				continue;
+			}
+
 			/* It will take some more time... */
+			attempt->socket = csocket;
+			attempt->fd = sock;
+			attempt->protocol_family = protocol_family;
+			add_to_list_end(connect_info->attempts, attempt);
+
 			set_handlers(sock, NULL, (select_handler_T) connected,
-				     (select_handler_T) dns_exception, csocket);
+				     (select_handler_T) connect_attempt_exception,
+				     attempt);
 			csocket->ops->set_state(csocket, connection_state(S_CONN));
+
+			/* Don't wait for this one too long if there are
+			 * more addresses to try. */
+			if (connect_info->triedno + 1 < connect_info->addrno)
+				install_timer(&connect_info->attempt_timer,
+					      CONNECT_ATTEMPT_DELAY,
+					      (void (*)(void *)) start_next_connect_attempt,
+					      csocket);
 			return;
 		}
 
@@ -763,6 +1024,12 @@ connect_socket(struct socket *csocket, struct connection_state state)
 
 	assert(i >= connect_info->addrno);
 
+	/* Wait for the attempts which are still in progress. */
+	if (!list_empty(connect_info->attempts)) {
+		csocket->ops->set_state(csocket, connection_state(S_CONN));
+		return;
+	}
+
 	/* Tried everything, but it didn't help :(. */
 
 	if (only_local && !saved_errno && at_least_one_remote_ip) {
@@ -976,16 +1243,28 @@ read_select(struct socket *socket)
 		clear_handlers(socket->fd);
 
 	if (!rb->freespace) {
-		int size = RD_SIZE(rb, rb->length);
+		int offset = rb->data - rb->buffer;
+
+		if (offset && offset >= rb->length) {
+			/* Most of the buffer was already consumed, so move
+			 * the rest to the front. This copies at most as many
+			 * bytes as were killed since the last time. */
+			memmove(rb->buffer, rb->data, rb->length);
+			rb->data = rb->buffer;
+			rb->freespace = offset;
+		} else {
+			int size = RD_SIZE(rb, offset + rb->length);
 
-		rb = (struct read_buffer *)mem_realloc(rb, size);
-		if (!rb) {
-			socket->ops->done(socket, connection_state(S_OUT_OF_MEM));
-			return;
+			rb = (struct read_buffer *)mem_realloc(rb, size);
+			if (!rb) {
+				socket->ops->done(socket, connection_state(S_OUT_OF_MEM));
+				return;
+			}
+			rb->data = rb->buffer + offset;
+			rb->freespace = size - sizeof(*rb) - offset - rb->length;
+			socket->read_buffer = rb;
 		}
-		rb->freespace = size - sizeof(*rb) - rb->length;
 		assert(rb->freespace > 0);
-		socket->read_buffer = rb;
 	}
 
 #ifdef CONFIG_SSL
@@ -1046,6 +1325,7 @@ alloc_read_buffer(struct socket *socket)
 		return NULL;
 	}
 
+	rb->data = rb->buffer;
 	rb->freespace = RD_SIZE(rb, 0) - sizeof(*rb);
 
 	return rb;
@@ -1125,6 +1405,13 @@ kill_buffer_data(struct read_buffer *rb, int n)
 
 	if (!n) return; /* FIXME: We accept to kill 0 bytes... */
 	rb->length -= n;
-	memmove(rb->data, rb->data + n, rb->length);
-	rb->freespace += n;
+
+	if (rb->length) {
+		/* The space is reclaimed by read_select() when needed. */
+		rb->data += n;
+		return;
+	}
+
+	rb->freespace += rb->data + n - rb->buffer;
+	rb->data = rb->buffer;
 }
@@ -62,10 +62,13 @@ struct read_buffer {
 	 * usually many times, not only when all the data arrives. */
 	socket_read_T done;
 
+	/* The unread data. It starts somewhere in @buffer so that
+	 * kill_buffer_data() only has to move this pointer. */
+	char *data;
 	int length;
-	int freespace;
+	int freespace;			/* Space left after the data */
 
-	char data[1]; /* must be at end of struct */
+	char buffer[1]; /* must be at end of struct */
 };
 
 struct socket {
@@ -126,6 +129,9 @@ void timeout_socket(struct socket *socket);
 
 /* Connection establishing: */
 
+/* Forgets the hosts which were found to connect faster over IPv4. */
+void free_ipv4_first_hosts(void);
+
 /* End successful connect() attempt to socket. */
 void complete_connect_socket(struct socket *socket, struct uri *uri,
 			     socket_connect_T done);
@@ -0,0 +1,455 @@
+/* Test the asynchronous resolver against a stub DNS server */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <arpa/nameser.h>
+#include <fcntl.h>
+#include <resolv.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include "elinks.h"
+
+#include "config/options.h"
+#include "main/select.h"
+#include "network/dns.h"
+#include "osdep/osdep.h"
+#include "util/memory.h"
+
+/* fake tty get function, needed for charsets.c */
+int
+get_ctl_handle(void)
+{
+	return -1;
+}
+
+char *
+gettext(const char *text)
+{
+	return (char *)text;
+}
+
+int
+os_default_charset(void)
+{
+	return -1;
+}
+
+/* Every option the resolver asks for, i.e. connection.async_dns, is on. */
+struct option *config_options;
+
+#ifdef CONFIG_DEBUG
+union option_value *
+get_opt_(char *file, int line, enum option_type option_type,
+	 struct option *tree, const char *name, struct session *ses)
+#else
+union option_value *
+get_opt_(struct option *tree, const char *name, struct session *ses)
+#endif
+{
+	static union option_value value;
+
+	value.number = 1;
+	return &value;
+}
+
+int
+c_pipe(int *fd)
+{
+	return pipe(fd);
+}
+
+int
+set_blocking_fd(int fd)
+{
+	int flags = fcntl(fd, F_GETFL, 0);
+
+	if (flags < 0) return -1;
+	return fcntl(fd, F_SETFL, flags & ~O_NONBLOCK);
+}
+
+/* Like the fork() version in osdep.c, without the terminals. */
+int
+start_thread(void (*fn)(void *, int), void *ptr, int l)
+{
+	int p[2];
+	pid_t pid;
+
+	if (c_pipe(p) < 0) return -1;
+
+	pid = fork();
+	if (!pid) {
+		close(p[0]);
+		fn(ptr, p[1]);
+		close(p[1]);
+		_exit(0);
+	}
+	if (pid == -1) {
+		close(p[0]);
+		close(p[1]);
+		return -1;
+	}
+
+	close(p[1]);
+	return p[0];
+}
+
+/* The select loop, just enough for the result pipes of the workers and the
+ * stub server. */
+static struct {
+	select_handler_T read_func;
+	select_handler_T error_func;
+	void *data;
+} handlers[FD_SETSIZE];
+
+void
+set_handlers(int fd, select_handler_T read_func, select_handler_T write_func,
+	     select_handler_T error_func, void *data)
+{
+	if (fd < 0 || fd >= FD_SETSIZE) {
+		fprintf(stderr, "set_handlers: bad descriptor %d\n", fd);
+		exit(EXIT_FAILURE);
+	}
+
+	handlers[fd].read_func = read_func;
+	handlers[fd].error_func = error_func;
+	handlers[fd].data = data;
+}
+
+static int pending;
+
+/* Run the loop until no lookup is pending.  Returns 0 if it took longer
+ * than a few seconds. */
+static int
+run_loop(void)
+{
+	while (pending > 0) {
+		struct timeval timeout = { 5, 0 };
+		fd_set read_set;
+		int fd, n, max_fd = -1;
+
+		FD_ZERO(&read_set);
+		for (fd = 0; fd < FD_SETSIZE; fd++) {
+			if (!handlers[fd].read_func) continue;
+			FD_SET(fd, &read_set);
+			max_fd = fd;
+		}
+
+		n = select(max_fd + 1, &read_set, NULL, NULL, &timeout);
+		if (n <= 0) return 0;
+
+		for (fd = 0; fd <= max_fd; fd++) {
+			if (FD_ISSET(fd, &read_set) && handlers[fd].read_func)
+				handlers[fd].read_func(handlers[fd].data);
+		}
+	}
+
+	return 1;
+}
+
+/* The stub DNS server answers A queries for the names below and counts
+ * them; any other name does not exist. */
+static struct stub_host {
+	const char *name;
+	const char *addr;
+	int queries;
+} stub_hosts[] = {
+	{ "one.elinks.test", "192.0.2.1" },
+	{ "two.elinks.test", "192.0.2.2" },
+	{ "w1.elinks.test", "192.0.2.11" },
+	{ "w2.elinks.test", "192.0.2.12" },
+	{ "w3.elinks.test", "192.0.2.13" },
+	{ "w4.elinks.test", "192.0.2.14" },
+};
+
+#define STUB_HOSTS (sizeof(stub_hosts) / sizeof(*stub_hosts))
+
+static int stub_fd = -1;
+
+static struct stub_host *
+find_stub_host(const char *name)
+{
+	int i;
+
+	for (i = 0; i < STUB_HOSTS; i++)
+		if (!strcasecmp(stub_hosts[i].name, name))
+			return &stub_hosts[i];
+
+	return NULL;
+}
+
+static void
+read_stub_query(void *data)
+{
+	unsigned char buf[512];
+	struct sockaddr_storage from;
+	socklen_t fromlen = sizeof(from);
+	struct stub_host *host;
+	char name[256];
+	int namelen = 0, pos = NS_HFIXEDSZ, type;
+	ssize_t len;
+
+	len = recvfrom(stub_fd, buf, sizeof(buf) - NS_RRFIXEDSZ - 6, 0,
+		       (struct sockaddr *) &from, &fromlen);
+	if (len < NS_HFIXEDSZ) return;
+
+	while (pos < len && buf[pos]) {
+		int label = buf[pos++];
+
+		if (pos + label > len || namelen + label + 1 >= sizeof(name))
+			return;
+		if (namelen) name[namelen++] = '.';
+		memcpy(name + namelen, buf + pos, label);
+		namelen += label;
+		pos += label;
+	}
+	name[namelen] = '\0';
+	pos++;
+	if (pos + NS_QFIXEDSZ > len) return;
+
+	type = buf[pos] << 8 | buf[pos + 1];
+	pos += NS_QFIXEDSZ;
+
+	host = find_stub_host(name);
+
+	/* A response with the question only, dropping any EDNS record. */
+	buf[2] = 0x81;			/* QR, RD */
+	buf[3] = host ? 0x80 : 0x83;	/* RA, NXDOMAIN */
+	memset(buf + 6, 0, 6);
+
+	if (host && type == ns_t_a) {
+		static const unsigned char answer[] = {
+			0xc0, NS_HFIXEDSZ,	/* the name in the question */
+			0, ns_t_a, 0, ns_c_in,
+			0, 0, 0, 60,		/* TTL */
+			0, 4,
+		};
+		struct in_addr addr;
+
+		host->queries++;
+		inet_pton(AF_INET, host->addr, &addr);
+		memcpy(buf + pos, answer, sizeof(answer));
+		memcpy(buf + pos + sizeof(answer), &addr, 4);
+		pos += sizeof(answer) + 4;
+		buf[7] = 1;
+	}
+
+	sendto(stub_fd, buf, pos, 0, (struct sockaddr *) &from, fromlen);
+}
+
+/* Starts the stub server and points the resolver at it.  The workers are
+ * forked later and inherit the resolver state. */
+static int
+start_stub_server(void)
+{
+	struct sockaddr_in addr;
+	socklen_t addrlen = sizeof(addr);
+
+	stub_fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (stub_fd < 0) return 0;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(stub_fd, (struct sockaddr *) &addr, sizeof(addr)) < 0
+	    || getsockname(stub_fd, (struct sockaddr *) &addr, &addrlen) < 0)
+		return 0;
+
+	if (res_init() < 0) return 0;
+	_res.nscount = 1;
+	_res.nsaddr_list[0] = addr;
+	_res.retrans = 1;
+	_res.retry = 1;
+	_res.options &= ~(RES_DNSRCH | RES_DEFNAMES);
+
+	set_handlers(stub_fd, read_stub_query, NULL, NULL, NULL);
+
+	return 1;
+}
+
+/* What one lookup got. */
+struct lookup {
+	const char *name;
+	const char *expected;
+	int done;
+	int ok;
+	void *query;
+};
+
+static void
+lookup_done(void *data, struct sockaddr_storage *addr, int addrno)
+{
+	struct lookup *lookup = (struct lookup *) data;
+	char found[INET6_ADDRSTRLEN] = "";
+	int i;
+
+	for (i = 0; i < addrno; i++) {
+		if (addr[i].ss_family != AF_INET) continue;
+		inet_ntop(AF_INET, &((struct sockaddr_in *) &addr[i])->sin_addr,
+			  found, sizeof(found));
+		break;
+	}
+
+	lookup->done++;
+	lookup->ok = lookup->expected ? !strcmp(found, lookup->expected) : !addrno;
+	pending--;
+}
+
+static int
+start_lookup(struct lookup *lookup)
+{
+	pending++;
+	return find_host((char *) lookup->name, &lookup->query, lookup_done, lookup, 0) != DNS_ERROR
+	       || !lookup->expected;
+}
+
+static int
+check_lookups(const char *test, struct lookup *lookups, int count)
+{
+	int i;
+
+	for (i = 0; i < count; i++) {
+		if (lookups[i].done == 1 && lookups[i].ok) continue;
+
+		fprintf(stderr, "%s: lookup of %s %s\n", test, lookups[i].name,
+			lookups[i].done == 1 ? "got a wrong answer" : "did not finish once");
+		return 0;
+	}
+
+	return 1;
+}
+
+/* Lookups of one name started before the first answer share one query. */
+static int
+test_coalescing(void)
+{
+	struct lookup lookups[] = {
+		{ "one.elinks.test", "192.0.2.1" },
+		{ "one.elinks.test", "192.0.2.1" },
+		{ "ONE.elinks.test", "192.0.2.1" },
+		{ "two.elinks.test", "192.0.2.2" },
+	};
+	int i;
+
+	for (i = 0; i < sizeof(lookups) / sizeof(*lookups); i++)
+		if (!start_lookup(&lookups[i])) {
+			fprintf(stderr, "coalescing: lookup of %s failed\n",
+				lookups[i].name);
+			return 0;
+		}
+
+	if (!run_loop()) {
+		fprintf(stderr, "coalescing: timed out\n");
+		return 0;
+	}
+
+	if (!check_lookups("coalescing", lookups, sizeof(lookups) / sizeof(*lookups)))
+		return 0;
+
+	if (find_stub_host("one.elinks.test")->queries != 1) {
+		fprintf(stderr, "coalescing: %d queries for one.elinks.test\n",
+			find_stub_host("one.elinks.test")->queries);
+		return 0;
+	}
+
+	return 1;
+}
+
+/* The answer is cached, a failure is reported. */
+static int
+test_cache_and_failure(void)
+{
+	struct lookup cached = { "one.elinks.test", "192.0.2.1" };
+	struct lookup missing[] = {
+		{ "missing.elinks.test", NULL },
+	};
+
+	if (!start_lookup(&cached) || cached.done != 1 || !cached.ok
+	    || find_stub_host("one.elinks.test")->queries != 1) {
+		fprintf(stderr, "cache: one.elinks.test was not cached\n");
+		return 0;
+	}
+
+	start_lookup(&missing[0]);
+	if (!run_loop()) {
+		fprintf(stderr, "failure: timed out\n");
+		return 0;
+	}
+
+	return check_lookups("failure", missing, 1);
+}
+
+/* A worker must not keep the descriptors ELinks had open when it was
+ * forked, or closing them would not close e.g. the connections. */
+static int
+test_inherited_fds(void)
+{
+	struct lookup lookups[] = {
+		{ "w1.elinks.test", "192.0.2.11" },
+		{ "w2.elinks.test", "192.0.2.12" },
+		{ "w3.elinks.test", "192.0.2.13" },
+		{ "w4.elinks.test", "192.0.2.14" },
+	};
+	char c;
+	int p[2];
+	int i;
+
+	if (pipe(p) < 0) return 0;
+
+	/* More names than there are workers yet, so some are forked now. */
+	for (i = 0; i < sizeof(lookups) / sizeof(*lookups); i++)
+		start_lookup(&lookups[i]);
+
+	if (!run_loop()) {
+		fprintf(stderr, "inherited descriptors: timed out\n");
+		return 0;
+	}
+
+	if (!check_lookups("inherited descriptors", lookups, sizeof(lookups) / sizeof(*lookups)))
+		return 0;
+
+	close(p[1]);
+	fcntl(p[0], F_SETFL, O_NONBLOCK);
+	if (read(p[0], &c, 1) != 0) {
+		fprintf(stderr, "inherited descriptors: a worker keeps a pipe open\n");
+		return 0;
+	}
+	close(p[0]);
+
+	return 1;
+}
+
+int
+main(int argc, char **argv)
+{
+	ELOG
+	int ret;
+
+	signal(SIGPIPE, SIG_IGN);
+
+	if (!start_stub_server()) {
+		fprintf(stderr, "Cannot start the stub DNS server.\n");
+		return EXIT_FAILURE;
+	}
+
+	ret = test_coalescing()
+	      && test_cache_and_failure()
+	      && test_inherited_fds();
+
+	shrink_dns_cache(1);
+	done_dns_resolver();
+	while (wait(NULL) > 0);
+
+	return ret ? EXIT_SUCCESS : EXIT_FAILURE;
+}
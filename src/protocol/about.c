@@ -138,6 +138,6 @@ about_protocol_handler(struct connection *conn)
 		mem_free_set(&cached->content_type, stracpy("text/html"));
 	}
 
-	conn->cached = cached;
+	set_connection_cache_entry(conn, cached);
 	abort_connection(conn, connection_state(S_OK));
 }
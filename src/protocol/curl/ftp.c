@@ -612,7 +612,7 @@ ftp_got_data(void *stream, void *buf, size_t len)
 	set_connection_timeout(conn);
 
 	if (!conn->cached) {
-		conn->cached = get_cache_entry(conn->uri);
+		set_connection_cache_entry(conn, get_cache_entry(conn->uri));
 
 		if (!conn->cached) {
 out_of_mem:
@@ -300,7 +300,7 @@ gophers_got_data(void *stream, void *buf, size_t len)
 	set_connection_timeout(conn);
 
 	if (!conn->cached) {
-		conn->cached = get_cache_entry(conn->uri);
+		set_connection_cache_entry(conn, get_cache_entry(conn->uri));
 
 		if (!conn->cached) {
 			abort_connection(conn, connection_state(S_OUT_OF_MEM));
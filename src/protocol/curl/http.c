@@ -457,7 +457,7 @@ http_curl_got_header(void *stream, void *buf, size_t len)
 		}
 
 		if (!conn->cached && http->longcode >= 200L) {
-			conn->cached = get_cache_entry(conn->uri);
+			set_connection_cache_entry(conn, get_cache_entry(conn->uri));
 
 			if (!conn->cached) {
 				abort_connection(conn, connection_state(S_OUT_OF_MEM));
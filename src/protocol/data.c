@@ -130,7 +130,7 @@ data_protocol_handler(struct connection *conn)
 		return;
 	}
 
-	conn->cached = cached;
+	set_connection_cache_entry(conn, cached);
 
 	data_start = parse_data_protocol_header(conn, &base64);
 	if (!data_start) {
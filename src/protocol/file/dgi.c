@@ -353,7 +353,8 @@ dgi_protocol_handler(struct connection *conn)
 
 		/* Try to add fragment data to the connection cache if either
 		 * file reading or directory listing worked out ok. */
-		cached = conn->cached = get_cache_entry(conn->uri);
+		cached = get_cache_entry(conn->uri);
+		set_connection_cache_entry(conn, cached);
 		if (!conn->cached) {
 			state = connection_state(S_OUT_OF_MEM);
 		} else {
@@ -486,7 +487,8 @@ execute_dgi(struct connection *conn)
 
 	/* Try to add fragment data to the connection cache if either
 	 * file reading or directory listing worked out ok. */
-	cached = conn->cached = get_cache_entry(conn->uri);
+	cached = get_cache_entry(conn->uri);
+	set_connection_cache_entry(conn, cached);
 	if (!conn->cached) {
 		state = connection_state(S_OUT_OF_MEM);
 	} else {
@@ -346,7 +346,8 @@ file_protocol_handler(struct connection *connection)
 
 		/* Try to add fragment data to the connection cache if either
 		 * file reading or directory listing worked out ok. */
-		cached = connection->cached = get_cache_entry(connection->uri);
+		cached = get_cache_entry(connection->uri);
+		set_connection_cache_entry(connection, cached);
 		if (!connection->cached) {
 			if (!redirect_location) done_string(&page);
 			state = connection_state(S_OUT_OF_MEM);
@@ -45,7 +45,7 @@ finger_get_response(struct socket *socket, struct read_buffer *rb)
 		abort_connection(conn, connection_state(S_OUT_OF_MEM));
 		return;
 	}
-	conn->cached = cached;
+	set_connection_cache_entry(conn, cached);
 
 	if (socket->state == SOCKET_CLOSED) {
 		abort_connection(conn, connection_state(S_OK));
@@ -474,7 +474,7 @@ fsp_got_header(struct socket *socket, struct read_buffer *rb)
 	struct read_buffer *buf;
 	int error = 0;
 
-	conn->cached = get_cache_entry(conn->uri);
+	set_connection_cache_entry(conn, get_cache_entry(conn->uri));
 	if (!conn->cached) {
 		/* Even though these are pipes rather than real
 		 * sockets, call close_socket instead of close, to
@@ -1066,7 +1066,7 @@ show_fsp_directory(struct connection *conn)
 	char *data = get_uri_string(conn->uri, URI_DATA);
 	char dircolor[8] = "";
 
-	if (!conn->cached) conn->cached = get_cache_entry(conn->uri);
+	if (!conn->cached) set_connection_cache_entry(conn, get_cache_entry(conn->uri));
 	if (!conn->cached) {
 		abort_connection(conn, connection_state(S_OUT_OF_MEM));
 		return;
@@ -1183,7 +1183,7 @@ try_fsp_read_file(void *data)
 		return;
 	}
 
-	if (!conn->cached) conn->cached = get_cache_entry(conn->uri);
+	if (!conn->cached) set_connection_cache_entry(conn, get_cache_entry(conn->uri));
 	if (!conn->cached) {
 		abort_connection(conn, connection_state(S_OUT_OF_MEM));
 		return;
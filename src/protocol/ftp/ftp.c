@@ -354,7 +354,7 @@ prompt_username_pw(struct connection *conn)
 {
 	ELOG
 	if (!conn->cached) {
-		conn->cached = get_cache_entry(conn->uri);
+		set_connection_cache_entry(conn, get_cache_entry(conn->uri));
 		if (!conn->cached) {
 			abort_connection(conn, connection_state(S_OUT_OF_MEM));
 			return;
@@ -1181,7 +1181,7 @@ ftp_got_final_response(struct socket *socket, struct read_buffer *rb)
 		 * File unavailable (e.g., file not found, no access). */
 
 		if (!conn->cached)
-			conn->cached = get_cache_entry(conn->uri);
+			set_connection_cache_entry(conn, get_cache_entry(conn->uri));
 
 		if (!conn->cached
 		    || !redirect_cache(conn->cached, "/", 1, 0)) {
@@ -1538,7 +1538,7 @@ got_something_from_data_connection(struct connection *conn)
 
 	set_connection_timeout(conn);
 
-	if (!conn->cached) conn->cached = get_cache_entry(conn->uri);
+	if (!conn->cached) set_connection_cache_entry(conn, get_cache_entry(conn->uri));
 	if (!conn->cached) {
 out_of_mem:
 		abort_connection(conn, connection_state(S_OUT_OF_MEM));
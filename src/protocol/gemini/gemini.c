@@ -301,7 +301,7 @@ gemini_got_header(struct socket *socket, struct read_buffer *rb)
 		return;
 	}
 	socket->state = SOCKET_END_ONCLOSE;
-	conn->cached = get_cache_entry(conn->uri);
+	set_connection_cache_entry(conn, get_cache_entry(conn->uri));
 
 	a = get_header(rb);
 	if (a == -1) {
@@ -342,8 +342,10 @@ gemini_got_header(struct socket *socket, struct read_buffer *rb)
 			return;
 		}
 		if (conn->cached) {
-			delete_cache_entry(conn->cached);
-			conn->cached = NULL;
+			struct cache_entry *cached = conn->cached;
+
+			set_connection_cache_entry(conn, NULL);
+			delete_cache_entry(cached);
 		}
 	} else {
 		struct string head_string;
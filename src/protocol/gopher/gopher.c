@@ -714,7 +714,7 @@ init_gopher_cache_entry(struct connection *conn)
 
 	if (!cached) return NULL;
 
-	conn->cached = cached;
+	set_connection_cache_entry(conn, cached);
 
 	if (!cached->content_type
 	    && gopher
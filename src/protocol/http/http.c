@@ -743,7 +743,7 @@ http_send_header(struct socket *socket)
 		return;
 	}
 
-	if (!conn->cached) conn->cached = find_in_cache(uri);
+	if (!conn->cached) set_connection_cache_entry(conn, find_in_cache(uri));
 
 	talking_to_proxy = IS_PROXY_URI(conn->uri) && !conn->socket->ssl;
 	use_connect = connection_is_https_proxy(conn) && !conn->socket->ssl;
@@ -1126,19 +1126,81 @@ http_send_header(struct socket *socket)
 #undef POST_BUFFER_SIZE
 
 
+/* Decoded data are written straight to the end of the cache entry where
+ * possible. When the data do not go at the end of the last fragment (the
+ * first chunk or a reload overwriting older data) they pass through a
+ * window which is reused for all connections. */
+struct http_decoding_sink {
+	struct connection *conn;
+	off_t offset;
+	unsigned int in_window:1;
+};
+
+static char http_decode_window[HTTP_DECODE_WINDOW_SIZE];
+
 static char *
+http_sink_reserve(void *data, int size, int *avail)
+{
+	ELOG
+	struct http_decoding_sink *sink = (struct http_decoding_sink *)data;
+	ssize_t room;
+	char *tail = get_fragment_tail(sink->conn->cached, sink->offset,
+				       size, &room);
+
+	sink->in_window = !tail;
+	if (!tail) {
+		*avail = HTTP_DECODE_WINDOW_SIZE;
+		return http_decode_window;
+	}
+
+	*avail = (int) MIN(room, INT_MAX);
+	return tail;
+}
+
+static int
+http_sink_commit(void *data, int len)
+{
+	ELOG
+	struct http_decoding_sink *sink = (struct http_decoding_sink *)data;
+	struct connection *conn = sink->conn;
+	int ret;
+
+	if (sink->in_window)
+		ret = add_fragment(conn->cached, sink->offset,
+				   http_decode_window, len);
+	else
+		ret = commit_fragment_tail(conn->cached, sink->offset, len);
+
+	if (ret < 0) return -1;
+	if (ret == 1) conn->tries = 0;
+
+	sink->offset += len;
+	return 0;
+}
+
+/* Decodes @len bytes of @data into the cache entry at conn->from. The number
+ * of bytes added to the entry is stored in *@new_len. Returns -1 on error. */
+static int
 decompress_data(struct connection *conn, char *data, int len,
 		int *new_len)
 {
 	ELOG
-	*new_len = 0; /* new_len must be zero if we would ever return NULL */
+	struct http_decoding_sink sink_data = { conn, conn->from, 0 };
+	struct decoding_sink sink = { http_sink_reserve, http_sink_commit, &sink_data };
+	int ret;
+
+	*new_len = 0;
 
 	if (!conn->stream) {
 		conn->stream = open_encoded(-1, conn->content_encoding);
-		if (!conn->stream) return NULL;
+		if (!conn->stream) return -1;
 	}
 
-	return decode_encoded_buffer(conn->stream, conn->content_encoding, data, len, new_len);
+	ret = decode_encoded_to(conn->stream, data, len, &sink);
+
+	/* Whatever got to the cache before an error stays there. */
+	*new_len = sink_data.offset - conn->from;
+	return ret;
 }
 
 static int
@@ -1281,12 +1343,8 @@ read_chunked_http_data(struct connection *conn, struct read_buffer *rb)
 				if (add_fragment(conn->cached, conn->from, rb->data, len) == 1)
 					conn->tries = 0;
 			} else {
-				char *data = decompress_data(conn, rb->data, len, &data_len);
+				decompress_data(conn, rb->data, len, &data_len);
 
-				if (add_fragment(conn->cached, conn->from, data, data_len) == 1)
-					conn->tries = 0;
-
-				mem_free_if(data);
 				if (zero || !http->length) shutdown_connection_stream(conn);
 			}
 
@@ -1350,20 +1408,16 @@ read_normal_http_data(struct connection *conn, struct read_buffer *rb)
 		if (add_fragment(conn->cached, conn->from, rb->data, data_len) == 1)
 			conn->tries = 0;
 	} else {
-		char *data;
+		int ret;
 finish:
-		data = decompress_data(conn, rb->data, len, &data_len);
+		ret = decompress_data(conn, rb->data, len, &data_len);
 
-		if (!data && !http->length && len) {
+		if (ret < 0 && !data_len && !http->length && len) {
 			kill_buffer_data(rb, len);
 			len = 0;
 			goto finish;
 		}
 
-		if (add_fragment(conn->cached, conn->from, data, data_len) == 1)
-			conn->tries = 0;
-
-		mem_free_if(data);
 		if (!http->length) shutdown_connection_stream(conn);
 	}
 
@@ -1513,6 +1567,69 @@ check_http_authentication(struct connection *conn, struct uri *uri,
 }
 
 
+/* Sets the expiration of @cached according to the Expires, Pragma and
+ * Cache-Control headers in @head. */
+static void
+set_cache_expiration(struct cache_entry *cached, char *head)
+{
+	ELOG
+	char *d;
+
+	/* I am not entirely sure in what order we should process these
+	 * headers and if we should still process Cache-Control max-age
+	 * if we already set max age to date mentioned in Expires.
+	 * --jonas */
+	/* Ensure that when ever cached->max_age is set, cached->expired
+	 * is also set, so the cache management knows max_age contains a
+	 * valid time. If on the other hand no caching is requested
+	 * cached->expire should be set to zero.  */
+	if ((d = parse_header(head, "Expires", NULL))) {
+		/* Convert date to seconds. */
+		time_t expires = parse_date(&d, NULL, 0, 1);
+
+		mem_free(d);
+
+		if (expires && cached->cache_mode != CACHE_MODE_NEVER) {
+			timeval_from_seconds(&cached->max_age, expires);
+			cached->expire = 1;
+		}
+	}
+
+	if ((d = parse_header(head, "Pragma", NULL))) {
+		if (strstr(d, "no-cache")) {
+			cached->cache_mode = CACHE_MODE_NEVER;
+			cached->expire = 0;
+		}
+		mem_free(d);
+	}
+
+	if (cached->cache_mode != CACHE_MODE_NEVER
+	    && (d = parse_header(head, "Cache-Control", NULL))) {
+		if (strstr(d, "no-cache") || strstr(d, "must-revalidate")) {
+			cached->cache_mode = CACHE_MODE_NEVER;
+			cached->expire = 0;
+
+		} else  {
+			char *pos = strstr(d, "max-age=");
+
+			assert(cached->cache_mode != CACHE_MODE_NEVER);
+
+			if (pos) {
+				/* Grab the number of seconds. */
+				timeval_T max_age;
+
+				timeval_from_seconds(&max_age, atol(pos + 8));
+				timeval_now(&cached->max_age);
+				timeval_add_interval(&cached->max_age, &max_age);
+
+				cached->expire = 1;
+			}
+		}
+
+		mem_free(d);
+	}
+}
+
 void
 http_got_header(struct socket *socket, struct read_buffer *rb)
 {
@@ -1628,6 +1745,13 @@ again:
 		return;
 	}
 	if (h == 304) {
+		/* The cached document was revalidated, so take over the new
+		 * expiration time, if any. */
+		if (conn->cached) {
+			if (!get_opt_bool("document.cache.ignore_cache_control", NULL))
+				set_cache_expiration(conn->cached, head);
+			conn->cached->seconds = time(NULL);
+		}
 		mem_free(head);
 		http_end_request(conn, connection_state(S_OK), 1);
 		return;
@@ -1648,7 +1772,7 @@ again:
 		return;
 	}
 
-	conn->cached = get_cache_entry(conn->uri);
+	set_connection_cache_entry(conn, get_cache_entry(conn->uri));
 	if (!conn->cached) {
 		mem_free(head);
 		abort_connection(conn, connection_state(S_OUT_OF_MEM));
@@ -1657,63 +1781,8 @@ again:
 	conn->cached->cgi = conn->cgi;
 	mem_free_set(&conn->cached->head, head);
 
-	if (!get_opt_bool("document.cache.ignore_cache_control", NULL)) {
-		struct cache_entry *cached = conn->cached;
-
-		/* I am not entirely sure in what order we should process these
-		 * headers and if we should still process Cache-Control max-age
-		 * if we already set max age to date mentioned in Expires.
-		 * --jonas */
-		/* Ensure that when ever cached->max_age is set, cached->expired
-		 * is also set, so the cache management knows max_age contains a
-		 * valid time. If on the other hand no caching is requested
-		 * cached->expire should be set to zero.  */
-		if ((d = parse_header(cached->head, "Expires", NULL))) {
-			/* Convert date to seconds. */
-			time_t expires = parse_date(&d, NULL, 0, 1);
-
-			mem_free(d);
-
-			if (expires && cached->cache_mode != CACHE_MODE_NEVER) {
-				timeval_from_seconds(&cached->max_age, expires);
-				cached->expire = 1;
-			}
-		}
-
-		if ((d = parse_header(cached->head, "Pragma", NULL))) {
-			if (strstr(d, "no-cache")) {
-				cached->cache_mode = CACHE_MODE_NEVER;
-				cached->expire = 0;
-			}
-			mem_free(d);
-		}
-
-		if (cached->cache_mode != CACHE_MODE_NEVER
-		    && (d = parse_header(cached->head, "Cache-Control", NULL))) {
-			if (strstr(d, "no-cache") || strstr(d, "must-revalidate")) {
-				cached->cache_mode = CACHE_MODE_NEVER;
-				cached->expire = 0;
-
-			} else  {
-				char *pos = strstr(d, "max-age=");
-
-				assert(cached->cache_mode != CACHE_MODE_NEVER);
-
-				if (pos) {
-					/* Grab the number of seconds. */
-					timeval_T max_age;
-
-					timeval_from_seconds(&max_age, atol(pos + 8));
-					timeval_now(&cached->max_age);
-					timeval_add_interval(&cached->max_age, &max_age);
-
-					cached->expire = 1;
-				}
-			}
-
-			mem_free(d);
-		}
-	}
+	if (!get_opt_bool("document.cache.ignore_cache_control", NULL))
+		set_cache_expiration(conn->cached, conn->cached->head);
 
 	/* XXX: Is there some reason why NOT to follow the Location header
 	 * for any status? If the server didn't mean it, it wouldn't send
@@ -174,7 +174,7 @@ init_nntp_connection_info(struct connection *conn)
 		if (!groupend) {
 			struct connection_state state = connection_state(S_OK);
 
-			conn->cached = get_cache_entry(conn->uri);
+			set_connection_cache_entry(conn, get_cache_entry(conn->uri));
 			if (!conn->cached
 			    || !redirect_cache(conn->cached, "/", 0, 0))
 				state = connection_state(S_OUT_OF_MEM);
@@ -607,7 +607,7 @@ news_protocol_handler(struct connection *conn)
 		return;
 	}
 
-	conn->cached = get_cache_entry(conn->uri);
+	set_connection_cache_entry(conn, get_cache_entry(conn->uri));
 	if (!conn->cached || !init_string(&location)) {
 		abort_connection(conn, connection_state(S_OUT_OF_MEM));
 		return;
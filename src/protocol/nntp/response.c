@@ -104,7 +104,7 @@ init_nntp_header(struct connection *conn, struct read_buffer *rb)
 	struct nntp_connection_info *nntp = (struct nntp_connection_info *)conn->info;
 
 	if (!conn->cached) {
-		conn->cached = get_cache_entry(conn->uri);
+		set_connection_cache_entry(conn, get_cache_entry(conn->uri));
 		if (!conn->cached) return connection_state(S_OUT_OF_MEM);
 
 	} else if (conn->cached->head || conn->cached->content_type) {
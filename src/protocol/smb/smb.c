@@ -97,7 +97,7 @@ smb_get_cache(struct connection *conn)
 {
 	if (conn->cached) return 0;
 
-	conn->cached = get_cache_entry(conn->uri);
+	set_connection_cache_entry(conn, get_cache_entry(conn->uri));
 	if (conn->cached) return 0;
 
 	abort_connection(conn, connection_state(S_OUT_OF_MEM));
@@ -301,7 +301,7 @@ spartan_got_header(struct socket *socket, struct read_buffer *rb)
 		return;
 	}
 	socket->state = SOCKET_END_ONCLOSE;
-	conn->cached = get_cache_entry(conn->uri);
+	set_connection_cache_entry(conn, get_cache_entry(conn->uri));
 
 	a = get_header(rb);
 	if (a == -1) {
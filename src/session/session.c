@@ -31,6 +31,9 @@
 #include "document/view.h"
 #include "globhist/globhist.h"
 #include "intl/libintl.h"
+#if defined(CONFIG_ECMASCRIPT_SMJS) || defined(CONFIG_QUICKJS) || defined(CONFIG_MUJS)
+#include "js/ecmascript-c.h"
+#endif
 #include "main/event.h"
 #include "main/object.h"
 #include "main/timer.h"
@@ -1653,6 +1656,9 @@ tabwin_func(struct window *tab, struct term_event *ev)
 			if (!ses || ses->tab != get_current_tab(ses->tab->term))
 				break;
 
+#if defined(CONFIG_ECMASCRIPT_SMJS) || defined(CONFIG_QUICKJS) || defined(CONFIG_MUJS)
+			ecmascript_show_rerenders(ses);
+#endif
 			draw_formatted(ses, tab->resize);
 			if (tab->resize) {
 				load_frames(ses, ses->doc_view);
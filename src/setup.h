@@ -30,14 +30,23 @@
 #define DISALLOWED_ECMASCRIPT_URL_PREFIXES	"disallow.txt"
 
 #define DNS_CACHE_TIMEOUT		3600	/* in seconds */
+#define DNS_NEGATIVE_CACHE_TIMEOUT	60	/* in seconds */
+#define DNS_NEGATIVE_CACHE_SIZE		256
+#define DNS_RESOLVER_WORKERS		4
+
+#define CONNECT_ATTEMPT_DELAY		((milliseconds_T) 250) /* RFC 8305 */
+#define IPV4_FIRST_HOSTS		256
 
 #define HTTP_KEEPALIVE_TIMEOUT		60000
 #define FTP_KEEPALIVE_TIMEOUT		600000
 #define NNTP_KEEPALIVE_TIMEOUT		600000
-#define MAX_KEEPALIVE_CONNECTIONS	30
 #define KEEPALIVE_CHECK_TIME		((milliseconds_T) 20000)
+#define MAX_HOST_CONNECTION_STATS	64 /* hosts without connections */
 
 #define MAX_REDIRECTS			10
+#define HTTP_DECODE_WINDOW_SIZE		16384
+
+#define MAX_PARSED_CSS_SHEETS		32
 
 #define MEMORY_CACHE_GC_PERCENT		90
 #define MAX_CACHED_OBJECT_PERCENT	25
@@ -129,6 +138,9 @@
 
 #define REQUEST_ANIMATION_FRAME		((milliseconds_T) 20)
 
+/* Bytes of encoded sixel frames kept for drawing them again */
+#define SIXEL_FRAME_CACHE_SIZE		(8 * 1024 * 1024)
+
 /* Either 3 or 4 */
 #define KITTY_BYTES_PER_PIXEL	4
 //#define ECMASCRIPT_DEBUG 1
@@ -33,6 +33,7 @@
 #include "util/bitfield.h"
 #include "util/conv.h"
 #include "util/error.h"
+#include "util/math.h"
 #include "util/memory.h"
 #include "util/string.h"
 
@@ -284,6 +285,8 @@ struct screen_driver_opt {
 #ifdef CONFIG_LIBSIXEL
 	unsigned int sixel:1;
 #endif
+	/* Whether to move unchanged rows with the scroll region. */
+	unsigned int scroll_region:1;
 };
 
 /** Used in @c add_char*() and @c redraw_screen() to reduce the logic.
@@ -330,6 +333,7 @@ static const struct screen_driver_opt dumb_screen_driver_opt = {
 #ifdef CONFIG_LIBSIXEL
 	/* sixel */		0,
 #endif
+	/* scroll_region */	0,
 };
 
 /** Default options for ::TERM_VT100.  */
@@ -357,6 +361,7 @@ static const struct screen_driver_opt vt100_screen_driver_opt = {
 #ifdef CONFIG_LIBSIXEL
 	/* sixel */		0,
 #endif
+	/* scroll_region */	1,
 };
 
 /** Default options for ::TERM_LINUX.  */
@@ -384,6 +389,7 @@ static const struct screen_driver_opt linux_screen_driver_opt = {
 #ifdef CONFIG_LIBSIXEL
 	/* sixel */		0,
 #endif
+	/* scroll_region */	1,
 };
 
 /** Default options for ::TERM_KOI8.  */
@@ -411,6 +417,7 @@ static const struct screen_driver_opt koi8_screen_driver_opt = {
 #ifdef CONFIG_LIBSIXEL
 	/* sixel */		0,
 #endif
+	/* scroll_region */	1,
 };
 
 /** Default options for ::TERM_FREEBSD.  */
@@ -438,6 +445,7 @@ static const struct screen_driver_opt freebsd_screen_driver_opt = {
 #ifdef CONFIG_LIBSIXEL
 	/* sixel */		0,
 #endif
+	/* scroll_region */	0,
 };
 
 /** Default options for ::TERM_FBTERM.  */
@@ -465,6 +473,7 @@ static const struct screen_driver_opt fbterm_screen_driver_opt = {
 #ifdef CONFIG_LIBSIXEL
 	/* sixel */		0,
 #endif
+	/* scroll_region */	1,
 };
 
 /** Default options for all the different types of terminals.
@@ -482,6 +491,10 @@ static const struct screen_driver_opt *const screen_driver_opts[] = {
 
 static INIT_LIST_OF(struct screen_driver, active_screen_drivers);
 
+/* Statistics of what redraw_screen() sent to the terminals. */
+static long screen_frames;
+static unsigned longlong screen_bytes;
+
 void
 set_screen_dirty(struct terminal_screen *screen, int from, int to)
 {
@@ -506,6 +519,20 @@ set_screen_dirty_image(struct terminal_screen *screen, int from, int to)
 	screen->was_dirty = 1;
 }
 
+int
+is_screen_drawn(struct terminal_screen *screen, int from, int to)
+{
+	ELOG
+	int i;
+
+	for (i = from; i <= to; i++) {
+		if (test_bitfield_bit(screen->drawn, i))
+			return 1;
+	}
+
+	return 0;
+}
+
 #include <stdio.h>
 
 /** Set screen_driver.opt according to screen_driver.type and @a term_spec.
@@ -623,6 +650,21 @@ set_screen_driver_opt(struct screen_driver *driver, struct option *term_spec)
 #ifdef CONFIG_TERMINFO
 	driver->opt.terminfo = get_cmd_opt_bool("terminfo");
 #endif
+
+	/* Dumb and FreeBSD terminals have no scroll region.  The images
+	 * drawn over the text would move with it, and terminfo is used for
+	 * terminals we know nothing about. */
+	if (!get_opt_bool_tree(term_spec, "scroll_region", NULL))
+		driver->opt.scroll_region = 0;
+#ifdef CONFIG_TERMINFO
+	if (driver->opt.terminfo) driver->opt.scroll_region = 0;
+#endif
+#ifdef CONFIG_KITTY
+	if (driver->opt.kitty) driver->opt.scroll_region = 0;
+#endif
+#ifdef CONFIG_LIBSIXEL
+	if (driver->opt.sixel) driver->opt.scroll_region = 0;
+#endif
 }
 
 static int
@@ -1015,11 +1057,15 @@ add_char16(struct string *screen, struct screen_driver *driver,
 #endif /* CONFIG_UTF8 */
 	    (!compare_color_16(ch->c.color, state->color)
 	     || ch->is_default_fg_color != state->is_default_fg_color
-	     || ch->is_default_bg_color != state->is_default_bg_color)
+	     || ch->is_default_bg_color != state->is_default_bg_color
+	     /* Without colors, highlighting is all there is. */
+	     || (driver->opt.color_mode == COLOR_MODE_MONO
+		 && ((ch->attr ^ state->attr) & SCREEN_ATTR_STANDOUT)))
 	   ) {
 		copy_color_16(state->color, ch->c.color);
 		state->is_default_fg_color = ch->is_default_fg_color;
 		state->is_default_bg_color = ch->is_default_bg_color;
+		state->attr = ch->attr;
 
 #ifdef CONFIG_TERMINFO
 		if (driver->opt.terminfo) {
@@ -1537,6 +1583,43 @@ add_char_true(struct string *screen, struct screen_driver *driver,
 }
 #endif
 
+/** Moves the cursor from column @a cursor of the line to @a x, either with
+ * a cursor move or by sending the chars between them again, whichever is
+ * shorter.  With @a cursor -1 the cursor is not on the line yet. */
+#define add_chars_gap(image_, driver_, state_, ADD_CHAR, line, y, cursor, x)	\
+{										\
+	int length = (image_)->length;						\
+	int move;								\
+										\
+	add_cursor_move_to_string(image_, (y) + 1, (x) + 1);			\
+	move = (image_)->length - length;					\
+										\
+	/* Every char takes at least one byte. */				\
+	if ((cursor) >= 0 && (x) - (cursor) <= move) {				\
+		struct screen_state saved_state = *(state_);			\
+		int gap;							\
+										\
+		(image_)->length = length;					\
+		for (gap = (cursor); gap < (x); gap++)				\
+			ADD_CHAR(image_, driver_, &(line)[gap], state_);	\
+										\
+		if ((image_)->length - length > move) {				\
+			(image_)->length = length;				\
+			*(state_) = saved_state;				\
+			add_cursor_move_to_string(image_, (y) + 1, (x) + 1);	\
+		}								\
+		(image_)->source[(image_)->length] = '\0';			\
+	}									\
+}
+
+#ifdef CONFIG_UTF8
+/** The second cell of a double-width char sends nothing, so a change of it
+ * has to be sent from the first one. */
+#define is_second_cell(driver_, ch)	((driver_)->opt.utf8_cp && (ch)->data == UCS_NO_CHAR)
+#else
+#define is_second_cell(driver_, ch)	0
+#endif
+
 #define add_chars(image_, term_, driver_, state_, ADD_CHAR, compare_bg_color, compare_fg_color)			\
 {										\
 	struct terminal_screen *screen = (term_)->screen;			\
@@ -1546,39 +1629,17 @@ add_char_true(struct string *screen, struct screen_driver *driver,
 										\
 	for (; y <= ymax; y++) {					\
 		int dirty = test_bitfield_bit(screen->dirty_image, y);						\
+		clear_bitfield_bit(screen->drawn, y);				\
 		if (!dirty && !test_bitfield_bit(screen->dirty, y)) continue;		\
 		int ypos = y * (term_)->width;					\
 		struct screen_char *current = &screen->last_image[ypos];	\
-		struct screen_char *pos = &screen->image[ypos];			\
-		struct screen_char *start_of_line = pos;			\
-		int is_last_line = (y == ymax);					\
-		int x = 0;						\
+		struct screen_char *line = &screen->image[ypos];		\
+		int xend = xmax;					\
+		int cursor = -1;					\
+		int x;							\
 		clear_bitfield_bit(screen->dirty, y);				\
 		clear_bitfield_bit(screen->dirty_image, y);				\
 										\
-		if (!dirty) for (; x <= xmax; x++, current++, pos++) {			\
-			if (compare_bg_color(pos->c.color, current->c.color)) {	\
-				/* No update for exact match. */		\
-				if (compare_fg_color(pos->c.color, current->c.color)\
-				    && pos->data == current->data		\
-				    && pos->attr == current->attr)		\
-					continue;				\
-										\
-				/* Else if the color match and the data is
-				 * ``space''. */				\
-				if (pos->data <= ' ' && current->data <= ' '	\
-				    && pos->attr == current->attr)		\
-					continue;				\
-			}							\
-			dirty = 1;						\
-			break;							\
-		}								\
-										\
-		if (!dirty) {							\
-			continue;						\
-		}								\
-		add_cursor_move_to_string(image_, y + 1, 1);			\
-																\
 		/*  Workaround for terminals without
 		 *  "eat_newline_glitch (xn)", e.g., the cons25 family
 		 *  of terminals and cygwin terminal.
@@ -1587,15 +1648,194 @@ add_char_true(struct string *screen, struct screen_driver *driver,
 		 *  A better fix would be to correctly detects
 		 *  terminal type, and/or add a terminal option for
 		 *  this purpose. */					\
-		if (is_last_line) {	\
-			xmax--;	\
+		if (y == ymax) {	\
+			xend--;	\
 		}	\
-		for (pos = start_of_line, x = 0; x <= xmax; x++, pos++) {	\
-			ADD_CHAR(image_, driver_, pos, state_);	\
-		}							\
+										\
+		/* Lines with images are sent whole, others only the chars
+		 * which changed. */					\
+		for (x = 0; x <= xend; x++) {				\
+			struct screen_char *pos = &line[x];			\
+										\
+			if (!dirty && compare_bg_color(pos->c.color, current[x].c.color)) {	\
+				/* No update for exact match. */		\
+				if (compare_fg_color(pos->c.color, current[x].c.color)\
+				    && pos->data == current[x].data		\
+				    && pos->attr == current[x].attr)		\
+					continue;				\
+										\
+				/* Else if the color match and the data is
+				 * ``space''. */				\
+				if (pos->data <= ' ' && current[x].data <= ' '	\
+				    && pos->attr == current[x].attr)		\
+					continue;				\
+			}							\
+										\
+			if (cursor != x) {					\
+				if (x > 0 && is_second_cell(driver_, pos))	\
+					pos = &line[--x];			\
+				add_chars_gap(image_, driver_, state_, ADD_CHAR, line, y, cursor, x);	\
+			}							\
+			ADD_CHAR(image_, driver_, pos, state_);		\
+			cursor = x + 1;						\
+		}								\
+										\
+		if (cursor >= 0)					\
+			set_bitfield_bit(screen->drawn, y);		\
+		copy_screen_chars(current, line, (term_)->width);		\
 	}								\
 }
 
+/** Compares the same things as add_chars() does for an exact match. */
+static inline int
+screen_rows_equal(struct screen_char *a, struct screen_char *b, int width)
+{
+	//ELOG
+	int x;
+
+	for (x = 0; x < width; x++) {
+		if (a[x].data != b[x].data || a[x].attr != b[x].attr
+		    || memcmp(a[x].c.color, b[x].c.color, SCREEN_COLOR_SIZE))
+			return 0;
+	}
+
+	return 1;
+}
+
+static inline unsigned int
+hash_screen_row(struct screen_char *line, int width)
+{
+	//ELOG
+	unsigned int hash = 0;
+	int x;
+
+	for (x = 0; x < width; x++) {
+		int i;
+
+		hash = hash * 31 + line[x].data;
+		hash = hash * 31 + line[x].attr;
+		for (i = 0; i < SCREEN_COLOR_SIZE; i++)
+			hash = hash * 31 + line[x].c.color[i];
+	}
+
+	return hash;
+}
+
+static inline int
+screen_row_changed(struct terminal_screen *screen, int width, int y)
+{
+	//ELOG
+	if (!test_bitfield_bit(screen->dirty, y)) return 0;
+
+	return !screen_rows_equal(&screen->image[y * width],
+				  &screen->last_image[y * width], width);
+}
+
+/** Looks for the rows which have only moved up or down since the last
+ * redraw, e.g. when a document was scrolled.  If there are more of them
+ * than of the rows which stayed in place, the changed part of the screen
+ * is scrolled by the terminal and screen->last_image with it, so that
+ * add_chars() sends only the newly exposed rows. */
+static void
+add_scroll_to_string(struct string *image, struct terminal *term)
+{
+	//ELOG
+	struct terminal_screen *screen = term->screen;
+	int width = term->width;
+	unsigned int *hash, *last_hash;
+	int top, bottom, height;
+	int y, shift, best_shift = 0, best_rows = 0;
+
+	/* The rows which did not change must not move.  Neither does the
+	 * last one, whose last char add_chars() never draws. */
+	for (top = 0; top < term->height - 1; top++)
+		if (screen_row_changed(screen, width, top))
+			break;
+	for (bottom = term->height - 2; bottom > top; bottom--)
+		if (screen_row_changed(screen, width, bottom))
+			break;
+
+	height = bottom - top + 1;
+	if (height < 3) return;
+
+	for (y = top; y <= bottom; y++)
+		if (test_bitfield_bit(screen->dirty_image, y))
+			return;
+
+	hash = (unsigned int *)fmem_alloc(2 * height * sizeof(*hash));
+	if (!hash) return;
+	last_hash = hash + height;
+
+	for (y = 0; y < height; y++) {
+		int ypos = (top + y) * width;
+
+		hash[y] = hash_screen_row(&screen->image[ypos], width);
+		last_hash[y] = hash_screen_row(&screen->last_image[ypos], width);
+	}
+
+	/* Row y of the new image is row y + shift of the last one. */
+	for (shift = 1 - height; shift < height; shift++) {
+		int rows = 0;
+
+		for (y = int_max(0, -shift); y < int_min(height, height - shift); y++) {
+			int ypos = (top + y) * width;
+
+			if (hash[y] == last_hash[y + shift]
+			    && screen_rows_equal(&screen->image[ypos],
+						 &screen->last_image[ypos + shift * width],
+						 width))
+				rows++;
+		}
+
+		if (rows > best_rows || (!shift && rows == best_rows)) {
+			best_rows = rows;
+			best_shift = shift;
+		}
+	}
+
+	fmem_free(hash);
+
+	if (!best_shift) return;
+
+	add_bytes_to_string(image, "\033[", 2);
+	add_long_to_string(image, top + 1);
+	add_char_to_string(image, ';');
+	add_long_to_string(image, bottom + 1);
+	add_char_to_string(image, 'r');
+
+	if (best_shift > 0) {
+		struct screen_char *first = &screen->last_image[top * width];
+
+		/* Index at the bottom margin scrolls the region up. */
+		add_cursor_move_to_string(image, bottom + 1, 1);
+		for (y = 0; y < best_shift; y++)
+			add_bytes_to_string(image, "\033D", 2);
+
+		memmove(first, first + best_shift * width,
+			(height - best_shift) * width * sizeof(*first));
+		memset(first + (height - best_shift) * width, 0xFF,
+		       best_shift * width * sizeof(*first));
+	} else {
+		struct screen_char *first = &screen->last_image[top * width];
+
+		/* Reverse index at the top margin scrolls it down. */
+		add_cursor_move_to_string(image, top + 1, 1);
+		for (y = 0; y < -best_shift; y++)
+			add_bytes_to_string(image, "\033M", 2);
+
+		memmove(first - best_shift * width, first,
+			(height + best_shift) * width * sizeof(*first));
+		memset(first, 0xFF, -best_shift * width * sizeof(*first));
+	}
+
+	/* Reset the region, which also homes the cursor. */
+	add_bytes_to_string(image, "\033[r", 3);
+
+	/* The rows which were not changed in the image may have moved
+	 * on the terminal. */
+	set_screen_dirty(screen, top, bottom);
+}
+
 #include <stdio.h>
 
 /*! Updating of the terminal screen is done by checking what needs to
@@ -1617,6 +1857,9 @@ redraw_screen(struct terminal *term)
 
 	if (!init_string(&image)) return;
 
+	if (driver->opt.scroll_region)
+		add_scroll_to_string(&image, term);
+
 	switch (driver->opt.color_mode) {
 	default:
 		/* If the desired color mode was not compiled in,
@@ -1684,14 +1927,30 @@ redraw_screen(struct terminal *term)
 		if (term->master) want_draw();
 		hard_write(term->fdout, image.source, image.length);
 		if (term->master) done_draw();
+
+		screen_frames++;
+		screen_bytes += image.length;
 	}
 
 	done_string(&image);
 
-	copy_screen_chars(screen->last_image, screen->image, term->width * term->height);
 	screen->was_dirty = 0;
 }
 
+long
+get_screen_frames(void)
+{
+	ELOG
+	return screen_frames;
+}
+
+unsigned longlong
+get_screen_bytes(void)
+{
+	ELOG
+	return screen_bytes;
+}
+
 void
 erase_screen(struct terminal *term)
 {
@@ -1762,6 +2021,10 @@ resize_screen(struct terminal *term, int width, int height)
 		struct bitfield *new_dirty_image = init_bitfield(height);
 		if (!new_dirty_image) return;
 		mem_free_set(&screen->dirty_image, new_dirty_image);
+
+		struct bitfield *new_drawn = init_bitfield(height);
+		if (!new_drawn) return;
+		mem_free_set(&screen->drawn, new_drawn);
 	}
 
 	bsize = size * sizeof(*image);
@@ -1788,6 +2051,7 @@ done_screen(struct terminal_screen *screen)
 	mem_free_if(screen->image);
 	mem_free_if(screen->dirty);
 	mem_free_if(screen->dirty_image);
+	mem_free_if(screen->drawn);
 	mem_free(screen);
 }
 
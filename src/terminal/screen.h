@@ -28,12 +28,18 @@ struct terminal_screen {
 
 	struct bitfield *dirty;
 	struct bitfield *dirty_image;
+	/** The rows to which the last redraw sent some chars. */
+	struct bitfield *drawn;
 };
 
 /** Mark the screen ready for redrawing. */
 void set_screen_dirty(struct terminal_screen *screen, int from, int to);
 void set_screen_dirty_image(struct terminal_screen *screen, int from, int to);
 
+/** Checks whether the last redraw sent chars to any of the rows, which
+ * might have overwritten what was drawn over them before. */
+int is_screen_drawn(struct terminal_screen *screen, int from, int to);
+
 /** Initializes a screen. Returns NULL upon allocation failure. */
 struct terminal_screen *init_screen(void);
 
@@ -47,6 +53,11 @@ void resize_screen(struct terminal *term, int x, int y);
 /** Updates the terminal screen. */
 void redraw_screen(struct terminal *term);
 
+/** Returns how many updates redraw_screen() sent and how many bytes
+ * they took. */
+long get_screen_frames(void);
+unsigned longlong get_screen_bytes(void);
+
 /** Erases the entire screen and moves the cursor to the upper left corner. */
 void erase_screen(struct terminal *term);
 
@@ -42,6 +42,7 @@
 #include "terminal/image.h"
 #include "terminal/screen.h"
 #include "terminal/sixel.h"
+#include "terminal/sixel2.h"
 #include "terminal/terminal.h"
 #include "util/memcount.h"
 
@@ -786,6 +787,123 @@ end:
 }
 
 
+/** An encoded part of a document image.  The same parts are drawn again
+ * after every change of the screen, so they are kept, the most recently
+ * used first, up to SIXEL_FRAME_CACHE_SIZE bytes. */
+struct sixel_frame {
+	LIST_HEAD_EL(struct sixel_frame);
+
+	unsigned int id;
+	int x, y, w, h;
+	int cell_width, cell_height;
+	int width, height;
+	struct string pixels;
+};
+
+static INIT_LIST_OF(struct sixel_frame, sixel_frames);
+static size_t sixel_frames_size;
+
+static long sixel_frames_encoded;
+static long sixel_frames_cached;
+static unsigned longlong sixel_bytes_sent;
+static unsigned longlong sixel_bytes_saved;
+
+static void
+done_sixel_frame(struct sixel_frame *frame)
+{
+	ELOG
+	sixel_frames_size -= frame->pixels.length;
+	del_from_list(frame);
+	done_string(&frame->pixels);
+	mem_free(frame);
+}
+
+/** Finds the frame cut the way @dest says and copies its encoded pixels
+ * and size to @dest. */
+static int
+get_cached_sixel_frame(struct image *dest, int cell_width, int cell_height)
+{
+	ELOG
+	struct sixel_frame *frame;
+
+	foreach (frame, sixel_frames) {
+		if (frame->id != dest->id
+		    || frame->x != dest->x || frame->y != dest->y
+		    || frame->w != dest->w || frame->h != dest->h
+		    || frame->cell_width != cell_width
+		    || frame->cell_height != cell_height)
+			continue;
+
+		if (!add_string_to_string(&dest->pixels, &frame->pixels))
+			return 0;
+		dest->width = frame->width;
+		dest->height = frame->height;
+
+		move_to_top_of_list(sixel_frames, frame);
+		sixel_frames_cached++;
+		return 1;
+	}
+
+	return 0;
+}
+
+static void
+cache_sixel_frame(struct image *dest, int cell_width, int cell_height)
+{
+	ELOG
+	struct sixel_frame *frame;
+
+	sixel_frames_encoded++;
+	if (!dest->pixels.length || dest->pixels.length > SIXEL_FRAME_CACHE_SIZE)
+		return;
+
+	frame = (struct sixel_frame *)mem_calloc(1, sizeof(*frame));
+	if (!frame) return;
+
+	if (!init_string(&frame->pixels)
+	    || !add_string_to_string(&frame->pixels, &dest->pixels)) {
+		done_string(&frame->pixels);
+		mem_free(frame);
+		return;
+	}
+	frame->id = dest->id;
+	frame->x = dest->x;
+	frame->y = dest->y;
+	frame->w = dest->w;
+	frame->h = dest->h;
+	frame->cell_width = cell_width;
+	frame->cell_height = cell_height;
+	frame->width = dest->width;
+	frame->height = dest->height;
+
+	add_to_list(sixel_frames, frame);
+	sixel_frames_size += frame->pixels.length;
+
+	while (sixel_frames_size > SIXEL_FRAME_CACHE_SIZE)
+		done_sixel_frame(sixel_frames.prev);
+}
+
+void
+done_sixel_frames(void)
+{
+	ELOG
+	while (!list_empty(sixel_frames))
+		done_sixel_frame(sixel_frames.next);
+}
+
+unsigned int
+get_new_image_id(void)
+{
+	ELOG
+	static unsigned int last_image_id;
+
+	/* The frames of the freed images are only dropped from the cache
+	 * when they are used least, so the ids must not repeat. */
+	return ++last_image_id;
+}
+
+/** Images are drawn over the text, so a frame has to be sent again only
+ * when it is new or when some chars were sent to its rows. */
 void
 try_to_draw_images(struct terminal *term, struct string *text)
 {
@@ -796,21 +914,57 @@ try_to_draw_images(struct terminal *term, struct string *text)
 		return;
 	}
 	foreach (im, term->images) {
+		int yend = im->cy + (im->height + term->cell_height - 1) / term->cell_height - 1;
+
+		if (im->sent && !is_screen_drawn(term->screen, im->cy, yend)) {
+			sixel_bytes_saved += im->pixels.length;
+			continue;
+		}
 		add_cursor_move_to_string(text, im->cy + 1, im->cx + 1);
 		add_string_to_string(text, &im->pixels);
+		sixel_bytes_sent += im->pixels.length;
+		im->sent = 1;
 	}
 }
 
-void
-delete_image(struct image *im)
+static void
+done_image(struct image *im)
 {
 	ELOG
-	del_from_list(im);
 	done_string(&im->pixels);
 	el_string_unref(im->data);
 	mem_free(im);
 }
 
+void
+add_image_frame(struct terminal *term, struct image *frame)
+{
+	ELOG
+	struct image *im;
+
+	foreach (im, term->images) {
+		if (im->id == frame->id
+		    && im->cx == frame->cx && im->cy == frame->cy
+		    && im->x == frame->x && im->y == frame->y
+		    && im->w == frame->w && im->h == frame->h
+		    && im->width == frame->width && im->height == frame->height) {
+			im->stale = 0;
+			done_image(frame);
+			return;
+		}
+	}
+
+	add_to_list(term->images, frame);
+}
+
+void
+delete_image(struct image *im)
+{
+	ELOG
+	del_from_list(im);
+	done_image(im);
+}
+
 int
 add_image_to_document(struct document *doc, char *data, int datalen, int lineno, struct image **imagine)
 {
@@ -878,6 +1032,7 @@ add_image_to_document(struct document *doc, char *data, int datalen, int lineno,
 	if (SIXEL_FAILED(status)) {
 		goto end;
 	}
+	im->id = get_new_image_id();
 	im->cy = lineno;
 	im->cx = 0;
 	im->width = width;
@@ -913,7 +1068,9 @@ copy_frame(struct image *src, struct el_box *box, int cell_width, int cell_heigh
 	int height;
 	int x;
 	int y;
+	int clipx, clipy, clipwidth, clipheight;
 	struct image *dest = mem_calloc(1, sizeof(*dest));
+	sixel_allocator_t *el_sixel_allocator = NULL;
 	SIXELSTATUS status;
 
 	if (!dest) {
@@ -924,7 +1081,38 @@ copy_frame(struct image *src, struct el_box *box, int cell_width, int cell_heigh
 		mem_free(dest);
 		return NULL;
 	}
-	sixel_allocator_t *el_sixel_allocator = NULL;
+	x = src->cx - dx;
+	y = src->cy - dy;
+
+	clipx = x >= 0 ? 0 : (-x * cell_width);
+	clipy = y >= 0 ? 0 : (-y * cell_height);
+	clipwidth = box->width * cell_width;
+	clipheight = box->height * cell_height;
+
+	if (src->width < clipwidth) {
+		clipwidth = src->width;
+	}
+	if (src->height < clipheight) {
+		clipheight = src->height;
+	}
+
+	if (x * cell_width + clipwidth >= box->width * cell_width) {
+		clipwidth = (box->width * cell_width - x * cell_width);
+	}
+	if (y * cell_height + clipheight >= box->height * cell_height) {
+		clipheight = ((box->height * cell_height - y * cell_height) / 6) * 6;
+	}
+	dest->id = src->id;
+	dest->x = clipx;
+	dest->y = clipy;
+	dest->w = clipwidth;
+	dest->h = clipheight;
+	dest->cx = x < 0 ? 0 : x;
+	dest->cy = y < 0 ? 0 : y;
+
+	if (get_cached_sixel_frame(dest, cell_width, cell_height)) {
+		goto cached;
+	}
 #ifdef CONFIG_MEMCOUNT
 	el_sixel_allocator = init_sixel_allocator();
 #endif
@@ -971,27 +1159,11 @@ copy_frame(struct image *src, struct el_box *box, int cell_width, int cell_heigh
 	if (SIXEL_FAILED(status)) {
 		goto end;
 	}
-	x = src->cx - dx;
-	y = src->cy - dy;
+	encoder->clipx = clipx;
+	encoder->clipy = clipy;
+	encoder->clipwidth = clipwidth;
+	encoder->clipheight = clipheight;
 
-	encoder->clipx = x >= 0 ? 0 : (-x * cell_width);
-	encoder->clipy = y >= 0 ? 0 : (-y * cell_height);
-	encoder->clipwidth = box->width * cell_width;
-	encoder->clipheight = box->height * cell_height;
-
-	if (src->width < encoder->clipwidth) {
-		encoder->clipwidth = src->width;
-	}
-	if (src->height < encoder->clipheight) {
-		encoder->clipheight = src->height;
-	}
-
-	if (x * cell_width + encoder->clipwidth >= box->width * cell_width) {
-		encoder->clipwidth = (box->width * cell_width - x * cell_width);
-	}
-	if (y * cell_height + encoder->clipheight >= box->height * cell_height) {
-		encoder->clipheight = ((box->height * cell_height - y * cell_height) / 6) * 6;
-	}
 	status = sixel_output_new(&output, sixel_write_callback, &dest->pixels, el_sixel_allocator);
 
 	if (SIXEL_FAILED(status)) {
@@ -1002,17 +1174,19 @@ copy_frame(struct image *src, struct el_box *box, int cell_width, int cell_heigh
 	if (SIXEL_FAILED(status)) {
 		goto end;
 	}
-	dest->cx = x < 0 ? 0 : x;
-	dest->cy = y < 0 ? 0 : y;
-	dest->width = encoder->clipx >= src->width ? 0 : sixel_frame_get_width(frame);
-	dest->height = encoder->clipy >= src->height ? 0 : sixel_frame_get_height(frame);
+	dest->width = clipx >= src->width ? 0 : sixel_frame_get_width(frame);
+	dest->height = clipy >= src->height ? 0 : sixel_frame_get_height(frame);
+
+	if (dest->width && dest->height) {
+		cache_sixel_frame(dest, cell_width, cell_height);
+	}
 end:
 	sixel_frame_unref(frame);
 	sixel_output_unref(output);
 	sixel_decoder_unref(decoder);
 	sixel_encoder_unref(encoder);
 	sixel_allocator_unref(el_sixel_allocator);
-
+cached:
 	if (!dest->width || !dest->height) {
 		done_string(&dest->pixels);
 		mem_free(dest);
@@ -1064,6 +1238,18 @@ copy_sixel2_frame(struct image *src, struct el_box *box, int cell_width, int cel
 	dest->cy = cy < 0 ? 0 : cy;
 	dest->width = src->width;
 	dest->height = src->height;
+	dest->id = src->id;
+
+	if (!init_string(&dest->pixels)) {
+		el_string_unref(dest->data);
+		mem_free(dest);
+		return NULL;
+	}
+
+	if (!get_cached_sixel_frame(dest, cell_width, cell_height)) {
+		encode(&dest->pixels, (unsigned char *)dest->data->data, src->width, dest->h, dest->x, dest->y, dest->w, 1024);
+		cache_sixel_frame(dest, cell_width, cell_height);
+	}
 
 //	dest->ID = src->ID;
 	dest->image_number = src->image_number;
@@ -1072,3 +1258,31 @@ copy_sixel2_frame(struct image *src, struct el_box *box, int cell_width, int cel
 
 	return dest;
 }
+
+unsigned longlong
+get_sixel_bytes_sent(void)
+{
+	ELOG
+	return sixel_bytes_sent;
+}
+
+unsigned longlong
+get_sixel_bytes_saved(void)
+{
+	ELOG
+	return sixel_bytes_saved;
+}
+
+long
+get_sixel_frames_encoded(void)
+{
+	ELOG
+	return sixel_frames_encoded;
+}
+
+long
+get_sixel_frames_cached(void)
+{
+	ELOG
+	return sixel_frames_cached;
+}
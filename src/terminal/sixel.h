@@ -27,11 +27,24 @@ struct image {
 	int width;
 	int height;
 	int image_number;
+	/** Identifies a document image and the frames cut from it. */
+	unsigned int id;
 	unsigned int sixel2:1;
+	/** Whether the frame is on the terminal already. */
+	unsigned int sent:1;
+	/** Set by draw_doc() for the frames which were not drawn again. */
+	unsigned int stale:1;
 };
 
 void delete_image(struct image *im);
 
+/** Returns an id for a new document image. */
+unsigned int get_new_image_id(void);
+
+/** Adds the frame to the terminal images, unless the same frame is there
+ * already, in which case the old one stays and @frame is freed. */
+void add_image_frame(struct terminal *term, struct image *frame);
+
 void try_to_draw_images(struct terminal *term, struct string *text);
 
 /* return height of image in terminal rows */
@@ -40,6 +53,18 @@ int add_image_to_document(struct document *doc, char *data, int datalen, int lin
 struct image *copy_frame(struct image *src, struct el_box *box, int cell_width, int cell_height, int dx, int dy);
 struct image *copy_sixel2_frame(struct image *src, struct el_box *box, int cell_width, int cell_height, int dx, int dy);
 
+/** Frees the cache of the encoded frames. */
+void done_sixel_frames(void);
+
+/** Returns how many bytes of sixel frames were sent to the terminals and
+ * how many were not, since the frames were there already. */
+unsigned longlong get_sixel_bytes_sent(void);
+unsigned longlong get_sixel_bytes_saved(void);
+/** Returns how many frames were encoded and how many were found in the
+ * cache of the encoded frames. */
+long get_sixel_frames_encoded(void);
+long get_sixel_frames_cached(void);
+
 #endif
 
 #ifdef __cplusplus
@@ -290,8 +290,8 @@ destroy_terminal(struct terminal *term)
 	mem_free_if(term->interlink);
 
 	if (term->blocked != -1) {
-		close(term->blocked);
 		clear_handlers(term->blocked);
+		close(term->blocked);
 	}
 
 	del_from_list(term);
@@ -357,8 +357,8 @@ void
 close_handle(void *h)
 {
 	ELOG
-	close((intptr_t) h);
 	clear_handlers((intptr_t) h);
+	close((intptr_t) h);
 }
 
 static void
@@ -627,6 +627,15 @@ attach_terminal(int in, int out, int ctl, void *info, int len)
 	return term;
 }
 
+static void
+done_terminal_images(struct module *xxx)
+{
+	ELOG
+#ifdef CONFIG_LIBSIXEL
+	done_sixel_frames();
+#endif
+}
+
 static struct module *terminal_submodules[] = {
 	&terminal_screen_module,
 	NULL
@@ -642,6 +651,6 @@ struct module terminal_module = struct_module(
 	/* submodules: */	terminal_submodules,
 	/* data: */		NULL,
 	/* init: */		NULL,
-	/* done: */		NULL,
+	/* done: */		done_terminal_images,
 	/* getname: */	NULL
 );
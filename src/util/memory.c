@@ -142,7 +142,10 @@ mem_mmap_alloc(size_t size)
 {
 	//ELOG
 	if (size) {
-		void *p = mmap(NULL, round_size(size), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANON, -1, 0);
+		/* The mapping must be private: a shared anonymous mapping
+		 * is backed by a fixed size object, so touching the pages
+		 * gained by mremap() would raise SIGBUS. */
+		void *p = mmap(NULL, round_size(size), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
 
 		if (p != MAP_FAILED)
 			return p;
@@ -70,7 +70,7 @@ secsave_errno_T secsave_errno = SS_ERR_NONE;
 /** Open a file for writing in a secure way. @returns a pointer to a
  * structure secure_save_info on success, or NULL on failure. */
 static struct secure_save_info *
-secure_open_umask(char *file_name)
+secure_open_umask(char *file_name, int state_file)
 {
 	ELOG
 	struct stat st;
@@ -81,8 +81,9 @@ secure_open_umask(char *file_name)
 	/* XXX: This is inherently evil and has no place in util/, which
 	 * should be independent on such stuff. What do we do, except blaming
 	 * Jonas for noticing it? --pasky */
-	if ((get_cmd_opt_bool("no-connect")
-	     || get_cmd_opt_int("session-ring"))
+	if (state_file
+	    && (get_cmd_opt_bool("no-connect")
+		|| get_cmd_opt_int("session-ring"))
 	    && !get_cmd_opt_bool("touch-files")) {
 		secsave_errno = SS_ERR_DISABLED;
 		return NULL;
@@ -202,9 +203,8 @@ end:
 	return NULL;
 }
 
-/* @relates secure_save_info */
-struct secure_save_info *
-secure_open(char *file_name)
+static struct secure_save_info *
+secure_open_do(char *file_name, int state_file)
 {
 	ELOG
 	struct secure_save_info *ssi;
@@ -217,12 +217,32 @@ secure_open(char *file_name)
 #endif
 
 	saved_mask = umask(mask);
-	ssi = secure_open_umask(file_name);
+	ssi = secure_open_umask(file_name, state_file);
 	umask(saved_mask);
 
 	return ssi;
 }
 
+/* @relates secure_save_info */
+struct secure_save_info *
+secure_open(char *file_name)
+{
+	ELOG
+	return secure_open_do(file_name, 1);
+}
+
+/** Like secure_open() but also works with -no-connect and -session-ring,
+ * for files which hold no user state, like the disk cache.  As several
+ * instances may then write the same file, the caller has to make that safe,
+ * for example by locking.
+ * @relates secure_save_info */
+struct secure_save_info *
+secure_open_cache(char *file_name)
+{
+	ELOG
+	return secure_open_do(file_name, 0);
+}
+
 /** Close a file opened with secure_open(). @returns 0 on success,
  * errno or -1 on failure.
  * @relates secure_save_info */
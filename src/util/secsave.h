@@ -41,6 +41,7 @@ struct secure_save_info {
 };
 
 struct secure_save_info *secure_open(char *);
+struct secure_save_info *secure_open_cache(char *);
 
 int secure_close(struct secure_save_info *);
 
@@ -53,6 +53,7 @@ DUMP_FUNCTION_SPECIALIZED(struct document *document, struct dump_output *out)
 #ifdef DUMP_COLOR_MODE_NONE
 		int white = 0;
 #endif
+		struct screen_char *chars;
 		int x;
 
 #ifdef DUMP_COLOR_MODE_16
@@ -65,6 +66,7 @@ DUMP_FUNCTION_SPECIALIZED(struct document *document, struct dump_output *out)
 		write_true_color("48", background, out);
 #endif	/* DUMP_COLOR_MODE_TRUE */
 
+		chars = get_line_chars(document, y);
 		for (x = 0; x < document->data[y].length; x++) {
 			if (dumplinks) {
 				if (is_start_of_link(document, x, y, &current_link_number, &next_link)) {
@@ -78,23 +80,23 @@ DUMP_FUNCTION_SPECIALIZED(struct document *document, struct dump_output *out)
 			unsigned char c;
 #endif  /* !DUMP_CHARSET_UTF8 */
 			const unsigned char attr
-				= document->data[y].ch.chars[x].attr;
+				= chars[x].attr;
 #ifdef DUMP_COLOR_MODE_16
 			const unsigned char color1
-				= document->data[y].ch.chars[x].c.color[0];
+				= chars[x].c.color[0];
 #elif defined(DUMP_COLOR_MODE_256)
 			const unsigned char color1
-				= document->data[y].ch.chars[x].c.color[0];
+				= chars[x].c.color[0];
 			const unsigned char color2
-				= document->data[y].ch.chars[x].c.color[1];
+				= chars[x].c.color[1];
 #elif defined(DUMP_COLOR_MODE_TRUE)
 			const unsigned char *const new_foreground
-				= &document->data[y].ch.chars[x].c.color[0];
+				= &chars[x].c.color[0];
 			const unsigned char *const new_background
-				= &document->data[y].ch.chars[x].c.color[3];
+				= &chars[x].c.color[3];
 #endif	/* DUMP_COLOR_MODE_TRUE */
 
-			c = document->data[y].ch.chars[x].data;
+			c = chars[x].data;
 
 #ifdef DUMP_CHARSET_UTF8
 			if (c == UCS_NO_CHAR) {
@@ -37,7 +37,6 @@
 #include "terminal/screen.h"
 #ifdef CONFIG_LIBSIXEL
 #include "terminal/sixel.h"
-#include "terminal/sixel2.h"
 #endif
 #include "terminal/tab.h"
 #include "terminal/terminal.h"
@@ -271,6 +270,7 @@ draw_doc(struct session *ses, struct document_view *doc_view, int active)
 	struct terminal *term;
 	struct el_box *box;
 	struct screen_char *last = NULL;
+	struct screen_char last_char;
 
 	int vx, vy;
 	int y;
@@ -394,6 +394,8 @@ draw_doc(struct session *ses, struct document_view *doc_view, int active)
 	     y < int_min(doc_view->document->height, box->height + vy);
 	     y++) {
 		struct screen_char *first = NULL;
+		/* Packed lines are unpacked only as they get visible. */
+		struct screen_char *chars = get_line_chars(doc_view->document, y);
 		int i, j;
 		int last_index = 0;
 		int st = int_max(vx, 0);
@@ -404,13 +406,15 @@ draw_doc(struct session *ses, struct document_view *doc_view, int active)
 		if (en - st > 0) {
 			if (st - vx >= 0) {
 				draw_line(term, box->x + st - vx, box->y + y - vy,
-				  en - st,
-				  &doc_view->document->data[y].ch.chars[st]);
+				  en - st, &chars[st]);
 			}
 
 			for (i = en - 1; i >= 0; --i) {
-				if (doc_view->document->data[y].ch.chars[i].data != ' ' && doc_view->document->data[y].ch.chars[i].data != UCS_NO_BREAK_SPACE) {
-					last = &doc_view->document->data[y].ch.chars[i];
+				if (chars[i].data != ' ' && chars[i].data != UCS_NO_BREAK_SPACE) {
+					/* Kept for the following lines, which
+					 * may be unpacked to the same place. */
+					copy_struct(&last_char, &chars[i]);
+					last = &last_char;
 					last_index = i + 1;
 					break;
 				}
@@ -418,8 +422,8 @@ draw_doc(struct session *ses, struct document_view *doc_view, int active)
 		}
 
 		for (i = st; i < max; i++) {
-			if (doc_view->document->data[y].ch.chars[i].data != ' '  && doc_view->document->data[y].ch.chars[i].data != UCS_NO_BREAK_SPACE) {
-				first = &doc_view->document->data[y].ch.chars[i];
+			if (chars[i].data != ' '  && chars[i].data != UCS_NO_BREAK_SPACE) {
+				first = &chars[i];
 				break;
 			}
 		}
@@ -484,8 +488,10 @@ draw_doc(struct session *ses, struct document_view *doc_view, int active)
 			int found = vs->plain;
 
 			if (!found) {
+				struct screen_char *chars = get_line_chars(doc_view->document, im.cy);
+
 				for (;cx < data[im.cy].length; cx++) {
-					if (im.number == data[im.cy].ch.chars[cx].number) {
+					if (im.number == chars[cx].number) {
 						found = 1;
 						break;
 					}
@@ -532,12 +538,11 @@ draw_doc(struct session *ses, struct document_view *doc_view, int active)
 	if (!screen || !screen->was_dirty) {
 		return;
 	}
-	while (!list_empty(term->images)) {
-		struct image *im = (struct image *)term->images.next;
-		int yend = im->cy + (im->height + term->cell_height - 1) / term->cell_height;
+	struct image *frame, *next;
 
-		set_screen_dirty_image(term->screen, im->cy, yend);
-		delete_image(im);
+	/* The frames drawn again stay on the terminal. */
+	foreach (frame, term->images) {
+		frame->stale = 1;
 	}
 
 	if (term->sixel) {
@@ -565,8 +570,10 @@ draw_doc(struct session *ses, struct document_view *doc_view, int active)
 			int found = vs->plain;
 
 			if (!found) {
+				struct screen_char *chars = get_line_chars(doc_view->document, im.cy);
+
 				for (;x < data[im.cy].length; x++) {
-					if (im.image_number == data[im.cy].ch.chars[x].number) {
+					if (im.image_number == chars[x].number) {
 						found = 1;
 						break;
 					}
@@ -592,10 +599,7 @@ draw_doc(struct session *ses, struct document_view *doc_view, int active)
 				if (im_copy2) {
 					im_copy2->cx += box->x;
 					im_copy2->cy += box->y;
-					init_string(&im_copy2->pixels);
-					encode(&im_copy2->pixels, (unsigned char *)im_copy2->data->data, im.width, im_copy2->h, im_copy2->x, im_copy2->y, im_copy2->w, 1024);
-					///fputs(im_copy2->pixels.source, stderr);
-					add_to_list(term->images, im_copy2);
+					add_image_frame(term, im_copy2);
 				}
 			} else {
 				struct image *im_copy = copy_frame(&im, box, term->cell_width, term->cell_height, vs->x, vs->y);
@@ -603,11 +607,22 @@ draw_doc(struct session *ses, struct document_view *doc_view, int active)
 				if (im_copy) {
 					im_copy->cx += box->x;
 					im_copy->cy += box->y;
-					add_to_list(term->images, im_copy);
+					add_image_frame(term, im_copy);
 				}
 			}
 		}
 	}
+
+	foreachsafe (frame, next, term->images) {
+		int yend;
+
+		if (!frame->stale) {
+			continue;
+		}
+		yend = frame->cy + (frame->height + term->cell_height - 1) / term->cell_height;
+		set_screen_dirty_image(term->screen, frame->cy, yend);
+		delete_image(frame);
+	}
 	}
 #endif
 }
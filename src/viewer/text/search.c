@@ -161,17 +161,18 @@ get_srch(struct document *document)
 		for (y = node->box.y; y < height; y++) {
 			int width = int_min(node->box.x + node->box.width,
 			                    document->data[y].length);
+			struct screen_char *chars = get_line_chars(document, y);
 
 			for (x = node->box.x;
-			     x < width && document->data[y].ch.chars[x].data <= ' ';
+			     x < width && chars[x].data <= ' ';
 			     x++);
 
 			for (; x < width; x++) {
-				UCHAR c = document->data[y].ch.chars[x].data;
+				UCHAR c = chars[x].data;
 				int count = 0;
 				int xx;
 
-				if (document->data[y].ch.chars[x].attr & SCREEN_ATTR_UNSEARCHABLE)
+				if (chars[x].attr & SCREEN_ATTR_UNSEARCHABLE)
 					continue;
 
 #ifdef CONFIG_UTF8
@@ -190,7 +191,7 @@ get_srch(struct document *document)
 				}
 
 				for (xx = x + 1; xx < width; xx++) {
-					if ((unsigned char)document->data[y].ch.chars[xx].data < ' ')
+					if ((unsigned char)chars[xx].data < ' ')
 						continue;
 					count = xx - x;
 					break;
@@ -1581,7 +1582,7 @@ get_document_char(struct document *document, int x, int y)
 {
 	ELOG
 	return (document->height > y && document->data[y].length > x)
-		? document->data[y].ch.chars[x].data : 0;
+		? get_line_chars(document, y)[x].data : 0;
 }
 
 static void
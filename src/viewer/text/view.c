@@ -1118,6 +1118,7 @@ copy_to_clipboard2(struct document_view *doc_view)
 
 	for (y = starty; y <= endy; y++) {
 		int ex = int_min(endx, document->data[y].length - 1);
+		struct screen_char *chars = get_line_chars(document, y);
 		int rls = remove_leading_space;
 		int space_counter = 0;
 		int x;
@@ -1128,7 +1129,7 @@ copy_to_clipboard2(struct document_view *doc_view)
 #else
 			unsigned char c;
 #endif
-			c = document->data[y].ch.chars[x].data;
+			c = chars[x].data;
 
 #ifdef CONFIG_UTF8
 			if (utf8 && c == UCS_NO_CHAR) {